@@ -0,0 +1,319 @@
+#include <string>
+#include <map>
+#include <vector>
+#include <chrono>
+#include <fstream>
+#include <filesystem>
+#include <functional>
+#include <algorithm>
+#include <numeric>
+#include <stdexcept>
+#include <fmt/core.h>
+#include <nlohmann/json.hpp>
+#include "tasks.hpp"
+#include "task-plan.hpp"
+#include "log-parser.hpp"
+
+/*============================================
+| Declaration
+==============================================*/
+// size in bytes of the chunks of logs given to the parser (size of the pipe reads)
+constexpr std::size_t g_chunk_size = 64 * 1024;
+
+// size in bytes of the sliding window used to parse variables in the logs
+constexpr std::size_t g_parse_window_size = 64 * 1024;
+
+/*============================================
+| Function definitions
+==============================================*/
+// execute a benchmark case and print its results as a json line:
+//  {"name", "items", "iterations", "min-us", "median-us", "mean-us", "max-us", "items-per-s"}
+void run(const std::string& name,
+         const std::string& filter,
+         const std::size_t items,
+         const std::size_t iterations,
+         const std::function<void()>& fct)
+{
+  if (!filter.empty() && (name.find(filter) == std::string::npos))
+    return;
+
+  // the first execution warms up the caches and allocator
+  using clock = std::chrono::steady_clock;
+  fct();
+  std::vector<double> times;
+  for (std::size_t i = 0; i < iterations; ++i)
+  {
+    const auto start = clock::now();
+    fct();
+    times.push_back(std::chrono::duration<double, std::micro>(clock::now() - start).count());
+  }
+  std::sort(times.begin(), times.end());
+  const double mean = std::accumulate(times.begin(), times.end(), 0.0) / static_cast<double>(times.size());
+  const double median = times[times.size() / 2];
+  nlohmann::ordered_json result = {
+    { "name", name },
+    { "items", items },
+    { "iterations", iterations },
+    { "min-us", times.front() },
+    { "median-us", median },
+    { "mean-us", mean },
+    { "max-us", times.back() },
+    { "items-per-s", (median > 0.0) ? (1e6 * static_cast<double>(items) / median) : 0.0 } };
+  fmt::print("{}\n", result.dump());
+  std::fflush(stdout);
+}
+
+// write a synthetic tasks file: groups of 100 tasks, each task depends on the previous one of its group
+std::filesystem::path write_tasks_file(const std::filesystem::path& dir, const std::size_t tasks)
+{
+  json db = {
+    { "description", "benchmark ${name}" },
+    { "variables", json::array({ { { "name", "bench" } }, { { "root", "${dir}/${name}" } } }) },
+    { "tasks-groups", json::array() } };
+  for (std::size_t i = 0; i < tasks; ++i)
+  {
+    if (i % 100 == 0)
+      db["tasks-groups"].push_back({ { "id", fmt::format("g{}", i / 100) }, { "tasks", json::array() } });
+    json task = {
+      { "id", fmt::format("t{}", i) },
+      { "description", fmt::format("task {} of ${{name}}", i) },
+      { "cmd", "${tool}" },
+      { "args", fmt::format("--input ${{root}}/in{0}.txt --output ${{root}}/out{0}.txt", i) },
+      { "parse-variables", json::array({ { { fmt::format("v{}", i), "value=([0-9]+)" } } }) } };
+    if (i % 100)
+      task["depends-on"] = fmt::format("t{}", i - 1);
+    db["tasks-groups"].back()["tasks"].push_back(std::move(task));
+  }
+  const std::filesystem::path path = dir / fmt::format("tasks-{}.json", tasks);
+  std::ofstream file(path, std::ios::binary);
+  file << db.dump(2);
+  return path;
+}
+
+int main(int argc, char** argv)
+{
+  // parse command-line arguments: [--quick] [--filter <name>]
+  bool quick = false;
+  std::string filter;
+  for (int i = 1; i < argc; ++i)
+  {
+    const std::string arg = argv[i];
+    if (arg == "--quick")
+      quick = true;
+    else if ((arg == "--filter") && (i + 1 < argc))
+      filter = argv[++i];
+    else
+    {
+      fmt::print("usage: {} [--quick] [--filter <name>]\n", argv[0]);
+      return -1;
+    }
+  }
+  const std::size_t scale = quick ? 10 : 1;
+
+  try
+  {
+    // update_var(): many references in a single string
+    {
+      var_map vars;
+      std::string str;
+      for (std::size_t i = 0; i < 1000; ++i)
+      {
+        vars.set(fmt::format("v{}", i), fmt::format("value-{}", i));
+        str += fmt::format("text {} ${{v{}}} ", i, i);
+      }
+      const var_env env = var_env().push(vars);
+      run("update_var/many-references", filter, 1000, 200 / scale, [&]() { update_var(str, env); });
+    }
+
+    // update_var(): references nested in paths
+    {
+      var_map vars;
+      vars.set("root", "/tmp/benchmark");
+      std::string str;
+      for (std::size_t i = 0; i < 200; ++i)
+      {
+        vars.set(fmt::format("dir{}", i), fmt::format("directory-{}", i));
+        str += fmt::format("--file \"$[${{root}}/${{dir{}}}/file.txt]\" ", i);
+      }
+      const var_env env = var_env().push(vars);
+      run("update_var/nested-paths", filter, 200, 200 / scale, [&]() { update_var(str, env); });
+    }
+
+    // variable environment: each task sees the variables of the previous one and produces a new value
+    for (const std::size_t count : { 1000, 100000 })
+    {
+      var_map globals;
+      globals.set("root", "/tmp/benchmark");
+      const var_env env = var_env().push(globals);
+      const var_template tpl("${root}/${v0}/${v63}");
+      std::vector<var_symbol> symbols;
+      for (std::size_t i = 0; i < 64; ++i)
+        symbols.push_back(var_symbols::intern(fmt::format("v{}", i)));
+      run(fmt::format("var_env/chain-{}", count), filter, count, std::max<std::size_t>(1, 100000 / count / scale), [&]() {
+        var_map vars;
+        for (std::size_t i = 0; i < count; ++i)
+        {
+          var_map task_vars = vars;
+          task_vars.set(symbols[i % symbols.size()], "value");
+          if (i >= symbols.size())
+            tpl.render(env.push(task_vars));
+          vars = std::move(task_vars);
+        }
+        });
+    }
+
+    // deadlines of the running tasks: timers added and expired by the wheel, registration of a process by the watchdog
+    for (const std::size_t count : { 1000, 100000 })
+    {
+      run(fmt::format("timer_wheel/{}", count), filter, count, std::max<std::size_t>(1, 100000 / count / scale), [&]() {
+        timer_wheel wheel;
+        std::size_t expired = 0;
+        for (std::size_t i = 0; i < count; ++i)
+          wheel.add(1 + (i * 7919) % 100000, i);
+        wheel.advance(100000, [&](const std::uint64_t, const std::uint64_t) { ++expired; });
+        if (expired != count)
+          throw std::runtime_error("timer_wheel: wrong number of expired timers");
+        });
+    }
+    {
+      watchdog dog;
+      std::unique_ptr<process_runner> runner = create_process_runner();
+      watch_options options;
+      options.timeout = std::chrono::milliseconds(60000);
+      options.idle_timeout = std::chrono::milliseconds(10000);
+      run("watchdog/watch", filter, 10000, 20 / scale, [&]() {
+        for (std::size_t i = 0; i < 10000; ++i)
+        {
+          watchdog::watch watch(dog, *runner, options);
+          watch.touch();
+        }
+        });
+    }
+
+    // live metrics: registration of the running tasks and their output
+    {
+      task_metrics metrics;
+      run("metrics/task", filter, 10000, 20 / scale, [&]() {
+        metrics.queue(10000);
+        for (std::size_t i = 0; i < 10000; ++i)
+        {
+          task_metrics::task task(metrics, "benchmark");
+          for (int k = 0; k < 8; ++k)
+            task.output(g_chunk_size);
+          task.done();
+        }
+        });
+    }
+
+    // parse_cmd(): long lists of --variables
+    for (const std::size_t count : { 100, 10000 })
+    {
+      std::vector<std::string> args = { "k0:/opt/benchmark" };
+      for (std::size_t i = 1; i < count; ++i)
+        args.push_back(fmt::format("k{}:${{k0}}/value-{}-${{k{}}}", i, i, i / 2));
+      run(fmt::format("parse_cmd/{}", count), filter, count, std::max<std::size_t>(1, 100000 / count / scale), [&]() { parse_cmd(args); });
+    }
+
+    // foreach: split 20k items of a list in batches within the command-line limit
+    {
+      std::string list;
+      for (std::size_t i = 0; i < 20000; ++i)
+        list += fmt::format("src/module-{}/file-{}.cpp\n", i / 100, i);
+      var_map list_vars;
+      list_vars.set("list", list);
+      const var_env env = var_env().push(list_vars);
+      task_foreach foreach;
+      foreach.items.emplace_back("${list}");
+      foreach.var = "files";
+      foreach.batch = 0;
+      const var_template args("-c -o out ${files}");
+      run("foreach/batches", filter, 20000, 20 / scale, [&]() {
+        const std::vector<std::string> items = get_foreach_items(foreach, env);
+        get_foreach_batches(foreach, items, [&](const std::string& value) -> std::size_t {
+          var_env item_vars = env;
+          item_vars.set(foreach.var, value);
+          return args.render(item_vars).size();
+          });
+        });
+    }
+
+    // parse_json() and build_tasks_graph() on synthetic tasks files - load_plan() from the compiled file
+    const std::filesystem::path dir = std::filesystem::temp_directory_path() / "AutoLaunch-benchmark";
+    std::filesystem::create_directories(dir);
+    var_map cmd_vars;
+    cmd_vars.set("dir", dir.generic_string());
+    cmd_vars.set("tool", NOOP_PATH);
+    for (const std::size_t tasks : { 10, 1000, 10000, 100000 })
+    {
+      if (quick && (tasks > 10000))
+        continue;
+      const std::filesystem::path path = write_tasks_file(dir, tasks);
+      const std::size_t iterations = std::max<std::size_t>(3, 10000 / tasks / scale);
+      run(fmt::format("parse_json/{}", tasks), filter, tasks, iterations, [&]() {
+        auto [db, vars] = parse_json(path, cmd_vars);
+        build_tasks_graph(db["tasks-groups"]);
+        });
+      run(fmt::format("load_plan/{}", tasks), filter, tasks, iterations, [&]() {
+        const task_plan plan = load_plan(path);
+        get_json_variables(plan, cmd_vars);
+        });
+      std::filesystem::remove(path);
+      std::filesystem::remove(std::filesystem::path(path) += ".plan");
+    }
+
+    // parse-variables extraction on multi-MB logs: the values are at the end of the logs
+    {
+      const std::size_t size = (quick ? 1 : 16) * 1024 * 1024;
+      std::string logs;
+      for (std::size_t i = 0; logs.size() < size; ++i)
+        logs += fmt::format("[{:08}] compiling module {} of the benchmark project\r\n", i, i % 97);
+      logs += "version=1.2.3\r\nchecksum: 0123456789abcdef\r\n";
+      const std::shared_ptr<const pattern_set> patterns = std::make_shared<const pattern_set>(std::vector<pattern_spec>{
+        { "version", "version=([0-9.]+)" },
+        { "checksum", "checksum: ([0-9a-f]+)" },
+        { "missing", "not-found=([0-9]+)" } });
+      run("parse-variables/logs", filter, logs.size(), 5, [&]() {
+        log_parser parser(patterns, g_parse_window_size);
+        for (std::size_t pos = 0; pos < logs.size(); pos += g_chunk_size)
+          parser.parse(logs.substr(pos, g_chunk_size));
+        parser.finish();
+        if (parser.variables().size() != 2)
+          throw std::runtime_error("parse-variables: wrong variables extracted");
+        });
+
+      // every line matches: all the values of the modules are extracted
+      const std::shared_ptr<const pattern_set> all = std::make_shared<const pattern_set>(std::vector<pattern_spec>{
+        { "modules", "compiling module (\\d+)", pattern_spec::match_mode::all, "," },
+        { "version", "version=([0-9.]+)", pattern_spec::match_mode::last } });
+      run("parse-variables/all", filter, logs.size(), 5, [&]() {
+        log_parser parser(all, g_parse_window_size);
+        for (std::size_t pos = 0; pos < logs.size(); pos += g_chunk_size)
+          parser.parse(logs.substr(pos, g_chunk_size));
+        parser.finish();
+        if (parser.variables().at("version") != "1.2.3")
+          throw std::runtime_error("parse-variables: wrong variables extracted");
+        });
+    }
+
+    // end-to-end spawn of no-op tasks
+    {
+      process_stats stats;
+      run("execute_task/noop", filter, 1, 200 / scale, [&]() {
+        execute_task(NOOP_PATH, "", [](const std::string&) {}, false, watch_options(), stats);
+        });
+      watchdog dog;
+      watch_options options;
+      options.timeout = std::chrono::milliseconds(60000);
+      run("execute_task/noop-watchdog", filter, 1, 200 / scale, [&]() {
+        execute_task(NOOP_PATH, "", [](const std::string&) {}, false, options, stats, process_pipes(), process_limits(), &dog);
+        });
+    }
+    std::filesystem::remove_all(dir);
+  }
+  catch (const std::exception& ex)
+  {
+    fmt::print(stderr, "error: {}\n", ex.what());
+    return -1;
+  }
+  return 0;
+}
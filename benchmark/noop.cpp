@@ -0,0 +1,5 @@
+// stand-in executable for the no-op tasks of the benchmark
+int main()
+{
+  return 0;
+}
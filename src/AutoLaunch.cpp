@@ -1,23 +1,50 @@
 ﻿#include <string>
 #include <map>
 #include <filesystem>
-#include <regex>
 #include <fstream>
 #include <stdexcept>
 #include <algorithm>
 #include <condition_variable>
 #include <mutex>
 #include <chrono>
+#include <set>
+#include <vector>
+#include <thread>
+#include <future>
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <cctype>
 #include <signal.h>
 #include <stdbool.h>
 #include <fmt/core.h>
 #include <fmt/color.h>
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
 #include <winpp/console.hpp>
 #include <winpp/parser.hpp>
 #include <winpp/win.hpp>
-#include <winpp/system-mutex.hpp>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include "posix-compat.hpp"
+#endif
 #include <nlohmann/json.hpp>
-using json = nlohmann::ordered_json;
+#include "log-parser.hpp"
+#include "process.hpp"
+#include "task-state.hpp"
+#include "task-checkpoint.hpp"
+#include "tasks.hpp"
+#include "resource-lock.hpp"
+#include "task-trace.hpp"
+#include "log-sink.hpp"
+#include "execution.hpp"
+#include "watchdog.hpp"
+#ifndef _WIN32
+#include "server.hpp"
+#endif
 
 /*============================================
 | Declaration
@@ -29,419 +56,1068 @@ const std::string PROGRAM_VERSION = "1.4.4";
 // default length in characters to align status 
 constexpr std::size_t g_status_len = 80;
 
+// size in bytes of the sliding window used to parse variables in the logs
+constexpr std::size_t g_parse_window_size = 64 * 1024;
+
+// default size in KiB of the last logs displayed when a task fails
+constexpr float g_logs_tail_size = 64.0f;
+
+// default delay in seconds before the first retry of a failed task - doubled at each retry
+constexpr float g_retry_delay = 1.0f;
+
+// maximum delay in seconds between two retries of a failed task
+constexpr float g_max_retry_delay = 300.0f;
+
+// number of tasks displayed in the summary of the trace
+constexpr std::size_t g_trace_summary_size = 10;
+
 /*============================================
 | Function definitions
 ==============================================*/
+// watchdog of the running processes: stopped by ctrl-c
+std::atomic<watchdog*> g_watchdog = nullptr;
+
 // define the function to be called when ctrl-c is sent to process
-void exit_program(int signum)
+//  the running processes are stopped by the watchdog thread: nothing else is safe in a signal handler
+void exit_program(int)
 {
-  fmt::print("event: ctrl-c called => stopping program\n");
+  watchdog* dog = g_watchdog;
+  if (dog)
+    dog->interrupt();
 }
 
 // lambda function to show colored tags
-auto add_tag = [](const fmt::color color, const std::string& text) {
-  fmt::print(fmt::fg(color) | fmt::emphasis::bold, "[{}]\n", text);
+auto add_tag = [](std::FILE* out, const fmt::color color, const std::string& text) {
+  fmt::print(out, fmt::fg(color) | fmt::emphasis::bold, "[{}]\n", text);
 };
 
 // execute a sequence of actions with tags
-void exec(const std::string& str, std::function<void()> fct)
+void exec(std::FILE* out, const std::string& str, std::function<void()> fct)
 {
-  fmt::print(fmt::emphasis::bold, "{:<" + std::to_string(g_status_len) + "}", str + ": ");
+  fmt::print(out, fmt::emphasis::bold, "{:<" + std::to_string(g_status_len) + "}", str + ": ");
   try
   {
     fct();
-    add_tag(fmt::color::green, "OK");
+    add_tag(out, fmt::color::green, "OK");
   }
-  catch (const std::exception& ex)
+  catch (const std::exception&)
   {
-    add_tag(fmt::color::red, "KO");
-    throw ex;
+    add_tag(out, fmt::color::red, "KO");
+    throw;
   }
 }
 
-// replace a substring inside a string
-const std::string replace_string(const std::string& str,
-                                 const std::string& old_value,
-                                 const std::string& new_value)
+// display the list of variables - by order of name
+void display_variables(std::FILE* out, const var_map& variables)
 {
-  const std::size_t pos = str.find(old_value);
-  if (pos != std::string::npos)
-  {
-    std::string new_str = str.substr(0, pos);
-    new_str += new_value;
-    new_str += str.substr(pos + old_value.size());
-    return new_str;
-  }
-  return str;
+  std::vector<std::pair<const std::string*, const std::string*>> sorted;
+  variables.for_each([&](const var_symbol symbol, const std::string& value) {
+    sorted.emplace_back(&var_symbols::name(symbol), &value);
+    });
+  std::sort(sorted.begin(), sorted.end(), [](const auto& a, const auto& b) { return *a.first < *b.first; });
+  for (const auto& [key, value] : sorted)
+    fmt::print(out, "  {:<30}: {}\n", *key, *value);
+  fmt::print(out, "\n");
 }
 
-// replace a variable in string by values stored in variables
-bool replace_vars(std::string& str,
-                  const std::map<std::string, std::string>& variables,
-                  const std::string& old_value,
-                  const std::string& key,
-                  const char old_char = 0,
-                  const char new_char = 0)
+// get the name of the log file of a task: index and id (or description) of the task
+std::string get_log_name(const std::size_t index, const std::string& name)
 {
-  const auto& it = variables.find(key);
-  if (it == variables.end())
-    return false;
-  std::string new_value = it->second;
-  if (old_char != 0 && new_char != 0)
-    std::replace(new_value.begin(), new_value.end(), old_char, new_char);
-  str = replace_string(str, old_value, new_value);
-  return true;
+  std::string str = name.substr(0, 64);
+  for (auto& c : str)
+    if (!std::isalnum(static_cast<unsigned char>(c)) && (c != '-') && (c != '_') && (c != '.'))
+      c = '_';
+  return fmt::format("{:04}-{}.log", index, str);
 }
 
-// update string with existing variables
-const std::string update_var(const std::string& str,
-                             const std::map<std::string, std::string>& variables)
+// display the predicted schedule of the tasks: start, duration and worker of each task
+void display_plan(std::FILE* out,
+                  const std::vector<task_node>& nodes,
+                  const var_env& vars,
+                  const task_history& history,
+                  const std::size_t jobs)
 {
-  // replace sub-string with pattern ${xxx, 'x', 'y'} by their corresponding variable value
-  std::string new_str = str;
-  {
-    std::regex replace_pattern(R"(\$\{([^,\}]+),[^']'(.)',[^']'(.)'\})");
-    do
-    {
-      auto rit = std::sregex_iterator(new_str.begin(), new_str.end(), replace_pattern);
-      if (rit == std::sregex_iterator())
-        break;
-      const std::string old_value = rit->str(0);
-      const std::string key = rit->str(1);
-      const char old_char = rit->str(2).at(0);
-      const char new_char = rit->str(3).at(0);
-      if (!replace_vars(new_str, variables, old_value, key, old_char, new_char))
-        throw std::runtime_error(fmt::format("missing variable: ${{{}}}", key));
-    } while (true);
-  }
-
-  // replace sub-string with pattern ${xxx} by their corresponding variable value
+  const task_schedule schedule = schedule_tasks(nodes, vars, history);
+  const std::vector<planned_task> plan = plan_tasks(nodes, schedule, jobs);
+  auto to_s = [](const task_history::duration& d) { return d.count() / 1000.0; };
+  fmt::print(out, "{} {} jobs\n", fmt::format(fmt::emphasis::bold, "Plan:"), jobs);
+  fmt::print(out, "  {:>10} {:>10} {:>6}  {}\n", "start", "duration", "worker", "task");
+  task_history::duration total(0);
+  std::size_t unknown = 0;
+  for (const auto& t : plan)
   {
-    std::regex replace_pattern(R"(\$\{(.*?)\})");
-    do
-    {
-      auto rit = std::sregex_iterator(new_str.begin(), new_str.end(), replace_pattern);
-      if (rit == std::sregex_iterator())
-        break;
-      const std::string old_value = rit->str(0);
-      const std::string key = rit->str(1);
-      if (!replace_vars(new_str, variables, old_value, key))
-        throw std::runtime_error(fmt::format("missing variable: ${{{}}}", key));
-    } while (true);
+    const task_node& node = nodes[t.idx];
+    fmt::print(out, "  {:>9.2f}s {:>9.2f}s {:>6}  {}{}{}\n",
+      to_s(t.start),
+      to_s(t.end - t.start),
+      t.worker,
+      !node.id.empty() ? node.id : node.description.str(),
+      schedule.known[t.idx] ? "" : " (no history)",
+      t.critical ? fmt::format(fmt::fg(fmt::color::orange) | fmt::emphasis::bold, " *") : "");
+    total = std::max(total, t.end);
+    if (!schedule.known[t.idx])
+      ++unknown;
   }
+  const std::int64_t critical = schedule.ranks.empty() ? 0 : *std::max_element(schedule.ranks.begin(), schedule.ranks.end());
+  fmt::print(out, "{} {:.2f}s (critical path *: {:.2f}s, {} tasks without history)\n\n",
+    fmt::format(fmt::emphasis::bold, "Predicted total time:"),
+    to_s(total),
+    critical / 1000.0,
+    unknown);
+}
 
-  // there shouldn't be any sub-string with pattern ${xxx}
-  if (std::regex_search(new_str, std::regex(R"(\$\{.*?\})")))
-    throw std::runtime_error(fmt::format("this pattern can't be replaced: \"{}\"", new_str));
-
-  // replace sub-string with pattern $[xxx] or $<xxx> by the absolute path with quotes
-  //  surrounded by double-quotes for $[xxx] => "xxx"
-  //  surrounded by single-quotes for $<xxx> => 'xxx'
-  {
-    std::regex replace_pattern(R"(\$([\[<])(.*?)([\]>]))");
-    do
-    {
-      auto rit = std::sregex_iterator(new_str.begin(), new_str.end(), replace_pattern);
-      if (rit == std::sregex_iterator())
-        break;
-      const std::string old_value = rit->str(0);
-      std::string key = rit->str(2);
-      key.erase(std::remove(key.begin(), key.end(), '\"'), key.end());
-      key.erase(std::remove(key.begin(), key.end(), '\''), key.end());
-      char quote;
-      if (rit->str(1).at(0) == '[' && rit->str(3).at(0) == ']')
-        quote = '\"';
-      else if (rit->str(1).at(0) == '<' && rit->str(3).at(0) == '>')
-        quote = '\'';
-      else
-        throw std::runtime_error(fmt::format("wrong pattern detected: \"{}\"", old_value));
-      new_str = replace_string(new_str, old_value, quote + std::filesystem::absolute(std::filesystem::path(key)).string() + quote);
-      new_str = utf8::from_utf8(new_str);
-    } while (true);
-  }
-
-  return new_str;
-};
-
-// parse command-line option as key:value
-std::map<std::string, std::string> parse_cmd(const std::vector<std::string>& vars)
+// execute all the json tasks using a pool of workers
+void execute_tasks(std::vector<task_node>& nodes,
+                   const var_env& vars,
+                   const bool interactive,
+                   const std::size_t jobs,
+                   task_state_db& state_db,
+                   task_history& history,
+                   task_checkpoint& checkpoint,
+                   task_trace& trace,
+                   const std::filesystem::path& log_dir,
+                   execution_env& env)
 {
-  auto split = [](const std::string& str) -> std::pair<std::string, std::string> {
-    std::size_t pos = str.find(':');
-    if (pos == std::string::npos)
-      throw std::runtime_error(fmt::format("invalid command-line option: \"{}\"", str));
-    return std::pair<std::string, std::string>{str.substr(0, pos), str.substr(pos+1)};
+  // lambda helpers
+  // command-line values of the flags: used when neither the task nor its group defines them
+  auto get_bool_value = [&](const std::string& key) -> bool {
+    const std::string* value = vars.find(key);
+    return value ? (*value == "true") : false;
+  };
+  auto get_float_value = [&](const std::string& key) -> float {
+    const std::string* value = vars.find(key);
+    return value ? std::stof(*value) : 0.0f;
+  };
+  const task_flags defaults = {
+    get_bool_value("display"),
+    get_bool_value("debug"),
+    get_bool_value("ignore-error"),
+    get_bool_value("ask-execute"),
+    get_bool_value("ask-continue"),
+    get_bool_value("force"),
+    get_float_value("timeout"),
+    get_float_value("idle-timeout"),
+    vars.find("kill-grace") ? get_float_value("kill-grace") : g_kill_grace.count() / 1000.0f,
+    vars.find("kill-signal") ? *vars.find("kill-signal") : std::string("SIGTERM"),
+    get_float_value("logs-tail"),
+    get_float_value("retries"),
+    vars.find("retry-delay") ? get_float_value("retry-delay") : g_retry_delay };
+  parse_signal(*defaults.kill_signal);
+  auto to_ms = [](const float timeout) -> std::chrono::milliseconds { 
+    return std::chrono::milliseconds(static_cast<std::size_t>(1000.0 * timeout)); 
   };
-  std::map<std::string, std::string> variables;
-  for (const auto& v : vars)
-  {
-    auto [key, value] = split(v);
-    variables[key] = update_var(value, variables);
-  }
-  return variables;
-}
 
-// display the list of variables
-void display_variables(const std::map<std::string, std::string>& variables)
-{
-  for (const auto& v : variables)
-    fmt::print("  {:<30}: {}\n", v.first, v.second);
-  fmt::print("\n");
-}
+  // declare system wide resources to avoid executing tasks in parallel - not locked by default
+  //  an outer level (command-line/group) also holds the resources of its inner levels (group/tasks)
+  //  then all the resources of a level are acquired at once by order of name to avoid deadlocks
+  resource_manager& resources = *env.resources;
 
-// parse tasks json file
-std::pair<json, std::map<std::string, std::string>> parse_json(const std::filesystem::path& path,
-                                                               const std::map<std::string, std::string>& variables)
-{
-  // parse json file
-  std::ifstream file(path);
-  if (!file.good())
-    throw std::runtime_error(fmt::format("can't open file: \"{}\"", path.filename().u8string()));
-  const json& db = json::parse(file);
-
-  // check json format
-  if((!db.contains("description")  || !db["description"].is_string()) ||
-     (!db.contains("variables")    || !db["variables"].is_array())    ||
-     (!db.contains("tasks-groups") || !db["tasks-groups"].is_array()))
-    throw std::runtime_error(fmt::format("invalid tasks file format: \"{}\"", path.filename().u8string()));
-  for (const auto& tasks_groups : db["tasks-groups"])
+  // the waits for the resources, the job slots and the cores are given up when the execution is cancelled (ctrl-c)
+  const std::function<bool()> cancelled = [&]() -> bool { return env.dog && env.dog->cancelled(); };
+
+  // lock the whole process if "protected" command-line option is set
+  std::vector<resource> cmd_resources = get_resources(vars);
+  if (!cmd_resources.empty())
   {
-    if((!tasks_groups.contains("tasks") || !tasks_groups["tasks"].is_array()))
-      throw std::runtime_error(fmt::format("invalid tasks file format: \"{}\" (incorrect tasks group format)", path.filename().u8string()));
-    for (const auto& task : tasks_groups["tasks"])
+    for (const auto& node : nodes)
     {
-      if ((!task.contains("description") || !task["description"].is_string()) ||
-          (!task.contains("cmd")         || !task["cmd"].is_string())         ||
-          (!task.contains("args")        || !task["args"].is_string()))
-        throw std::runtime_error(fmt::format("invalid tasks file format: \"{}\" (incorrect task format)", path.filename().u8string()));
+      cmd_resources.insert(cmd_resources.end(), node.group_resources.begin(), node.group_resources.end());
+      cmd_resources.insert(cmd_resources.end(), node.resources.begin(), node.resources.end());
     }
   }
+  const bool cmd_protected = !cmd_resources.empty();
+  resource_guard cmd_guard;
+  if (cmd_protected)
+  {
+    const auto start = task_trace::clock::now();
+    cmd_guard.lock(resources, cmd_resources, cancelled);
+    trace.add_step("lock command-line resources", start);
+    if (env.metrics)
+      env.metrics->lock_wait(cmd_resources, std::chrono::duration_cast<std::chrono::microseconds>(task_trace::clock::now() - start));
+  }
 
-  // update variables
-  std::map<std::string, std::string> all_vars = variables;
-  std::map<std::string, std::string> json_vars;
-  for (const auto& v : db["variables"])
+  // state of the groups: lock the group from its first task until its last one
+  struct group_state
   {
-    for (const auto& [key, value] : v.items())
+    std::mutex mtx;
+    std::vector<resource> resources;
+    resource_guard guard;
+    std::size_t remaining = 0;
+    std::size_t running = 0;
+  };
+  std::vector<group_state> groups(nodes.empty() ? 0 : nodes.back().group_idx + 1);
+  for (const auto& node : nodes)
+  {
+    group_state& group = groups[node.group_idx];
+    ++group.remaining;
+    if (!node.group_resources.empty())
     {
-      const std::string& new_value = update_var(value.get<std::string>(), all_vars);
-      all_vars[key] = new_value;
-      json_vars[key] = new_value;
+      if (group.resources.empty())
+        group.resources = node.group_resources;
+      group.resources.insert(group.resources.end(), node.resources.begin(), node.resources.end());
     }
   }
 
-  return std::pair<json, std::map<std::string, std::string>>(db, json_vars);
-}
-
-// execute one task - blocking
-void execute_task(const std::string& cmd,
-                  const std::string& args,
-                  std::string& logs,
-                  const bool display,
-                  const bool ignore_error,
-                  const std::chrono::milliseconds& timeout)
-{
-  // define callback for logs
-  logs.clear();
-  auto cb_logs = [&logs, display](const std::string& l) -> void {
-    if (display)
-      fmt::print("{}", l);
-    logs += l;
-  };
-
-  // define callback for the program exit
-  std::mutex mtx;
-  std::condition_variable cv;
-  int exit_code = 0;
-  volatile bool stopped = false;
-  auto cb_exit = [&](const int ret) -> void {
-    exit_code = ret;
-    stopped = true;
-    cv.notify_all();
-  };
-
-  // start process in async mode (to display logs continuously)
-  win::async_process process;
-  process.set_default_error_code(-1);
-  process.set_working_dir(std::filesystem::current_path());
-  if (timeout.count())
-    process.set_timeout(timeout);
-  if (!process.execute(fmt::format("{} {}", cmd, args), cb_logs, cb_exit))
-    throw std::runtime_error("can't start process");
-
-  // wait for process to terminate
-  std::unique_lock<std::mutex> lock(mtx);
-  cv.wait(lock, [&]{ return stopped; });
-  if (!ignore_error && exit_code != 0)
-    throw std::runtime_error(fmt::format("process failed with error: {}", exit_code));
-}
+  // console output must not be mixed between workers
+  std::mutex console_mtx;
+  const bool parallel = (jobs > 1);
 
-// execute all the json tasks
-void execute_tasks(const json& tasks_groups,
-                   std::map<std::string, std::string>& vars,
-                   bool interactive)
-{
-  // lambda helpers
-  auto get_bool_value = [=](const json& obj, const std::string& key) -> bool {
-    if (obj.contains("flags") && obj["flags"].is_object())
-      if (obj["flags"].contains(key) && obj["flags"][key].is_boolean())
-        return obj["flags"][key].get<bool>();    
-    return (vars.find(key) != vars.end()) ? (vars.at(key) == "true") : false; 
-  };
-  auto get_float_value = [=](const json& obj, const std::string& key) -> float { 
-    if (obj.contains("flags") && obj["flags"].is_object())
-      if (obj["flags"].contains(key) && obj["flags"][key].is_number_float())
-        return obj["flags"][key].get<float>();
-    return (vars.find(key) != vars.end()) ? std::stof(vars.at(key)) : 0.0f; 
-  };
-  auto to_ms = [](const float timeout) -> std::chrono::milliseconds { 
-    return std::chrono::milliseconds(static_cast<std::size_t>(1000.0 * timeout)); 
-  };
+  // logs of the tasks: displayed and written in the log files by a dedicated thread
+  log_sink sink(env.out, console_mtx, log_dir);
 
-  // declare system wide mutex to avoid executing tasks in parallel - not locked by default
-  win::system_mutex mtx("Global\\AutoLaunchSystemMtx");
-  std::unique_lock<win::system_mutex> lck(mtx, std::defer_lock);
-  auto lock = [&]() -> void { if (!lck.owns_lock()) lck.lock(); };
-  auto unlock = [&]() -> void { if (lck.owns_lock()) lck.unlock(); };
+  // execute one task of the graph
+  std::atomic<bool> stopped = false;
+  std::atomic<std::size_t> started = 0;
+  //  the pipes of a pipeline are closed if the process of the task is not started
+  //  the cores of the process are reserved by the worker - all if empty
+  auto execute_node = [&](task_node& node, const std::size_t worker, process_pipes pipes, const std::vector<int>& cpus) -> void {
+    struct pipes_guard
+    {
+      process_pipes& pipes;
+      ~pipes_guard() { close_pipes(pipes); }
+    } guard{ pipes };
+    const bool piped = node.stdin_task || node.stdout_task;
 
-  // lock the whole process if "protected" command-line option is set
-  const bool cmd_protected = ((vars.find("protected") != vars.end()) &&
-                              (vars["protected"] == "true"));
-  if (cmd_protected)
-    lock();
+    // record the timings of the task - whatever its result
+    task_timings timings;
+    timings.name = node.description.str();
+    timings.group_idx = node.group_idx;
+    timings.worker = worker;
+    timings.start = task_trace::clock::now();
+    bool recorded = false;
+    std::optional<task_metrics::task> metrics;
+    if (env.metrics)
+      metrics.emplace(*env.metrics, !node.id.empty() ? node.id : node.description.str());
+    ++started;
+    auto record = [&](const std::string& status) -> void {
+      recorded = true;
+      timings.status = status;
+      timings.end = task_trace::clock::now();
+      trace.add_task(std::move(timings));
+    };
+    auto lock_wait = [&](const task_trace::clock::time_point& start, const std::vector<resource>* locked = nullptr) -> void {
+      const auto end = task_trace::clock::now();
+      const auto duration = std::chrono::duration_cast<std::chrono::microseconds>(end - start);
+      timings.lock_wait += duration;
+      timings.spans.push_back({ "lock wait", "lock", start, end });
+      if (locked && env.metrics)
+        env.metrics->lock_wait(*locked, duration);
+    };
 
-  // execute all grouped tasks
-  for (const auto& tasks_group : tasks_groups)
-  {
     // lock the group of tasks if "protected" group flag is set
-    const bool group_protected = (tasks_group.contains("flags") && tasks_group["flags"].is_object()) &&
-                                 (tasks_group["flags"].contains("protected") && tasks_group["flags"]["protected"].is_boolean()) &&
-                                 (tasks_group["flags"]["protected"].get<bool>());
-    if (!cmd_protected && group_protected)
-      lock();
-
-    // execute all tasks of this group
-    for (const auto& task : tasks_group["tasks"])
+    group_state& group = groups[node.group_idx];
+    const bool group_protected = !group.resources.empty();
+    {
+      const auto start = task_trace::clock::now();
+      std::lock_guard<std::mutex> lck(group.mtx);
+      ++group.running;
+      const bool lock_group = !cmd_protected && group_protected && !group.guard.owns_lock();
+      if (lock_group)
+        group.guard.lock(resources, group.resources, cancelled);
+      lock_wait(start, lock_group ? &group.resources : nullptr);
+    }
+    auto release_group = [&](const bool completed) -> void {
+      std::lock_guard<std::mutex> lck(group.mtx);
+      --group.running;
+      if (completed)
+        --group.remaining;
+      if (!group.running && (!group.remaining || stopped))
+        group.guard.unlock();
+    };
+
+    try
     {
       // lock the task if "protected" task flag is set
-      const bool task_protected = (task.contains("protected") && task["protected"].is_boolean()) &&
-                                  (task["protected"].get<bool>());
-      if (!cmd_protected && !group_protected && task_protected)
-        lock();
+      resource_guard task_guard;
+      if (!cmd_protected && !group_protected && !node.resources.empty())
+      {
+        const auto start = task_trace::clock::now();
+        task_guard.lock(resources, node.resources, cancelled);
+        lock_wait(start, &node.resources);
+      }
+      const auto expansion_start = task_trace::clock::now();
+
+      // gather the variables produced by the tasks this one depends on: snapshots shared with them
+      //  the variables of the task override the command-line and tasks file variables
+      for (const auto& d : node.deps)
+        node.vars.merge(nodes[d].vars);
+      var_env task_vars = vars.push(node.vars);
+      std::map<std::string, std::string> produced_vars;
+      auto set_var = [&](const std::string& key, const std::string& value) -> void {
+        const var_symbol symbol = var_symbols::intern(key);
+        task_vars.set(symbol, value);
+        node.vars.set(symbol, value);
+        produced_vars[key] = value;
+      };
 
       // read task execution flags - by order: task/group/command-line - default: false or 0.0f
-      const bool display_flag =                       task.contains("display") ?      task["display"]     .get<bool>()  : get_bool_value(tasks_group, "display");
-      const bool debug_flag =                         task.contains("debug") ?        task["debug"]       .get<bool>()  : get_bool_value(tasks_group, "debug");
-      const bool ignore_error_flag =                  task.contains("ignore-error") ? task["ignore-error"].get<bool>()  : get_bool_value(tasks_group, "ignore-error");
-      const bool ask_execute_flag =                   task.contains("ask-execute") ?  task["ask-execute"] .get<bool>()  : get_bool_value(tasks_group, "ask-execute");
-      const bool ask_continue_flag =                  task.contains("ask-continue") ? task["ask-continue"].get<bool>()  : get_bool_value(tasks_group, "ask-continue");
-      const std::chrono::milliseconds timeout = to_ms(task.contains("timeout") ?      task["timeout"]     .get<float>() : get_float_value(tasks_group, "timeout"));
+      const bool display_flag =                       node.flags.display.value_or(*defaults.display);
+      const bool debug_flag =                         node.flags.debug.value_or(*defaults.debug);
+      const bool ignore_error_flag =                  node.flags.ignore_error.value_or(*defaults.ignore_error);
+      const bool ask_execute_flag =                   node.flags.ask_execute.value_or(*defaults.ask_execute);
+      const bool ask_continue_flag =                  node.flags.ask_continue.value_or(*defaults.ask_continue);
+      const bool force_flag =                         node.flags.force.value_or(*defaults.force);
+      watch_options deadlines;
+      deadlines.timeout =                             to_ms(node.flags.timeout.value_or(*defaults.timeout));
+      deadlines.idle_timeout =                        to_ms(node.flags.idle_timeout.value_or(*defaults.idle_timeout));
+      deadlines.grace =                               to_ms(node.flags.kill_grace.value_or(*defaults.kill_grace));
+      deadlines.signal =                              parse_signal(node.flags.kill_signal.value_or(*defaults.kill_signal));
+      const float logs_tail =                         node.flags.logs_tail.value_or(*defaults.logs_tail);
+      const std::size_t retries =                     static_cast<std::size_t>(std::max(node.flags.retries.value_or(*defaults.retries), 0.0f));
+      const float retry_delay =                       node.flags.retry_delay.value_or(*defaults.retry_delay);
+
+      // expand the items of a "foreach" task and split them in batches (one process per batch)
+      //  the task parameters are rendered with the number of items as item variable
+      std::vector<std::string> items;
+      std::vector<std::pair<std::size_t, std::size_t>> batches;
+      auto with_item = [&](const std::string& value) -> var_env {
+        var_env item_vars = task_vars;
+        item_vars.set(node.foreach->var, value);
+        return item_vars;
+      };
+      std::optional<var_env> foreach_vars;
+      if (node.foreach)
+      {
+        items = get_foreach_items(*node.foreach, task_vars);
+        batches = get_foreach_batches(*node.foreach, items, [&](const std::string& value) -> std::size_t {
+          const var_env item_vars = with_item(value);
+          return node.cmd.render(item_vars).size() + 1 + node.args.render(item_vars).size();
+        });
+        foreach_vars = with_item(fmt::format("<{} items>", items.size()));
+      }
+      const var_env& params_vars = foreach_vars ? *foreach_vars : task_vars;
 
       // read task parameters
-      const std::string& desc = fmt::format("\"{}\"", update_var(task["description"].get<std::string>(), vars));
-      const std::string& cmd = update_var(task["cmd"].get<std::string>(), vars);
-      const std::string& args = update_var(task["args"].get<std::string>(), vars);
+      const std::string& desc = fmt::format("\"{}\"", node.description.render(params_vars));
+      const std::string& cmd = node.cmd.render(params_vars);
+      const std::string& args = node.args.render(params_vars);
+      const bool incremental = !node.inputs.empty() || !node.outputs.empty();
+      std::vector<std::string> inputs;
+      std::vector<std::string> outputs;
+      for (const auto& p : node.inputs)
+        inputs.push_back(p.render(params_vars));
+      for (const auto& p : node.outputs)
+        outputs.push_back(p.render(params_vars));
+      std::string command = fmt::format("{} {}", cmd, args);
+      for (const auto& item : items)
+        command += fmt::format("\n{}", item);
+      timings.name = desc;
+      const auto expansion_end = task_trace::clock::now();
+      timings.expansion = std::chrono::duration_cast<std::chrono::microseconds>(expansion_end - expansion_start);
+      timings.spans.push_back({ "expand variables", "expansion", expansion_start, expansion_end });
+      std::string status = "OK";
 
       if (debug_flag)
       {
         // display generated task command-line
-        fmt::print("{} {}\n",
+        status = "DEBUG";
+        std::lock_guard<std::mutex> lck(console_mtx);
+        fmt::print(env.out, "{} {}\n",
           fmt::format(fmt::emphasis::bold, "debugging task:"),
           desc);
-        fmt::print("{} [{}]\n",
+        fmt::print(env.out, "{} [{}]\n",
           fmt::format(fmt::emphasis::bold, "task-cmd:"),
           fmt::format("{} {}", cmd, utf8::to_utf8(args)));
+        for (const auto& [begin, end] : batches)
+        {
+          const var_env item_vars = with_item(join_foreach_items(*node.foreach, items, begin, end));
+          fmt::print(env.out, "{} [{}]\n",
+            fmt::format(fmt::emphasis::bold, "batch-cmd:"),
+            fmt::format("{} {}", node.cmd.render(item_vars), utf8::to_utf8(node.args.render(item_vars))));
+        }
+      }
+      else if (const auto& resumed = !piped ? checkpoint.check(node.key, command) : std::nullopt)
+      {
+        // skip the task: completed by the resumed execution - restore the variables it produced
+        for (const auto& [key, value] : *resumed)
+          set_var(key, value);
+        status = "RESUMED";
+        std::lock_guard<std::mutex> lck(console_mtx);
+        fmt::print(env.out, "{} {:<80}", fmt::format(fmt::emphasis::bold, "execute"), desc + ":");
+        add_tag(env.out, fmt::color::gray, "RESUMED");
+      }
+      else if (const auto& cached = (incremental && !force_flag && !piped) ? state_db.check(node.key, command, inputs, outputs) : std::nullopt)
+      {
+        // skip the task: its inputs/outputs are unchanged - restore the variables it produced
+        for (const auto& [key, value] : *cached)
+          set_var(key, value);
+        status = "UP-TO-DATE";
+        std::lock_guard<std::mutex> lck(console_mtx);
+        fmt::print(env.out, "{} {:<80}", fmt::format(fmt::emphasis::bold, "execute"), desc + ":");
+        add_tag(env.out, fmt::color::gray, "UP-TO-DATE");
       }
       else
       {
         // ask user if it's ok to execute this task
         if (interactive && ask_execute_flag)
         {
+          std::lock_guard<std::mutex> lck(console_mtx);
           if (!console::ask_user(fmt::format("Do you want to execute the task: {}?", desc)))
           {
-            if (!cmd_protected && !group_protected && task_protected)
-              unlock();
-            continue;
+            record("SKIPPED");
+            if (metrics)
+              metrics->done();
+            release_group(true);
+            return;
           }
         }
 
-        std::string logs;
+        log_tail logs(static_cast<std::size_t>(1024.0f * ((logs_tail > 0.0f) ? logs_tail : g_logs_tail_size)));
+        log_stream* stream = nullptr;
+        auto close_stream = [&]() -> void {
+          if (!stream)
+            return;
+          sink.close(stream);
+          stream = nullptr;
+          if (display_flag)
+            sink.flush();
+        };
         try
         {
-          // execute task
-          if (display_flag)
-            fmt::print("{} {}\n", fmt::format(fmt::emphasis::bold, "execute:"), desc);
-          else
-            fmt::print("{} {:<80}", fmt::format(fmt::emphasis::bold, "execute"), desc + ":");
-          execute_task(cmd, args, logs, display_flag, ignore_error_flag, timeout);
+          // execute task - the status is displayed at the end when tasks are executed in parallel
+          {
+            std::lock_guard<std::mutex> lck(console_mtx);
+            if (display_flag)
+              fmt::print(env.out, "{} {}\n", fmt::format(fmt::emphasis::bold, "execute:"), desc);
+            else if (!parallel)
+              fmt::print(env.out, "{} {:<80}", fmt::format(fmt::emphasis::bold, "execute"), desc + ":");
+          }
 
-          // parse logs to add new variables
-          if (task.contains("parse-variables"))
+          // queue the logs to the sink: prefixed by the task name when tasks are executed in parallel
+          if (display_flag || !log_dir.empty())
           {
-            // remove all new-lines
-            logs.erase(std::remove(logs.begin(), logs.end(), '\r'), logs.end());
-            logs.erase(std::remove(logs.begin(), logs.end(), '\n'), logs.end());
+            const std::string name = (!node.id.empty() ? node.id : desc.substr(1, desc.size() - 2));
+            stream = sink.open(get_log_name(static_cast<std::size_t>(&node - nodes.data()), name),
+                               parallel ? fmt::format("[{}] ", name) : "",
+                               display_flag);
+          }
 
-            // extract all variable using regex to find their values in the logs
-            for (const auto& var : task["parse-variables"])
+          // parse logs to add new variables while they are received
+          //  the processes of a "foreach" task forward their logs from several threads
+          log_parser parser(node.parse_variables, g_parse_window_size);
+          std::string output;
+          std::mutex output_mtx;
+          auto display = [&](const std::string& l) -> void {
+            std::lock_guard<std::mutex> lck(output_mtx);
+            if (stream)
+              sink.write(stream, l);
+            logs.append(l);
+          };
+          auto cb_output = [&](const std::string& l) -> void {
+            display(l);
+            parser.parse(l);
+            if (!node.output_variable.empty())
+              output += l;
+          };
+          // a failed process is executed again after a delay doubled at each retry
+          //  not once the execution is stopped (failed task or ctrl-c), nor in a pipeline: its pipes can't be replayed
+          auto with_retries = [&](const std::function<void()>& fct, const std::function<void()>& reset) -> void {
+            auto interrupted = [&]() -> bool { return stopped || (env.dog && env.dog->cancelled()); };
+            for (std::size_t attempt = 0; ; ++attempt)
             {
-              for (const auto& [key, value] : var.items())
+              std::string error;
+              try
+              {
+                fct();
+                return;
+              }
+              catch (const std::exception& ex)
               {
-                std::smatch sm;
-                std::regex reg(value.get<std::string>());
-                if (std::regex_search(logs, sm, reg))
-                  vars[key] = sm.str(1);
+                if (piped || (attempt >= retries) || interrupted())
+                {
+                  if (!attempt)
+                    throw;
+                  throw std::runtime_error(fmt::format("{} (after {} retries)", ex.what(), attempt));
+                }
+                error = ex.what();
               }
+              const float delay = std::min(retry_delay * static_cast<float>(1 << std::min<std::size_t>(attempt, 16)), g_max_retry_delay);
+              {
+                const std::string notice = fmt::format("retry {}/{} in {:.1f}s: {}\n", attempt + 1, retries, delay, error);
+                std::lock_guard<std::mutex> lck(output_mtx);
+                if (stream)
+                  sink.write(stream, notice);
+                logs.append(notice);
+              }
+              const auto until = std::chrono::steady_clock::now() + to_ms(delay);
+              while (!interrupted() && (std::chrono::steady_clock::now() < until))
+                std::this_thread::sleep_for(std::min<std::chrono::steady_clock::duration>(until - std::chrono::steady_clock::now(), std::chrono::milliseconds(50)));
+              if (interrupted())
+                throw std::runtime_error(attempt ? fmt::format("{} (after {} retries)", error, attempt) : error);
+              if (reset)
+                reset();
             }
-          }
+          };
+          // the batches of a "foreach" task are executed in parallel: each process uses its own job slot
+          //  the timeouts are applied to each process, the resources used are added
+          //  the cores of the task are reserved once: its batches are executed one at a time on them
+          //  the logs of each batch are parsed apart, then merged by order of the batches as soon as the previous ones are completed
+          auto execute_foreach = [&](const process_limits& limits) -> void {
+            struct batch_logs
+            {
+              log_parser parser;
+              std::string output;
+            };
+            std::vector<std::unique_ptr<batch_logs>> completed(batches.size());
+            std::size_t merged = 0;
+            const std::size_t parallel = node.cpus.empty() ? static_cast<std::size_t>(jobs) : 1;
+            execute_batches(batches.size(), parallel, [&](const std::size_t b) -> void {
+              const var_env item_vars = with_item(join_foreach_items(*node.foreach, items, batches[b].first, batches[b].second));
+              auto batch = std::make_unique<batch_logs>(batch_logs{ log_parser(node.parse_variables, g_parse_window_size), std::string() });
+              auto cb_batch = [&](const std::string& l) -> void {
+                display(l);
+                batch->parser.parse(l);
+                if (!node.output_variable.empty())
+                  batch->output += l;
+              };
+              process_stats stats;
+              auto add_stats = [&]() -> void {
+                std::lock_guard<std::mutex> lck(output_mtx);
+                timings.process.spawn += stats.spawn;
+                timings.process.user_cpu += stats.user_cpu;
+                timings.process.sys_cpu += stats.sys_cpu;
+                timings.process.peak_rss = std::max(timings.process.peak_rss, stats.peak_rss);
+                timings.process.output_bytes += stats.output_bytes;
+              };
+              const auto slot_start = task_trace::clock::now();
+              env.slots->acquire(env.owner, cancelled);
+              {
+                std::lock_guard<std::mutex> lck(output_mtx);
+                timings.slot_wait += std::chrono::duration_cast<std::chrono::microseconds>(task_trace::clock::now() - slot_start);
+              }
+              try
+              {
+                with_retries([&]() {
+                  execute_task(node.cmd.render(item_vars), node.args.render(item_vars), cb_batch, ignore_error_flag, deadlines, stats,
+                               process_pipes(), limits, env.dog, metrics ? &*metrics : nullptr);
+                  }, [&]() {
+                  batch->parser.reset();
+                  batch->output.clear();
+                  });
+              }
+              catch (const std::exception& ex)
+              {
+                env.slots->release(env.owner);
+                add_stats();
+                const auto& [begin, end] = batches[b];
+                if (end - begin == 1)
+                  throw std::runtime_error(fmt::format("{} (item: \"{}\")", ex.what(), items[begin]));
+                throw std::runtime_error(fmt::format("{} (items {} to {})", ex.what(), begin + 1, end));
+              }
+              env.slots->release(env.owner);
+              add_stats();
+              batch->parser.finish();
+              std::lock_guard<std::mutex> lck(output_mtx);
+              completed[b] = std::move(batch);
+              for (; (merged < completed.size()) && completed[merged]; ++merged)
+              {
+                parser.merge(completed[merged]->parser);
+                output += completed[merged]->output;
+                completed[merged].reset();
+              }
+            });
+          };
 
-          // update variables
-          if (task.contains("variables"))
+          // wait for a job slot (shared by the tasks files) - the batches of a "foreach" task wait for their own slot
+          //  the tasks reading a pipe use the job slot of the first task of their pipeline
+          const bool use_slot = !node.stdin_task && !node.foreach;
+          if (use_slot)
           {
-            for (const auto& var : task["variables"])
-            {
-              for (const auto& [key, value] : var.items())
-                vars[key] = update_var(value.get<std::string>(), vars);
-            }
+            const auto slot_start = task_trace::clock::now();
+            env.slots->acquire(env.owner, cancelled);
+            const auto slot_end = task_trace::clock::now();
+            timings.slot_wait = std::chrono::duration_cast<std::chrono::microseconds>(slot_end - slot_start);
+            timings.spans.push_back({ "job slot wait", "slot", slot_start, slot_end });
+          }
+          timings.process_start = task_trace::clock::now();
+          try
+          {
+            const process_pipes task_pipes = pipes;
+            pipes = process_pipes();
+            process_limits limits = node.limits;
+            limits.cpus = cpus;
+            if (!node.foreach)
+              with_retries([&]() {
+                execute_task(cmd, args, cb_output, ignore_error_flag, deadlines, timings.process, task_pipes, limits, env.dog,
+                             metrics ? &*metrics : nullptr);
+                }, [&]() {
+                parser.reset();
+                output.clear();
+                });
+            else
+              execute_foreach(limits);
+          }
+          catch (...)
+          {
+            if (use_slot)
+              env.slots->release(env.owner);
+            timings.process_end = task_trace::clock::now();
+            throw;
           }
+          if (use_slot)
+            env.slots->release(env.owner);
+          timings.process_end = task_trace::clock::now();
+          close_stream();
+          if (!node.foreach)
+            parser.finish();
+          for (const auto& [key, value] : parser.variables())
+            set_var(key, value);
+          if (!node.output_variable.empty())
+            set_var(node.output_variable, output);
+
+          // update variables
+          for (const auto& [key, value] : node.variables)
+            set_var(key, value.render(task_vars));
+
+          // store the state of the inputs/outputs after a successful execution
+          if (incremental)
+            state_db.update(node.key, command, inputs, outputs, produced_vars);
+          history.record(node.key,
+                         task_history::identity(desc.substr(1, desc.size() - 2), cmd, args),
+                         std::chrono::duration_cast<task_history::duration>(timings.process_end - timings.process_start));
 
           if (!display_flag)
-            add_tag(fmt::color::green, "OK");
+          {
+            std::lock_guard<std::mutex> lck(console_mtx);
+            if (parallel)
+              fmt::print(env.out, "{} {:<80}", fmt::format(fmt::emphasis::bold, "execute"), desc + ":");
+            add_tag(env.out, fmt::color::green, "OK");
+          }
         }
         catch (const std::exception& ex)
         {
-          std::exception err = ex;
+          close_stream();
           if (!display_flag)
           {
-            add_tag(fmt::color::red, "KO");
-            err = std::runtime_error(fmt::format("{}\n\n{}", ex.what(), logs));
+            std::lock_guard<std::mutex> lck(console_mtx);
+            if (parallel)
+              fmt::print(env.out, "{} {:<80}", fmt::format(fmt::emphasis::bold, "execute"), desc + ":");
+            add_tag(env.out, fmt::color::red, "KO");
+            throw std::runtime_error(fmt::format("{}\n\n{}", ex.what(), logs.str()));
           }
-          else
-            fmt::print("\n");
-          throw err;
+          std::lock_guard<std::mutex> lck(console_mtx);
+          fmt::print(env.out, "\n");
+          throw;
         }
       }
 
       // unlock the task if necessary
-      if (!cmd_protected && !group_protected && task_protected)
-        unlock();
+      task_guard.unlock();
+
+      // add the completed task to the journal of the execution: skipped if the execution is resumed
+      if (!piped && ((status == "OK") || (status == "UP-TO-DATE")))
+        checkpoint.record(node.key, command, produced_vars);
+      record(status);
+      if (metrics)
+        metrics->done();
 
       // ask user if it's ok to continue
       if (interactive && ask_continue_flag)
       {
+        std::lock_guard<std::mutex> lck(console_mtx);
         if (!console::ask_user("Do you want to continue?"))
           throw std::runtime_error("stop requested");
       }
     }
+    catch (...)
+    {
+      if (!recorded)
+        record("KO");
+      stopped = true;
+      release_group(false);
+      throw;
+    }
 
     // unlock the group of tasks if necessary
-    if (!cmd_protected && group_protected)
-      unlock();
+    release_group(true);
+  };
+
+  // execute a pipeline: its tasks are started at the same time, connected by pipes
+  //  the first task is executed by the worker, the next ones by their own threads
+  auto execute_pipeline = [&](const std::vector<std::size_t>& pipeline, const std::size_t worker, const cpu_reservation& cpus) -> void {
+    std::vector<process_pipes> pipes(pipeline.size());
+    try
+    {
+      for (std::size_t k = 0; k + 1 < pipeline.size(); ++k)
+      {
+        pipes[k].err = nodes[pipeline[k]].pipe_stderr;
+        pipes[k].tee = nodes[pipeline[k]].pipe_logs;
+        open_pipe(pipes[k], pipes[k + 1]);
+      }
+    }
+    catch (...)
+    {
+      for (auto& p : pipes)
+        close_pipes(p);
+      throw;
+    }
+    std::vector<std::exception_ptr> errors(pipeline.size());
+    auto execute = [&](const std::size_t k) -> void {
+      try
+      {
+        execute_node(nodes[pipeline[k]], worker, pipes[k], cpus.cores(k));
+      }
+      catch (...)
+      {
+        errors[k] = std::current_exception();
+      }
+    };
+    std::vector<std::thread> threads;
+    for (std::size_t k = 1; k < pipeline.size(); ++k)
+      threads.emplace_back(execute, k);
+    execute(0);
+    for (auto& t : threads)
+      t.join();
+    for (const auto& ex : errors)
+      if (ex)
+        std::rethrow_exception(ex);
+
+    // the variables produced by the pipeline are given to its next tasks by its last task
+    for (std::size_t k = 1; k < pipeline.size(); ++k)
+    {
+      var_map pipeline_vars = nodes[pipeline[k - 1]].vars;
+      pipeline_vars.merge(nodes[pipeline[k]].vars);
+      nodes[pipeline[k]].vars = std::move(pipeline_vars);
+    }
+  };
+
+  // scheduler: ready tasks are executed by order of their longest remaining path (predicted by the history)
+  //  then by order of declaration - only by order of declaration with a single job
+  //  the tasks never started (stopped execution) leave the queue of the metrics at the end
+  std::mutex mtx;
+  std::condition_variable cv;
+  const task_schedule schedule = parallel ? schedule_tasks(nodes, vars, history) : task_schedule();
+  std::set<std::pair<std::int64_t, std::size_t>> ready;
+  auto add_ready = [&](const std::size_t i) -> void {
+    ready.emplace(parallel ? -get_priority(nodes, schedule, i) : 0, i);
+  };
+  std::size_t completed = 0;
+  std::exception_ptr error;
+  for (std::size_t i = 0; i < nodes.size(); ++i)
+    if (!nodes[i].pending && !nodes[i].stdin_task)
+      add_ready(i);
+  if (env.metrics)
+    env.metrics->queue(static_cast<std::int64_t>(nodes.size()));
+  auto worker = [&](const std::size_t w) -> void {
+    std::unique_lock<std::mutex> lck(mtx);
+    while (true)
+    {
+      cv.wait(lck, [&]() { return !ready.empty() || error || (completed == nodes.size()); });
+      if (error || (completed == nodes.size()))
+        break;
+      const std::size_t i = ready.begin()->second;
+      ready.erase(ready.begin());
+      std::vector<std::size_t> pipeline = { i };
+      while (nodes[pipeline.back()].stdout_task)
+        pipeline.push_back(*nodes[pipeline.back()].stdout_task);
+      lck.unlock();
+      std::exception_ptr ex;
+      try
+      {
+        // the cores are reserved before any lock of the tasks: all the tasks of a pipeline at once
+        std::vector<cpu_request> requests;
+        for (const auto& p : pipeline)
+          requests.push_back(nodes[p].cpus);
+        const cpu_reservation cpus(env.cpus, requests, cancelled);
+        if (pipeline.size() == 1)
+          execute_node(nodes[i], w, process_pipes(), cpus.cores(0));
+        else
+          execute_pipeline(pipeline, w, cpus);
+      }
+      catch (...)
+      {
+        ex = std::current_exception();
+      }
+      lck.lock();
+      if (ex)
+      {
+        if (!error)
+          error = ex;
+      }
+      else
+      {
+        completed += pipeline.size();
+        for (const auto& p : pipeline)
+          for (const auto& n : nodes[p].next)
+            if (--nodes[n].pending == 0)
+              add_ready(n);
+      }
+      cv.notify_all();
+    }
+  };
+
+  // the current thread is one of the workers
+  std::vector<std::thread> pool;
+  for (std::size_t i = 1; i < std::min(jobs, nodes.size()); ++i)
+    pool.emplace_back(worker, i);
+  worker(0);
+  for (auto& t : pool)
+    t.join();
+  if (env.metrics)
+    env.metrics->queue(-static_cast<std::int64_t>(nodes.size() - started));
+  state_db.save();
+  history.save();
+  if (error)
+    std::rethrow_exception(error);
+}
+
+// execute a tasks file - return the exit code of the program
+int run_tasks(const run_request& request, execution_env& env)
+{
+  std::FILE* out = env.out;
+  int ret;
+  task_trace trace;
+  try
+  {
+    // check arguments validity
+    if (!std::filesystem::exists(request.tasks_file) ||
+        request.tasks_file.extension().string() != ".json")
+      throw std::runtime_error(fmt::format("the tasks file is invalid: \"{}\"", request.tasks_file.filename().u8string()));
+    if (request.jobs < 1)
+      throw std::runtime_error(fmt::format("the number of jobs is invalid: {}", request.jobs));
+
+    // parse command-line options
+    var_map cmd_vars;
+    auto start = task_trace::clock::now();
+    exec(out, "parsing command-line variables", [&]() { cmd_vars = parse_cmd(request.variables); });
+    trace.add_step("parsing command-line variables", start);
+    display_variables(out, cmd_vars);
+
+    // parsing tasks json file - compiled in the cache file and kept in memory by the server
+    std::shared_ptr<const task_plan> plan;
+    std::vector<task_node> tasks;
+    var_map json_vars;
+    start = task_trace::clock::now();
+    exec(out, "parsing json-file variables and check validity", [&]() {
+      if (env.cache)
+      {
+        // the nodes are copied: the plan is shared by all the executions of the file
+        plan = env.cache->load(request.tasks_file);
+        tasks = plan->nodes;
+      }
+      else
+      {
+        task_plan local_plan = load_plan(request.tasks_file);
+        tasks = std::move(local_plan.nodes);
+        plan = std::make_shared<const task_plan>(std::move(local_plan));
+      }
+      json_vars = get_json_variables(*plan, cmd_vars);
+      });
+    trace.add_step("parsing json-file variables", start);
+    display_variables(out, json_vars);
+
+    // scopes of the variables: the command-line variables override the variables of the tasks file
+    const var_env vars = var_env().push(json_vars).push(cmd_vars);
+
+    // execute tasks
+    fmt::print(out, "{} \"{}\"\n",
+      fmt::format(fmt::emphasis::bold, "Starting:"),
+      plan->description.render(vars));
+    std::unique_ptr<task_state_db> local_state_db;
+    if (!env.cache)
+    {
+      std::filesystem::path state_file = request.tasks_file;
+      state_file += ".state";
+      local_state_db = std::make_unique<task_state_db>(state_file);
+    }
+    task_state_db& state_db = env.cache ? env.cache->state_db(request.tasks_file) : *local_state_db;
+    std::unique_ptr<task_history> local_history;
+    if (!env.cache)
+    {
+      std::filesystem::path history_file = request.tasks_file;
+      history_file += ".history";
+      local_history = std::make_unique<task_history>(history_file);
+    }
+    task_history& history = env.cache ? env.cache->history(request.tasks_file) : *local_history;
+    if (request.plan)
+      display_plan(out, tasks, vars, history, static_cast<std::size_t>(request.jobs));
+    else
+    {
+      // journal of the completed tasks: one per set of command-line variables - removed once all the tasks are completed
+      std::filesystem::path checkpoint_file = request.tasks_file;
+      if (!request.variables.empty())
+      {
+        std::string key;
+        for (const auto& v : request.variables)
+          key += v + "\n";
+        checkpoint_file += fmt::format(".{:016x}", hash64::of(key));
+      }
+      checkpoint_file += ".checkpoint";
+      task_checkpoint checkpoint(checkpoint_file, request.resume);
+      if (request.resume)
+        fmt::print(out, "{} {} completed tasks\n\n", fmt::format(fmt::emphasis::bold, "Resuming:"), checkpoint.size());
+      execute_tasks(tasks, vars, request.interactive, static_cast<std::size_t>(request.jobs), state_db, history, checkpoint, trace, request.log_dir, env);
+      checkpoint.remove();
+    }
+    ret = 0;
+  }
+  catch (const std::exception& ex)
+  {
+    fmt::print(out, "{} {}\n",
+      fmt::format(fmt::fg(fmt::color::red) | fmt::emphasis::bold, "error:"),
+      ex.what());
+    ret = -1;
   }
 
-  // unlock the whole process if necessary
-  if (cmd_protected)
-    unlock();
+  // write the timings of the run - even if it failed
+  if (!request.trace_file.empty())
+  {
+    try
+    {
+      trace.save(request.trace_file);
+      trace.print_summary(out, g_trace_summary_size);
+    }
+    catch (const std::exception& ex)
+    {
+      fmt::print(out, "{} {}\n",
+        fmt::format(fmt::fg(fmt::color::red) | fmt::emphasis::bold, "error:"),
+        ex.what());
+      ret = -1;
+    }
+  }
+  return ret;
+}
+
+// execute several tasks files with a single limit of jobs shared fairly between the files
+//  at most "jobs" files are executed at the same time: a file uses at least one job slot
+//  the output of each file is displayed while it's executed, its lines prefixed by the name of the file
+//  then a summary of the results of each file - return the exit code of the program
+int run_batch(const std::vector<std::filesystem::path>& files, const run_request& request, execution_env& env)
+{
+  struct file_result
+  {
+    int ret = -1;
+    std::chrono::steady_clock::duration duration{};
+  };
+  std::vector<file_result> results(files.size());
+  std::mutex out_mtx;
+
+  // display the output of a file read from a pipe: only complete lines, with the prefix of the file
+  auto display = [&](const int fd, const std::string& prefix) -> void {
+    std::string pending;
+    char buffer[4096];
+    while (true)
+    {
+#ifdef _WIN32
+      const int size = ::_read(fd, buffer, sizeof(buffer));
+#else
+      const ssize_t size = ::read(fd, buffer, sizeof(buffer));
+      if ((size == -1) && (errno == EINTR))
+        continue;
+#endif
+      if (size > 0)
+        pending.append(buffer, static_cast<std::size_t>(size));
+      else if (!pending.empty())
+        pending += '\n';
+      std::string lines;
+      std::size_t pos = 0;
+      for (std::size_t eol; (eol = pending.find('\n', pos)) != std::string::npos; pos = eol + 1)
+        lines += prefix + pending.substr(pos, eol + 1 - pos);
+      pending.erase(0, pos);
+      if (!lines.empty())
+      {
+        std::lock_guard<std::mutex> lck(out_mtx);
+        std::fwrite(lines.data(), 1, lines.size(), env.out);
+        std::fflush(env.out);
+      }
+      if (size <= 0)
+        break;
+    }
+#ifdef _WIN32
+    ::_close(fd);
+#else
+    ::close(fd);
+#endif
+  };
+
+  auto execute_file = [&](const std::size_t index) -> void {
+    // each file has its own output, trace and log directory
+    const std::filesystem::path& file = files[index];
+    const std::string name = fmt::format("{:02}-{}", index, file.stem().u8string());
+    run_request r = request;
+    r.tasks_file = file;
+    if (!request.log_dir.empty())
+      r.log_dir = request.log_dir / name;
+    if (!request.trace_file.empty())
+      r.trace_file = request.trace_file.parent_path() /
+        fmt::format("{}-{}{}", request.trace_file.stem().u8string(), name, request.trace_file.extension().u8string());
+    {
+      std::lock_guard<std::mutex> lck(out_mtx);
+      fmt::print(env.out, "{} [{}] {}\n", fmt::format(fmt::emphasis::bold, "Tasks file:"), name, file.u8string());
+      std::fflush(env.out);
+    }
+
+    // the output of the file is written in a pipe (unbuffered, not inherited by the processes) read by a thread
+    //  the console is used as is if the pipe can't be created
+    std::FILE* out = nullptr;
+    std::thread reader;
+    int fds[2];
+#ifdef _WIN32
+    if (::_pipe(fds, 64 * 1024, _O_BINARY | _O_NOINHERIT) == 0)
+    {
+      out = ::_fdopen(fds[1], "wb");
+      if (!out)
+      {
+        ::_close(fds[0]);
+        ::_close(fds[1]);
+      }
+    }
+#else
+    if (::pipe2(fds, O_CLOEXEC) == 0)
+    {
+      out = ::fdopen(fds[1], "wb");
+      if (!out)
+      {
+        ::close(fds[0]);
+        ::close(fds[1]);
+      }
+    }
+#endif
+    if (out)
+    {
+      std::setvbuf(out, nullptr, _IONBF, 0);
+      reader = std::thread(display, fds[0], fmt::format("[{}] ", name));
+    }
+    execution_env file_env{ out ? out : env.out, env.resources, env.slots, env.cpus, env.cache, env.dog, env.metrics, index + 1 };
+    const auto start = std::chrono::steady_clock::now();
+    results[index].ret = run_tasks(r, file_env);
+    results[index].duration = std::chrono::steady_clock::now() - start;
+    if (out)
+    {
+      std::fclose(out);
+      reader.join();
+    }
+  };
+
+  // the files are executed by order by a pool of threads
+  std::atomic<std::size_t> next = 0;
+  auto worker = [&]() -> void {
+    for (std::size_t i = next++; i < files.size(); i = next++)
+      execute_file(i);
+  };
+  std::vector<std::thread> pool;
+  for (std::size_t i = 1; i < std::min(static_cast<std::size_t>(std::max(request.jobs, 1)), files.size()); ++i)
+    pool.emplace_back(worker);
+  worker();
+  for (auto& t : pool)
+    t.join();
+  fmt::print(env.out, "\n");
+
+  // display the results of each file
+  int ret = 0;
+  fmt::print(env.out, "{}\n", fmt::format(fmt::emphasis::bold, "Results:"));
+  for (std::size_t i = 0; i < files.size(); ++i)
+  {
+    const double seconds = std::chrono::duration<double>(results[i].duration).count();
+    fmt::print(env.out, "  {:<70} {:>8.2f}s ", files[i].u8string(), seconds);
+    if (results[i].ret == 0)
+      add_tag(env.out, fmt::color::green, "OK");
+    else
+      add_tag(env.out, fmt::color::red, "KO");
+    if (results[i].ret != 0)
+      ret = results[i].ret;
+  }
+  return ret;
 }
 
 int main(int argc, char** argv)
@@ -450,56 +1126,128 @@ int main(int argc, char** argv)
   console::init(1280, 600);
 
   // register signal handler
+#ifdef _WIN32
   signal(SIGINT, exit_program);
+#else
+  // without SA_RESTART: ctrl-c also interrupts the blocking system calls of the waits
+  struct sigaction action = {};
+  action.sa_handler = exit_program;
+  sigemptyset(&action.sa_mask);
+  action.sa_flags = 0;
+  sigaction(SIGINT, &action, nullptr);
+
+  // a closed pipe of a pipeline is reported as an error by the writes
+  signal(SIGPIPE, SIG_IGN);
+#endif
 
   // parse command-line arguments
-  std::filesystem::path tasks_file;
-  std::vector<std::string> variables_str;
-  bool interactive = false;
+  run_request request;
+  std::vector<std::string> tasks_files;
+  std::filesystem::path serve_socket;
+  std::filesystem::path connect_socket;
+  std::filesystem::path metrics_file;
+  std::filesystem::path metrics_socket;
   console::parser parser(PROGRAM_NAME, PROGRAM_VERSION);
-  parser.add("t", "tasks", "set the path to json tasks file", tasks_file, true)
-        .add("x", "variables", "define a list of variables for the tasks", variables_str)
-        .add("i", "interactive", "enable the interactive mode which asks user for questions", interactive);
-  if (!parser.parse(argc, argv))
+  parser.add("t", "tasks", "set the json tasks files: paths, directories or wildcards", tasks_files)
+        .add("x", "variables", "define a list of variables for the tasks", request.variables)
+        .add("i", "interactive", "enable the interactive mode which asks user for questions", request.interactive)
+        .add("j", "jobs", "set the number of tasks executed in parallel (using \"depends-on\")", request.jobs)
+        .add("r", "trace", "write the timings of the tasks to a chrome trace-event json file", request.trace_file)
+        .add("l", "log-dir", "write the logs of each task in a file of this directory", request.log_dir)
+        .add("p", "plan", "display the predicted schedule of the tasks and their total time without executing them", request.plan)
+        .add("R", "resume", "skip the tasks completed by the previous execution and restore their variables", request.resume)
+        .add("m", "metrics", "rewrite the live metrics in this prometheus textfile every second", metrics_file)
+#ifndef _WIN32
+        .add("s", "serve", "run as a server executing the tasks files submitted on this unix socket", serve_socket)
+        .add("c", "connect", "submit the tasks file to the server listening on this unix socket", connect_socket)
+        .add("M", "metrics-socket", "send the live metrics to the clients of this unix socket", metrics_socket)
+#endif
+        ;
+  if (!parser.parse(argc, argv) || (serve_socket.empty() == tasks_files.empty()))
   {
     parser.print_usage();
     return -1;
   }
 
+  // ctrl-c stops the running processes: polite signal then hard kill (second ctrl-c: hard kill at once)
+  static watchdog dog;
+  g_watchdog = &dog;
+  dog.on_interrupt([]() { fmt::print("event: ctrl-c called => stopping program\n"); });
+
   int ret;
   try
   {
-    // check arguments validity
-    if (!std::filesystem::exists(tasks_file) ||
-        tasks_file.extension().string() != ".json")
-      throw std::runtime_error(fmt::format("the tasks file is invalid: \"{}\"", tasks_file.filename().u8string()));
+    // get the list of tasks files
+    std::vector<std::filesystem::path> files;
+    if (serve_socket.empty())
+      files = get_tasks_files(tasks_files);
+    if (serve_socket.empty() && files.empty())
+      throw std::runtime_error("no tasks file found");
 
-    // parse command-line options
-    std::map<std::string, std::string> cmd_vars;
-    exec("parsing command-line variables", [&]() { cmd_vars = parse_cmd(variables_str); });
-    display_variables(cmd_vars);
-
-    // parsing tasks json file
-    json tasks_db;
-    std::map<std::string, std::string> json_vars;
-    exec("parsing json-file variables and check validity", [&]() {
-      const auto& [db, vars] = parse_json(tasks_file, cmd_vars);
-      tasks_db = db;
-      json_vars = vars;
+    // live metrics: exported by the process executing the tasks
+    if (!connect_socket.empty() && (!metrics_file.empty() || !metrics_socket.empty()))
+      throw std::runtime_error("the metrics are exported by the server");
+    task_metrics metrics;
+    std::optional<metrics_exporter> exporter;
+    if (!metrics_file.empty() || !metrics_socket.empty())
+      exporter.emplace(metrics, metrics_file, metrics_socket);
+    task_metrics* const metrics_ptr = exporter ? &metrics : nullptr;
+
+#ifndef _WIN32
+    // server: all the submissions share the same limit of jobs, cores, resources and tasks files in memory
+    if (!serve_socket.empty())
+    {
+      if (request.jobs < 1)
+        throw std::runtime_error(fmt::format("the number of jobs is invalid: {}", request.jobs));
+      resource_manager resources;
+      job_slots slots(static_cast<std::size_t>(request.jobs));
+      cpu_allocator cpus;
+      tasks_cache cache;
+      std::atomic<std::size_t> clients = 0;
+      task_server server(serve_socket, [&](const run_request& r, std::FILE* out) -> int {
+        execution_env env{ out, &resources, &slots, &cpus, &cache, &dog, metrics_ptr, ++clients };
+        return run_tasks(r, env);
       });
-    display_variables(json_vars);
+      dog.on_interrupt([&]() {
+        fmt::print("event: ctrl-c called => stopping server\n");
+        server.stop();
+        });
+      fmt::print("{} {} ({} jobs)\n", fmt::format(fmt::emphasis::bold, "Listening:"), serve_socket.string(), request.jobs);
+      std::fflush(stdout);
+      server.run();
+      return 0;
+    }
 
-    // fusion the two variable lists
-    std::map<std::string, std::string> vars;
-    vars.insert(cmd_vars.begin(), cmd_vars.end());
-    vars.insert(json_vars.begin(), json_vars.end());
+    // client: the server executes the tasks file and sends back its output
+    if (!connect_socket.empty())
+    {
+      if (request.interactive)
+        throw std::runtime_error("the interactive mode can't be used with a server");
+      if (files.size() > 1)
+        throw std::runtime_error("a single tasks file can be submitted to a server");
+      request.tasks_file = files.front();
+      return submit(connect_socket, request);
+    }
+#endif
 
-    // execute tasks
-    fmt::print(fmt::format("{} \"{}\"\n", 
-      fmt::format(fmt::emphasis::bold, "Starting:"), 
-      update_var(tasks_db["description"].get<std::string>(), vars)));
-    execute_tasks(tasks_db["tasks-groups"], vars, interactive);
-    ret = 0;
+    resource_manager resources;
+    job_slots slots(static_cast<std::size_t>(std::max(request.jobs, 1)));
+    cpu_allocator cpus;
+    execution_env env{ stdout, &resources, &slots, &cpus, nullptr, &dog, metrics_ptr };
+    if (files.size() == 1)
+    {
+      request.tasks_file = files.front();
+      ret = run_tasks(request, env);
+    }
+    else
+    {
+      // several tasks files: executed together by the workers of each file sharing the same job slots
+      if (request.interactive)
+        throw std::runtime_error("the interactive mode can't be used with several tasks files");
+      if (request.jobs < 1)
+        throw std::runtime_error(fmt::format("the number of jobs is invalid: {}", request.jobs));
+      ret = run_batch(files, request, env);
+    }
   }
   catch (const std::exception& ex)
   {
@@ -510,8 +1258,15 @@ int main(int argc, char** argv)
   }
 
   // prompt user to terminate the program
-  if (interactive)
+  if (request.interactive)
+  {
+#ifdef _WIN32
     system("pause");
+#else
+    fmt::print("Press Enter to continue . . .");
+    std::cin.get();
+#endif
+  }
 
   return ret;
 }
\ No newline at end of file
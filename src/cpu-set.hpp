@@ -0,0 +1,218 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <set>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <functional>
+#include <algorithm>
+#include <stdexcept>
+#include <fmt/core.h>
+#ifndef _WIN32
+#include <sched.h>
+#endif
+
+/*============================================
+| Declaration
+==============================================*/
+// maximum index of a core (size of the affinity masks)
+constexpr int g_max_cpus = 1024;
+
+// cores reserved by a task ("cpus" flag): a number of cores or an explicit set of cores
+struct cpu_request
+{
+  std::size_t count = 0;                        // number of cores chosen by the scheduler
+  std::vector<int> set;                         // explicit cores - used if not empty
+
+  bool empty() const { return !count && set.empty(); }
+  std::size_t size() const { return set.empty() ? count : set.size(); }
+};
+
+// parse a set of cores: "0-3,6" (ranges and cores separated by ',')
+inline std::vector<int> parse_cpu_set(const std::string& str);
+
+// cores available for the tasks: the affinity of the current process
+inline std::vector<int> get_available_cpus();
+
+// reserve the cores of the tasks: a core is never given to two tasks at the same time
+//  the cores of several tasks (pipeline) are reserved at once to never wait while holding some of them
+class cpu_allocator
+{
+public:
+  cpu_allocator() :
+    m_cpus(get_available_cpus())
+  {
+  }
+
+  // wait until all the requested cores are free and reserve them - one set of cores per request
+  //  the wait is given up (exception) when the cancelled function returns true
+  std::vector<std::vector<int>> acquire(const std::vector<cpu_request>& requests, const std::function<bool()>& cancelled = nullptr);
+
+  // release the cores of an acquire call
+  void release(const std::vector<std::vector<int>>& cores);
+
+  const std::vector<int>& cpus() const { return m_cpus; }
+
+private:
+  // period of the checks of the cancellation while waiting
+  static constexpr std::chrono::milliseconds g_cancel_check{ 100 };
+  const std::vector<int> m_cpus;
+  std::mutex m_mtx;
+  std::condition_variable m_cv;
+  std::set<int> m_used;
+};
+
+// cores reserved for the tasks of a pipeline (or a single task) - released when destroyed
+//  without allocator: the explicit sets are used as is and nothing is reserved
+class cpu_reservation
+{
+public:
+  cpu_reservation(cpu_allocator* allocator, const std::vector<cpu_request>& requests, const std::function<bool()>& cancelled = nullptr);
+  ~cpu_reservation();
+
+  cpu_reservation(const cpu_reservation&) = delete;
+  cpu_reservation& operator=(const cpu_reservation&) = delete;
+
+  // cores of a task - all if empty
+  const std::vector<int>& cores(const std::size_t idx) const { return m_cores[idx]; }
+
+private:
+  cpu_allocator* m_allocator = nullptr;
+  std::vector<std::vector<int>> m_cores;
+};
+
+/*============================================
+| Definition
+==============================================*/
+inline std::vector<int> parse_cpu_set(const std::string& str)
+{
+  auto parse_int = [&](const std::string& s) -> int {
+    if (s.empty() || (s.size() > 4) || !std::all_of(s.begin(), s.end(), [](const char c) { return (c >= '0') && (c <= '9'); }) ||
+        (std::stoi(s) >= g_max_cpus))
+      throw std::runtime_error(fmt::format("invalid cpus set: \"{}\"", str));
+    return std::stoi(s);
+  };
+  std::set<int> cpus;
+  std::size_t start = 0;
+  while (start <= str.size())
+  {
+    const std::size_t end = std::min(str.find(',', start), str.size());
+    const std::string range = str.substr(start, end - start);
+    start = end + 1;
+    const std::size_t dash = range.find('-');
+    const int first = parse_int(range.substr(0, dash));
+    const int last = (dash == std::string::npos) ? first : parse_int(range.substr(dash + 1));
+    if (last < first)
+      throw std::runtime_error(fmt::format("invalid cpus set: \"{}\"", str));
+    for (int c = first; c <= last; ++c)
+      if (!cpus.insert(c).second)
+        throw std::runtime_error(fmt::format("core {} declared twice in cpus set: \"{}\"", c, str));
+  }
+  return std::vector<int>(cpus.begin(), cpus.end());
+}
+
+inline std::vector<int> get_available_cpus()
+{
+  std::vector<int> cpus;
+#ifdef _WIN32
+  const int count = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+  for (int c = 0; c < count; ++c)
+    cpus.push_back(c);
+#else
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (::sched_getaffinity(0, sizeof(set), &set) == 0)
+  {
+    for (int c = 0; c < CPU_SETSIZE; ++c)
+      if (CPU_ISSET(c, &set))
+        cpus.push_back(c);
+  }
+  if (cpus.empty())
+    cpus.push_back(0);
+#endif
+  return cpus;
+}
+
+inline std::vector<std::vector<int>> cpu_allocator::acquire(const std::vector<cpu_request>& requests, const std::function<bool()>& cancelled)
+{
+  // the requests must be satisfiable: otherwise the tasks would wait forever
+  std::set<int> explicit_cpus;
+  std::size_t total = 0;
+  for (const auto& r : requests)
+  {
+    for (const int c : r.set)
+    {
+      if (std::find(m_cpus.begin(), m_cpus.end(), c) == m_cpus.end())
+        throw std::runtime_error(fmt::format("core {} of the \"cpus\" flag is not available", c));
+      if (!explicit_cpus.insert(c).second)
+        throw std::runtime_error(fmt::format("core {} reserved twice by the tasks of a pipeline", c));
+    }
+    total += r.size();
+  }
+  if (total > m_cpus.size())
+    throw std::runtime_error(fmt::format("{} cores requested by the \"cpus\" flag: only {} available", total, m_cpus.size()));
+
+  std::unique_lock<std::mutex> lck(m_mtx);
+  auto available = [&]() -> bool {
+    std::size_t free = 0;
+    for (const int c : m_cpus)
+    {
+      if (m_used.count(c))
+      {
+        if (explicit_cpus.count(c))
+          return false;
+      }
+      else if (!explicit_cpus.count(c))
+        ++free;
+    }
+    return free + explicit_cpus.size() >= total;
+  };
+  while (!m_cv.wait_for(lck, g_cancel_check, available))
+    if (cancelled && cancelled())
+      throw std::runtime_error("cancelled while waiting for the cores of the \"cpus\" flag");
+
+  // explicit sets are reserved as is, the counts take the first free cores
+  std::vector<std::vector<int>> cores;
+  for (const auto& r : requests)
+  {
+    std::vector<int> cpus = r.set;
+    for (auto it = m_cpus.begin(); (it != m_cpus.end()) && (cpus.size() < r.count); ++it)
+      if (!m_used.count(*it) && !explicit_cpus.count(*it))
+        cpus.push_back(*it);
+    m_used.insert(cpus.begin(), cpus.end());
+    cores.push_back(std::move(cpus));
+  }
+  return cores;
+}
+
+inline void cpu_allocator::release(const std::vector<std::vector<int>>& cores)
+{
+  {
+    std::lock_guard<std::mutex> lck(m_mtx);
+    for (const auto& cpus : cores)
+      for (const int c : cpus)
+        m_used.erase(c);
+  }
+  m_cv.notify_all();
+}
+
+inline cpu_reservation::cpu_reservation(cpu_allocator* allocator, const std::vector<cpu_request>& requests, const std::function<bool()>& cancelled)
+{
+  const bool reserve = allocator && std::any_of(requests.begin(), requests.end(), [](const cpu_request& r) { return !r.empty(); });
+  if (!reserve)
+  {
+    for (const auto& r : requests)
+      m_cores.push_back(r.set);
+    return;
+  }
+  m_cores = allocator->acquire(requests, cancelled);
+  m_allocator = allocator;
+}
+
+inline cpu_reservation::~cpu_reservation()
+{
+  if (m_allocator)
+    m_allocator->release(m_cores);
+}
@@ -0,0 +1,241 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <chrono>
+#include <functional>
+#include <stdexcept>
+#include <condition_variable>
+#include <cstdio>
+#include <filesystem>
+#include <system_error>
+#include "tasks.hpp"
+#include "task-plan.hpp"
+#include "task-state.hpp"
+#include "task-schedule.hpp"
+#include "resource-lock.hpp"
+
+/*============================================
+| Declaration
+==============================================*/
+// parameters of the execution of a tasks file
+struct run_request
+{
+  std::filesystem::path tasks_file;             // path to the json tasks file
+  std::vector<std::string> variables;           // command-line variables: key:value
+  bool interactive = false;                     // ask questions to the user
+  int jobs = 1;                                 // number of tasks executed in parallel
+  std::filesystem::path trace_file;             // chrome trace-event file - none if empty
+  std::filesystem::path log_dir;                // directory of the log files - none if empty
+  bool plan = false;                            // dry-run: display the predicted schedule of the tasks
+  bool resume = false;                          // skip the tasks completed by the previous execution (checkpoint)
+};
+
+// limit the number of processes executed at the same time
+//  the slots are shared fairly between their owners (tasks files): a free slot is given
+//  to the waiting owner which currently executes the fewest processes
+class job_slots
+{
+public:
+  explicit job_slots(const std::size_t count) :
+    m_free(count)
+  {
+  }
+
+  // wait for a free slot - the wait is given up (exception) when the cancelled function returns true
+  void acquire(const std::size_t owner = 0, const std::function<bool()>& cancelled = nullptr)
+  {
+    std::unique_lock<std::mutex> lck(m_mtx);
+    owner_state& state = m_owners[owner];
+    ++state.waiting;
+    auto available = [&]() -> bool {
+      if (!m_free)
+        return false;
+      for (const auto& [o, s] : m_owners)
+        if (s.waiting && (s.running < state.running))
+          return false;
+      return true;
+    };
+    while (!m_cv.wait_for(lck, g_cancel_check, available))
+    {
+      if (!cancelled || !cancelled())
+        continue;
+      --state.waiting;
+      if (!state.running && !state.waiting)
+        m_owners.erase(owner);
+      lck.unlock();
+      m_cv.notify_all();
+      throw std::runtime_error("cancelled while waiting for a job slot");
+    }
+    --state.waiting;
+    ++state.running;
+    --m_free;
+  }
+
+  void release(const std::size_t owner = 0)
+  {
+    {
+      std::lock_guard<std::mutex> lck(m_mtx);
+      owner_state& state = m_owners[owner];
+      --state.running;
+      if (!state.running && !state.waiting)
+        m_owners.erase(owner);
+      ++m_free;
+    }
+    m_cv.notify_all();
+  }
+
+private:
+  struct owner_state
+  {
+    std::size_t running = 0;
+    std::size_t waiting = 0;
+  };
+  // period of the checks of the cancellation while waiting
+  static constexpr std::chrono::milliseconds g_cancel_check{ 100 };
+  std::mutex m_mtx;
+  std::condition_variable m_cv;
+  std::size_t m_free;
+  std::map<std::size_t, owner_state> m_owners;
+};
+
+// compiled tasks files kept in memory - reloaded when they are modified
+class tasks_cache
+{
+public:
+  // get the compiled tasks file
+  std::shared_ptr<const task_plan> load(const std::filesystem::path& path);
+
+  // get the state database of a tasks file - shared by all its executions
+  task_state_db& state_db(const std::filesystem::path& path);
+
+  // get the durations history of a tasks file - shared by all its executions
+  task_history& history(const std::filesystem::path& path);
+
+private:
+  struct entry
+  {
+    std::filesystem::file_time_type mtime;
+    std::uintmax_t size = 0;
+    std::shared_ptr<const task_plan> plan;
+    std::unique_ptr<task_state_db> state_db;
+    std::unique_ptr<task_history> history;
+  };
+  std::mutex m_mtx;
+  std::map<std::filesystem::path, entry> m_entries;
+};
+
+// get the tasks files of the command-line: paths, directories (all their json files) or wildcards
+//  several patterns can be separated by ';'
+inline std::vector<std::filesystem::path> get_tasks_files(const std::vector<std::string>& patterns);
+
+// environment shared by the executions of the tasks files
+struct execution_env
+{
+  std::FILE* out = stdout;                      // console output
+  resource_manager* resources = nullptr;        // system wide resources of the "protected" flags
+  job_slots* slots = nullptr;                   // global limit of processes executed at the same time
+  cpu_allocator* cpus = nullptr;                // cores reserved by the "cpus" flags - not reserved if null
+  tasks_cache* cache = nullptr;                 // compiled tasks files - none if null
+  watchdog* dog = nullptr;                      // deadlines and cancellation of the processes - runner timeouts if null
+  task_metrics* metrics = nullptr;              // live metrics of the executions - none if null
+  std::size_t owner = 0;                        // owner of the job slots: the slots are shared fairly between owners
+};
+
+/*============================================
+| Definition
+==============================================*/
+inline std::vector<std::filesystem::path> get_tasks_files(const std::vector<std::string>& patterns)
+{
+  std::vector<std::filesystem::path> files;
+  for (const auto& str : patterns)
+  {
+    std::size_t start = 0;
+    while (start <= str.size())
+    {
+      const std::size_t end = std::min(str.find(';', start), str.size());
+      const std::string pattern = str.substr(start, end - start);
+      start = end + 1;
+      if (pattern.empty())
+        continue;
+
+      // an explicit file is kept as is: its existence and format are checked by the execution
+      std::error_code ec;
+      if ((pattern.find_first_of("*?") == std::string::npos) && !std::filesystem::is_directory(pattern, ec))
+      {
+        files.push_back(pattern);
+        continue;
+      }
+      std::vector<std::filesystem::path> paths = expand_paths({ pattern });
+      paths.erase(std::remove_if(paths.begin(), paths.end(), [](const std::filesystem::path& p) { return p.extension() != ".json"; }), paths.end());
+      if (paths.empty())
+        throw std::runtime_error(fmt::format("no tasks file found: \"{}\"", pattern));
+      files.insert(files.end(), paths.begin(), paths.end());
+    }
+  }
+
+  // a tasks file is executed only once
+  std::vector<std::filesystem::path> unique_files;
+  std::set<std::filesystem::path> keys;
+  for (const auto& f : files)
+  {
+    std::error_code ec;
+    if (keys.insert(std::filesystem::weakly_canonical(f, ec)).second)
+      unique_files.push_back(f);
+  }
+  return unique_files;
+}
+
+inline std::shared_ptr<const task_plan> tasks_cache::load(const std::filesystem::path& path)
+{
+  const std::filesystem::path key = std::filesystem::canonical(path);
+  const std::filesystem::file_time_type mtime = std::filesystem::last_write_time(key);
+  const std::uintmax_t size = std::filesystem::file_size(key);
+  {
+    std::lock_guard<std::mutex> lck(m_mtx);
+    const auto& it = m_entries.find(key);
+    if ((it != m_entries.end()) && it->second.plan && (it->second.mtime == mtime) && (it->second.size == size))
+      return it->second.plan;
+  }
+
+  // load the file without blocking the other executions
+  std::shared_ptr<const task_plan> plan = std::make_shared<const task_plan>(load_plan(key));
+  std::lock_guard<std::mutex> lck(m_mtx);
+  entry& e = m_entries[key];
+  e.mtime = mtime;
+  e.size = size;
+  e.plan = plan;
+  return plan;
+}
+
+inline task_state_db& tasks_cache::state_db(const std::filesystem::path& path)
+{
+  const std::filesystem::path key = std::filesystem::canonical(path);
+  std::lock_guard<std::mutex> lck(m_mtx);
+  entry& e = m_entries[key];
+  if (!e.state_db)
+  {
+    std::filesystem::path state_file = key;
+    state_file += ".state";
+    e.state_db = std::make_unique<task_state_db>(state_file);
+  }
+  return *e.state_db;
+}
+
+inline task_history& tasks_cache::history(const std::filesystem::path& path)
+{
+  const std::filesystem::path key = std::filesystem::canonical(path);
+  std::lock_guard<std::mutex> lck(m_mtx);
+  entry& e = m_entries[key];
+  if (!e.history)
+  {
+    std::filesystem::path history_file = key;
+    history_file += ".history";
+    e.history = std::make_unique<task_history>(history_file);
+  }
+  return *e.history;
+}
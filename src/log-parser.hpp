@@ -0,0 +1,585 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <map>
+#include <deque>
+#include <memory>
+#include <unordered_map>
+#include <cstdint>
+#include <algorithm>
+#include "pattern-set.hpp"
+
+/*============================================
+| Declaration
+==============================================*/
+// keep only the last bytes of the logs of a process
+class log_tail
+{
+public:
+  explicit log_tail(const std::size_t max_size) :
+    m_max_size(max_size)
+  {
+  }
+
+  // append a chunk of logs - the oldest logs are dropped
+  void append(const std::string& logs)
+  {
+    m_logs += logs;
+    m_total += logs.size();
+    if (m_logs.size() > 2 * m_max_size)
+      m_logs.erase(0, m_logs.size() - m_max_size);
+  }
+
+  // get the last logs - with a marker if some logs have been dropped
+  std::string str() const
+  {
+    if (m_logs.size() <= m_max_size)
+      return (m_total > m_logs.size()) ? "[...]\n" + m_logs : m_logs;
+    return "[...]\n" + m_logs.substr(m_logs.size() - m_max_size);
+  }
+
+  // total number of bytes received
+  std::size_t total() const { return m_total; }
+
+private:
+  const std::size_t m_max_size;
+  std::string m_logs;
+  std::size_t m_total = 0;
+};
+
+// maximum number of states of the DFA of a log_parser: the states are rebuilt when it's reached
+constexpr std::size_t g_max_dfa_states = 4096;
+
+// extract variables from the logs of a process while they are received
+//  new-lines are removed from the logs and all the regexes are searched at once in a single pass:
+//  the Pike VM of the program is executed by a DFA built lazily (its states are the threads of the VM),
+//  each transition also gives the operations on the captures of the threads - none while nothing matches
+//  the matches of a regex don't overlap (leftmost, then by order of priority as in ECMAScript)
+//  a match can't be longer than window_size: only the last window_size bytes are kept (memory usage: 2 * window_size)
+class log_parser
+{
+public:
+  log_parser(std::shared_ptr<const pattern_set> patterns, const std::size_t window_size);
+
+  // parse a new chunk of logs
+  void parse(const std::string& logs);
+
+  // parse the remaining logs - to call when the process is terminated
+  void finish();
+
+  // forget the parsed logs and the extracted variables - the DFA is kept
+  void reset();
+
+  // add the variables extracted from the next logs by a parser of the same regexes (next batch of a "foreach" task)
+  //  a first match already found is kept, a last match is replaced and all the matches are appended
+  void merge(const log_parser& next);
+
+  // get the extracted variables - the variables of the "all" mode are always defined
+  const std::map<std::string, std::string>& variables() const { return m_variables; }
+
+private:
+  static constexpr std::uint32_t new_thread = UINT32_MAX;
+  static constexpr std::size_t unset = SIZE_MAX;
+  enum context : std::uint8_t { context_begin, context_word, context_other };
+
+  // state of the DFA: threads of the VM before their epsilon closure (by regex, then by priority)
+  struct dfa_state
+  {
+    std::vector<std::uint32_t> pcs;
+    std::vector<std::uint32_t> offsets;         // first capture of each thread
+    std::uint32_t slots = 0;                    // number of captures of all the threads
+    std::uint8_t context = context_begin;       // kind of the previous byte
+    std::vector<bool> pending;                  // regexes with a match which can still be extended
+    std::vector<bool> disabled;                 // regexes not searched anymore (first match found)
+    std::size_t active = 0;                     // number of regexes still searched
+  };
+
+  // captures of a thread of the next state: copied from a thread of the current state (or unset) then saved slots
+  struct dfa_op
+  {
+    std::uint32_t src = new_thread;
+    std::uint32_t first = 0;                    // saved slots: [first, first + count) in the saves of the transition
+    std::uint32_t count = 0;
+  };
+
+  // match found (with the captures of its thread), final match or new search to restart after a final match
+  struct dfa_event
+  {
+    enum class kind : std::uint8_t { match, final, rescan };
+    kind type;
+    std::uint32_t pattern;
+    dfa_op op;
+  };
+
+  // transition with operations: the transitions without any operation are only a next state in the table
+  struct dfa_transition
+  {
+    std::uint32_t to = 0;
+    std::vector<dfa_op> ops;
+    std::vector<dfa_event> events;
+    std::vector<std::uint32_t> saves;
+  };
+
+  // execution of the DFA: state and captures of its threads
+  struct dfa_run
+  {
+    std::uint32_t state = 0;
+    std::vector<std::size_t> caps;
+    std::vector<std::size_t> next_caps;
+    bool sub = false;                           // search of a single regex restarted after a match
+    bool restart = false;                       // sub-search: a new match requires to restart it
+  };
+
+  std::uint32_t intern(const dfa_state& state);
+  std::int32_t compute(const std::uint32_t from, const std::size_t cls);
+  void step(dfa_run& run, const std::size_t cls, const std::size_t pos);
+  void rescan(dfa_run& run, const std::uint32_t pattern, const std::size_t pos, const bool end);
+  void extract(const std::uint32_t pattern);
+  void trim();
+
+private:
+  const std::shared_ptr<const pattern_set> m_set;
+  const pattern_set::program& m_program;
+  const std::size_t m_window_size;
+  const std::size_t m_stride;                   // transitions per state: one per class and the end of the logs
+  std::deque<dfa_state> m_states;
+  std::unordered_map<std::string, std::uint32_t> m_index;
+  std::vector<std::int32_t> m_table;            // next state (>= 0), unknown (-1) or transition with operations (-2 - index)
+  std::deque<dfa_transition> m_transitions;
+  std::vector<std::uint32_t> m_visited;         // epsilon closure: instructions visited for the current stamp
+  std::uint32_t m_stamp = 0;
+  dfa_run m_run;
+  std::string m_text;                           // logs without new-lines, from the position m_text_start
+  std::size_t m_text_start = 0;
+  std::vector<std::vector<std::size_t>> m_matches;  // captures of the last match of each regex
+  std::vector<std::size_t> m_counts;            // number of final matches of each regex
+  std::map<std::string, std::string> m_variables;
+};
+
+/*============================================
+| Definition
+==============================================*/
+inline log_parser::log_parser(std::shared_ptr<const pattern_set> patterns, const std::size_t window_size) :
+  m_set(patterns ? std::move(patterns) : std::make_shared<const pattern_set>()),
+  m_program(m_set->compile()),
+  m_window_size(window_size),
+  m_stride(m_program.class_count + 1)
+{
+  if (m_set->empty())
+    return;
+  m_visited.assign(m_program.code.size(), 0);
+  m_matches.resize(m_program.patterns.size());
+  reset();
+}
+
+inline void log_parser::reset()
+{
+  if (m_set->empty())
+    return;
+  m_text.clear();
+  m_text_start = 0;
+  m_counts.assign(m_program.patterns.size(), 0);
+  m_variables.clear();
+  for (std::size_t k = 0; k < m_program.patterns.size(); ++k)
+    if (m_set->specs()[k].mode == pattern_spec::match_mode::all)
+      for (const auto& [name, group] : m_program.patterns[k].variables)
+        m_variables[name];
+  dfa_state initial;
+  initial.pending.assign(m_program.patterns.size(), false);
+  initial.disabled.assign(m_program.patterns.size(), false);
+  m_run = dfa_run();
+  m_run.state = intern(initial);
+}
+
+inline void log_parser::parse(const std::string& logs)
+{
+  if (m_states.empty() || !m_states[m_run.state].active)
+    return;
+
+  // rebuild the DFA when it's too large: only the current state is kept
+  if (m_states.size() > g_max_dfa_states)
+  {
+    const dfa_state state = m_states[m_run.state];
+    m_states.clear();
+    m_index.clear();
+    m_table.clear();
+    m_transitions.clear();
+    m_run.state = intern(state);
+  }
+
+  // remove all new-lines
+  const std::size_t first = m_text.size();
+  m_text += logs;
+  m_text.erase(std::remove_if(m_text.begin() + first, m_text.end(), [](const char c) { return c == '\r' || c == '\n'; }), m_text.end());
+
+  // the transitions without operations only change the state
+  const unsigned char* data = reinterpret_cast<const unsigned char*>(m_text.data());
+  for (std::size_t i = first; i < m_text.size(); ++i)
+  {
+    const std::size_t cls = m_program.classes[data[i]];
+    const std::int32_t next = m_table[m_run.state * m_stride + cls];
+    if (next >= 0)
+    {
+      m_run.state = static_cast<std::uint32_t>(next);
+      continue;
+    }
+    step(m_run, cls, m_text_start + i);
+    if (!m_states[m_run.state].active)
+      break;
+  }
+  trim();
+}
+
+inline void log_parser::finish()
+{
+  if (!m_states.empty() && m_states[m_run.state].active)
+    step(m_run, m_program.class_count, m_text_start + m_text.size());
+  m_text.clear();
+  m_text_start = 0;
+}
+
+inline void log_parser::merge(const log_parser& next)
+{
+  if (m_set->empty())
+    return;
+  for (std::size_t k = 0; k < m_program.patterns.size(); ++k)
+  {
+    const pattern_spec& spec = m_set->specs()[k];
+    if (!next.m_counts[k] || ((spec.mode == pattern_spec::match_mode::first) && m_counts[k]))
+      continue;
+    for (const auto& [name, group] : m_program.patterns[k].variables)
+    {
+      const auto& it = next.m_variables.find(name);
+      if (it == next.m_variables.end())
+        continue;
+      std::string& var = m_variables[name];
+      if (spec.mode != pattern_spec::match_mode::all)
+        var = it->second;
+      else
+        var += m_counts[k] ? spec.separator + it->second : it->second;
+    }
+    m_counts[k] += next.m_counts[k];
+  }
+}
+
+inline std::uint32_t log_parser::intern(const dfa_state& state)
+{
+  std::string key(reinterpret_cast<const char*>(state.pcs.data()), state.pcs.size() * sizeof(std::uint32_t));
+  key += static_cast<char>(state.context);
+  for (std::size_t k = 0; k < state.pending.size(); ++k)
+    key += static_cast<char>(state.pending[k] | (state.disabled[k] << 1));
+  const auto& [it, inserted] = m_index.emplace(std::move(key), static_cast<std::uint32_t>(m_states.size()));
+  if (!inserted)
+    return it->second;
+
+  dfa_state& s = m_states.emplace_back(state);
+  s.offsets.clear();
+  s.slots = 0;
+  for (const auto& pc : s.pcs)
+  {
+    s.offsets.push_back(s.slots);
+    s.slots += m_program.patterns[m_program.code[pc].pattern].slots;
+  }
+  s.active = static_cast<std::size_t>(std::count(s.disabled.begin(), s.disabled.end(), false));
+  m_table.resize(m_table.size() + m_stride, -1);
+  return it->second;
+}
+
+inline std::int32_t log_parser::compute(const std::uint32_t from, const std::size_t cls)
+{
+  const dfa_state& s = m_states[from];
+  const bool end = (cls == m_program.class_count);
+  const bool word = !end && m_program.word_classes[cls];
+  dfa_transition tr;
+  dfa_state next;
+  next.context = !m_program.word_asserts ? context_other : (word ? context_word : context_other);
+  next.pending.assign(s.pending.size(), false);
+  next.disabled = s.disabled;
+
+  // follow the epsilon transitions of a thread by order of priority: the bytes instructions accepting the byte give the
+  //  threads of the next state - a match cuts the threads of lower priority of its regex (returns true)
+  struct frame
+  {
+    std::uint32_t pc;
+    std::size_t saves;
+  };
+  std::vector<frame> stack;
+  std::vector<std::uint32_t> path;
+  bool live = false;
+  bool restart = false;
+  auto follow = [&](const std::uint32_t start, const std::uint32_t src) -> bool {
+    stack.assign(1, frame{ start, 0 });
+    while (!stack.empty())
+    {
+      const frame f = stack.back();
+      stack.pop_back();
+      path.resize(f.saves);
+      for (std::uint32_t pc = f.pc; m_visited[pc] != m_stamp; )
+      {
+        m_visited[pc] = m_stamp;
+        const pattern_set::inst& in = m_program.code[pc];
+        bool ok = true;
+        switch (in.code)
+        {
+        case pattern_set::op::bytes:
+          if (!end && m_program.sets[in.x][cls])
+          {
+            next.pcs.push_back(pc + 1);
+            tr.ops.push_back(dfa_op{ src, static_cast<std::uint32_t>(tr.saves.size()), static_cast<std::uint32_t>(path.size()) });
+            tr.saves.insert(tr.saves.end(), path.begin(), path.end());
+            live = true;
+          }
+          ok = false;
+          break;
+        case pattern_set::op::split:
+          stack.push_back(frame{ in.y, path.size() });
+          pc = in.x;
+          continue;
+        case pattern_set::op::jump:
+          pc = in.x;
+          continue;
+        case pattern_set::op::save:
+          path.push_back(in.x);
+          break;
+        case pattern_set::op::assert_begin:
+          ok = (s.context == context_begin);
+          break;
+        case pattern_set::op::assert_end:
+          ok = end;
+          break;
+        case pattern_set::op::word_boundary:
+        case pattern_set::op::not_word_boundary:
+          ok = ((s.context == context_word) != word) == (in.code == pattern_set::op::word_boundary);
+          break;
+        case pattern_set::op::match:
+        {
+          // the match is final if no thread of higher priority continues: the search restarts at its end
+          //  (at the next byte after an empty match) - the first mode stops the search of the regex
+          const std::uint32_t k = in.pattern;
+          tr.events.push_back(dfa_event{ dfa_event::kind::match, k, dfa_op{ src, static_cast<std::uint32_t>(tr.saves.size()), static_cast<std::uint32_t>(path.size()) } });
+          tr.saves.insert(tr.saves.end(), path.begin(), path.end());
+          if (live)
+            next.pending[k] = true;
+          else
+          {
+            tr.events.push_back(dfa_event{ dfa_event::kind::final, k, dfa_op() });
+            if (m_set->specs()[k].mode == pattern_spec::match_mode::first)
+              next.disabled[k] = true;
+            else
+              restart = (src != new_thread);
+          }
+          return true;
+        }
+        }
+        if (!ok)
+          break;
+        ++pc;
+      }
+    }
+    return false;
+  };
+
+  // threads of each regex - then a new search if no match is pending
+  std::size_t t = 0;
+  for (std::uint32_t k = 0; k < s.pending.size(); ++k)
+  {
+    const std::size_t first = t;
+    while ((t < s.pcs.size()) && (m_program.code[s.pcs[t]].pattern == k))
+      ++t;
+    if (s.disabled[k])
+      continue;
+    ++m_stamp;
+    live = false;
+    restart = false;
+    bool matched = false;
+    for (std::size_t i = first; (i < t) && !matched; ++i)
+      matched = follow(s.pcs[i], static_cast<std::uint32_t>(i));
+    if (!matched && !s.pending[k])
+      matched = follow(m_program.patterns[k].start, new_thread);
+
+    // the pending match is kept while a thread of higher priority continues
+    //  it can't be extended anymore without one: the new search starts at its end
+    if (!matched && s.pending[k] && live)
+      next.pending[k] = true;
+    else if (!matched && s.pending[k])
+    {
+      tr.events.push_back(dfa_event{ dfa_event::kind::final, k, dfa_op() });
+      if (m_set->specs()[k].mode == pattern_spec::match_mode::first)
+        next.disabled[k] = true;
+      else
+        tr.events.push_back(dfa_event{ dfa_event::kind::rescan, k, dfa_op() });
+    }
+    if (restart)
+    {
+      ++m_stamp;
+      live = false;
+      restart = false;
+      follow(m_program.patterns[k].start, new_thread);
+    }
+  }
+
+  // a transition without operation only changes the state: the threads keep their captures
+  const std::uint32_t to = intern(next);
+  bool simple = tr.events.empty();
+  for (std::size_t j = 0; simple && (j < tr.ops.size()); ++j)
+    simple = (tr.ops[j].src == j) && !tr.ops[j].count;
+  std::int32_t& entry = m_table[from * m_stride + cls];
+  if (simple)
+    entry = static_cast<std::int32_t>(to);
+  else
+  {
+    tr.to = to;
+    m_transitions.push_back(std::move(tr));
+    entry = -2 - static_cast<std::int32_t>(m_transitions.size() - 1);
+  }
+  return entry;
+}
+
+inline void log_parser::step(dfa_run& run, const std::size_t cls, const std::size_t pos)
+{
+  std::int32_t next = m_table[run.state * m_stride + cls];
+  if (next == -1)
+    next = compute(run.state, cls);
+  if (next >= 0)
+  {
+    run.state = static_cast<std::uint32_t>(next);
+    return;
+  }
+
+  // captures of the threads of the next state
+  const dfa_transition& tr = m_transitions[static_cast<std::size_t>(-2 - next)];
+  const dfa_state& from = m_states[run.state];
+  const dfa_state& to = m_states[tr.to];
+  auto apply = [&](const dfa_op& op, std::size_t* dst, const std::size_t slots) -> void {
+    if (op.src == new_thread)
+      std::fill(dst, dst + slots, unset);
+    else
+      std::copy(run.caps.begin() + from.offsets[op.src], run.caps.begin() + from.offsets[op.src] + slots, dst);
+    for (std::uint32_t i = 0; i < op.count; ++i)
+      dst[tr.saves[op.first + i]] = pos;
+  };
+  run.next_caps.resize(to.slots);
+  for (std::size_t j = 0; j < tr.ops.size(); ++j)
+  {
+    const std::size_t slots = ((j + 1 < to.offsets.size()) ? to.offsets[j + 1] : to.slots) - to.offsets[j];
+    apply(tr.ops[j], run.next_caps.data() + to.offsets[j], slots);
+  }
+
+  // matches of the regexes: the new searches are restarted once the state is updated
+  std::vector<std::uint32_t> rescans;
+  for (const auto& e : tr.events)
+  {
+    if (e.type == dfa_event::kind::match)
+    {
+      m_matches[e.pattern].resize(m_program.patterns[e.pattern].slots);
+      apply(e.op, m_matches[e.pattern].data(), m_matches[e.pattern].size());
+    }
+    else if (e.type == dfa_event::kind::final)
+      extract(e.pattern);
+    else
+      rescans.push_back(e.pattern);
+  }
+  std::swap(run.caps, run.next_caps);
+  run.state = tr.to;
+  for (const auto& k : rescans)
+  {
+    if (run.sub)
+      run.restart = true;
+    else
+      rescan(run, k, pos, cls == m_program.class_count);
+  }
+}
+
+inline void log_parser::rescan(dfa_run& run, const std::uint32_t pattern, const std::size_t pos, const bool end)
+{
+  // the regex is searched alone from the end of its last match up to the current byte (included)
+  //  the search is restarted at the end of each new match found - without its logs (too long match)
+  //  the search only restarts at the next byte
+  const std::size_t last = pos + (end ? 0 : 1);
+  dfa_run sub;
+  sub.sub = true;
+  do
+  {
+    const std::vector<std::size_t>& match = m_matches[pattern];
+    const std::size_t start = match[1] + ((match[0] == match[1]) ? 1 : 0);
+    if ((start < m_text_start + ((start > 0) ? 1 : 0)) || (start > last))
+      return;
+    dfa_state initial;
+    initial.context = (start == 0) ? context_begin :
+                      (m_program.word_asserts && m_program.word_classes[m_program.classes[static_cast<unsigned char>(m_text[start - 1 - m_text_start])]]) ? context_word : context_other;
+    initial.pending.assign(m_program.patterns.size(), false);
+    initial.disabled.assign(m_program.patterns.size(), true);
+    initial.disabled[pattern] = false;
+    sub.state = intern(initial);
+    sub.caps.clear();
+    sub.restart = false;
+    for (std::size_t p = start; (p < last) && !sub.restart; ++p)
+      step(sub, m_program.classes[static_cast<unsigned char>(m_text[p - m_text_start])], p);
+    if (end && !sub.restart)
+      step(sub, m_program.class_count, pos);
+  } while (sub.restart);
+
+  // insert the threads of the regex in the current state
+  const dfa_state& state = m_states[run.state];
+  const dfa_state& found = m_states[sub.state];
+  if (found.pcs.empty() && !found.disabled[pattern])
+    return;
+  dfa_state merged;
+  merged.context = state.context;
+  merged.pending = state.pending;
+  merged.pending[pattern] = found.pending[pattern];
+  merged.disabled = state.disabled;
+  merged.disabled[pattern] = found.disabled[pattern];
+  std::size_t i = 0;
+  while ((i < state.pcs.size()) && (m_program.code[state.pcs[i]].pattern < pattern))
+    ++i;
+  const std::size_t offset = (i < state.pcs.size()) ? state.offsets[i] : state.slots;
+  merged.pcs.assign(state.pcs.begin(), state.pcs.begin() + i);
+  merged.pcs.insert(merged.pcs.end(), found.pcs.begin(), found.pcs.end());
+  merged.pcs.insert(merged.pcs.end(), state.pcs.begin() + i, state.pcs.end());
+  run.caps.insert(run.caps.begin() + offset, sub.caps.begin(), sub.caps.begin() + found.slots);
+  run.state = intern(merged);
+}
+
+inline void log_parser::extract(const std::uint32_t pattern)
+{
+  // the match is ignored if its logs have been dropped (longer than the window)
+  const std::vector<std::size_t>& match = m_matches[pattern];
+  const pattern_set::pattern& p = m_program.patterns[pattern];
+  const pattern_spec& spec = m_set->specs()[pattern];
+  for (const auto& [name, group] : p.variables)
+    if ((match[2 * group] != unset) && (match[2 * group] < m_text_start))
+      return;
+  for (const auto& [name, group] : p.variables)
+  {
+    const std::size_t begin = match[2 * group];
+    const std::size_t end = match[2 * group + 1];
+    const std::string value = ((begin != unset) && (end != unset) && (end >= begin)) ? m_text.substr(begin - m_text_start, end - begin) : std::string();
+    std::string& var = m_variables[name];
+    if (spec.mode != pattern_spec::match_mode::all)
+      var = value;
+    else
+      var += m_counts[pattern] ? spec.separator + value : value;
+  }
+  ++m_counts[pattern];
+}
+
+inline void log_parser::trim()
+{
+  // keep the logs of the current threads and pending matches (and the previous byte for the word boundaries)
+  //  but not more than the window
+  const dfa_state& state = m_states[m_run.state];
+  const std::size_t end = m_text_start + m_text.size();
+  std::size_t keep = end;
+  for (const auto& offset : state.offsets)
+    keep = std::min(keep, m_run.caps[offset]);
+  for (std::size_t k = 0; k < state.pending.size(); ++k)
+    if (state.pending[k])
+      keep = std::min(keep, m_matches[k][0]);
+  keep = std::max(std::max(keep, std::size_t(1)) - 1, (end > m_window_size) ? end - m_window_size : 0);
+  if (keep > m_text_start)
+  {
+    m_text.erase(0, keep - m_text_start);
+    m_text_start = keep;
+  }
+}
@@ -0,0 +1,442 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <list>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <thread>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <stdexcept>
+#include <fmt/core.h>
+
+/*============================================
+| Declaration
+==============================================*/
+// bounded lock-free queue: multiple producers, multiple consumers (sequence number per cell)
+template <typename T>
+class ring_buffer
+{
+public:
+  explicit ring_buffer(const std::size_t capacity);
+
+  ring_buffer(const ring_buffer&) = delete;
+  ring_buffer& operator=(const ring_buffer&) = delete;
+
+  // add a value - return false if the queue is full
+  bool try_push(T& value);
+
+  // remove the oldest value - return false if the queue is empty
+  bool try_pop(T& value);
+
+private:
+  struct cell
+  {
+    std::atomic<std::size_t> seq;
+    T value;
+  };
+  std::unique_ptr<cell[]> m_cells;
+  std::size_t m_mask;
+  alignas(64) std::atomic<std::size_t> m_head{ 0 };
+  alignas(64) std::atomic<std::size_t> m_tail{ 0 };
+};
+
+// output of a task: displayed on the console and/or written in a log file
+struct log_stream
+{
+  std::string prefix;                           // prefix of the lines on the console - none if empty
+  bool display = false;                         // display the logs on the console
+  std::FILE* file = nullptr;                    // log file - none if null
+  std::string file_buffer;                      // logs not yet written in the file
+  std::string line;                             // incomplete line not yet displayed (prefix mode)
+};
+
+// asynchronous logs: the chunks of logs are queued by the workers without blocking on I/O
+//  and written by a dedicated thread to the console (rate-limited) and the log files (large writes)
+class log_sink
+{
+public:
+  // the console mutex is locked by the writer thread to display the logs on the output
+  log_sink(std::FILE* out, std::mutex& console_mtx, const std::filesystem::path& log_dir);
+  ~log_sink();
+
+  log_sink(const log_sink&) = delete;
+  log_sink& operator=(const log_sink&) = delete;
+
+  // register the output of a task - the log file is created in the log directory (if any)
+  log_stream* open(const std::string& file_name, const std::string& prefix, const bool display);
+
+  // queue a chunk of logs - never blocks on I/O
+  void write(log_stream* stream, const std::string& logs);
+
+  // queue the end of the output of a task: flush its incomplete line and close its log file
+  void close(log_stream* stream);
+
+  // wait until all the queued logs are written
+  void flush();
+
+  // directory of the log files - none if empty
+  const std::filesystem::path& log_dir() const { return m_log_dir; }
+
+private:
+  enum class message_type { data, close, flush };
+  struct message
+  {
+    message_type type = message_type::data;
+    log_stream* stream = nullptr;
+    std::string data;
+    std::promise<void>* done = nullptr;
+  };
+
+  // queue a message - wait for the writer while the queue is full (the logs of the files can't be dropped)
+  void push(message msg);
+
+  // writer thread: drain the queue until the sink is destroyed
+  void run();
+
+  // process a message of the queue
+  void process(message& msg, std::string& console);
+
+  // append logs to the console output - dropped when the console budget is exceeded
+  void display(const std::string& logs, std::string& console);
+
+  // append the size of the dropped logs to the console output
+  void report_dropped(std::string& console);
+
+  // write the buffer of a log file
+  void write_file(log_stream& stream);
+
+private:
+  std::FILE* m_out;
+  std::mutex& m_console_mtx;
+  const std::filesystem::path m_log_dir;
+  ring_buffer<message> m_queue;
+  std::mutex m_streams_mtx;
+  std::list<log_stream> m_streams;
+  std::mutex m_mtx;
+  std::condition_variable m_cv;
+  std::condition_variable m_space_cv;
+  std::atomic<bool> m_idle{ false };
+  std::atomic<std::size_t> m_full_waiters{ 0 };
+  std::atomic<bool> m_stop{ false };
+  std::chrono::steady_clock::time_point m_window;
+  std::size_t m_window_bytes = 0;
+  std::size_t m_dropped_bytes = 0;
+  std::thread m_writer;
+};
+
+// number of chunks of logs waiting to be written
+constexpr std::size_t g_log_queue_size = 1024;
+
+// size in bytes of the writes in the log files
+constexpr std::size_t g_log_file_buffer = 1024 * 1024;
+
+// maximum number of bytes displayed on the console per 100 ms - the remaining logs are dropped
+constexpr std::size_t g_console_budget = 400 * 1024;
+
+/*============================================
+| Definition
+==============================================*/
+template <typename T>
+inline ring_buffer<T>::ring_buffer(const std::size_t capacity)
+{
+  std::size_t size = 2;
+  while (size < capacity)
+    size *= 2;
+  m_cells = std::make_unique<cell[]>(size);
+  m_mask = size - 1;
+  for (std::size_t i = 0; i < size; ++i)
+    m_cells[i].seq.store(i, std::memory_order_relaxed);
+}
+
+template <typename T>
+inline bool ring_buffer<T>::try_push(T& value)
+{
+  std::size_t pos = m_head.load(std::memory_order_relaxed);
+  while (true)
+  {
+    cell& c = m_cells[pos & m_mask];
+    const std::size_t seq = c.seq.load(std::memory_order_acquire);
+    const std::ptrdiff_t diff = static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(pos);
+    if (diff == 0)
+    {
+      if (m_head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+      {
+        c.value = std::move(value);
+        c.seq.store(pos + 1, std::memory_order_release);
+        return true;
+      }
+    }
+    else if (diff < 0)
+      return false;
+    else
+      pos = m_head.load(std::memory_order_relaxed);
+  }
+}
+
+template <typename T>
+inline bool ring_buffer<T>::try_pop(T& value)
+{
+  std::size_t pos = m_tail.load(std::memory_order_relaxed);
+  while (true)
+  {
+    cell& c = m_cells[pos & m_mask];
+    const std::size_t seq = c.seq.load(std::memory_order_acquire);
+    const std::ptrdiff_t diff = static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(pos + 1);
+    if (diff == 0)
+    {
+      if (m_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+      {
+        value = std::move(c.value);
+        c.seq.store(pos + m_mask + 1, std::memory_order_release);
+        return true;
+      }
+    }
+    else if (diff < 0)
+      return false;
+    else
+      pos = m_tail.load(std::memory_order_relaxed);
+  }
+}
+
+inline log_sink::log_sink(std::FILE* out, std::mutex& console_mtx, const std::filesystem::path& log_dir) :
+  m_out(out),
+  m_console_mtx(console_mtx),
+  m_log_dir(log_dir),
+  m_queue(g_log_queue_size),
+  m_window(std::chrono::steady_clock::now())
+{
+  if (!m_log_dir.empty())
+    std::filesystem::create_directories(m_log_dir);
+  m_writer = std::thread([this]() { run(); });
+}
+
+inline log_sink::~log_sink()
+{
+  m_stop = true;
+  m_cv.notify_one();
+  m_writer.join();
+  for (auto& s : m_streams)
+  {
+    if (s.file)
+    {
+      write_file(s);
+      std::fclose(s.file);
+    }
+  }
+}
+
+inline log_stream* log_sink::open(const std::string& file_name, const std::string& prefix, const bool display)
+{
+  log_stream stream;
+  stream.prefix = prefix;
+  stream.display = display;
+  if (!m_log_dir.empty())
+  {
+    const std::filesystem::path path = m_log_dir / file_name;
+#ifdef _WIN32
+    stream.file = ::_wfopen(path.c_str(), L"wb");
+#else
+    stream.file = std::fopen(path.c_str(), "wb");
+#endif
+    if (!stream.file)
+      throw std::runtime_error(fmt::format("can't create log file: \"{}\"", path.u8string()));
+  }
+  std::lock_guard<std::mutex> lck(m_streams_mtx);
+  m_streams.push_back(std::move(stream));
+  return &m_streams.back();
+}
+
+inline void log_sink::write(log_stream* stream, const std::string& logs)
+{
+  message msg;
+  msg.stream = stream;
+  msg.data = logs;
+  push(std::move(msg));
+}
+
+inline void log_sink::close(log_stream* stream)
+{
+  message msg;
+  msg.type = message_type::close;
+  msg.stream = stream;
+  push(std::move(msg));
+}
+
+inline void log_sink::flush()
+{
+  std::promise<void> done;
+  std::future<void> flushed = done.get_future();
+  message msg;
+  msg.type = message_type::flush;
+  msg.done = &done;
+  push(std::move(msg));
+  flushed.wait();
+}
+
+inline void log_sink::push(message msg)
+{
+  if (!m_queue.try_push(msg))
+  {
+    // the writer is woken to drain the queue, then wakes the waiting producers
+    //  the wait is bounded in case the notification is missed
+    std::unique_lock<std::mutex> lck(m_mtx);
+    ++m_full_waiters;
+    m_cv.notify_one();
+    while (!m_queue.try_push(msg))
+      m_space_cv.wait_for(lck, std::chrono::milliseconds(10));
+    --m_full_waiters;
+  }
+  if (m_idle)
+    m_cv.notify_one();
+}
+
+inline void log_sink::run()
+{
+  message msg;
+  std::string console;
+  while (true)
+  {
+    // process all the queued messages - the console output is displayed at once
+    bool received = false;
+    while (m_queue.try_pop(msg))
+    {
+      received = true;
+      process(msg, console);
+      if (console.size() >= g_log_file_buffer)
+        break;
+    }
+    if (received && m_full_waiters)
+    {
+      std::lock_guard<std::mutex> lck(m_mtx);
+      m_space_cv.notify_all();
+    }
+    if (!console.empty())
+    {
+      std::lock_guard<std::mutex> lck(m_console_mtx);
+      std::fwrite(console.data(), 1, console.size(), m_out);
+      std::fflush(m_out);
+      console.clear();
+    }
+    if (received)
+      continue;
+    if (m_stop)
+      break;
+
+    // wait for new messages - the producers only notify an idle writer
+    std::unique_lock<std::mutex> lck(m_mtx);
+    m_idle = true;
+    m_cv.wait_for(lck, std::chrono::milliseconds(10));
+    m_idle = false;
+  }
+}
+
+inline void log_sink::process(message& msg, std::string& console)
+{
+  log_stream* stream = msg.stream;
+  switch (msg.type)
+  {
+  case message_type::data:
+    if (stream->file)
+    {
+      stream->file_buffer += msg.data;
+      if (stream->file_buffer.size() >= g_log_file_buffer)
+        write_file(*stream);
+    }
+    if (!stream->display)
+      break;
+    if (stream->prefix.empty())
+    {
+      display(msg.data, console);
+      break;
+    }
+
+    // prefix mode: only complete lines are displayed
+    stream->line += msg.data;
+    {
+      const std::size_t end = stream->line.rfind('\n');
+      if (end == std::string::npos)
+        break;
+      std::string lines;
+      std::size_t start = 0;
+      while (start <= end)
+      {
+        const std::size_t pos = stream->line.find('\n', start);
+        lines += stream->prefix;
+        lines.append(stream->line, start, pos + 1 - start);
+        start = pos + 1;
+      }
+      stream->line.erase(0, end + 1);
+      display(lines, console);
+    }
+    break;
+
+  case message_type::close:
+    if (stream->display && !stream->line.empty())
+      display(stream->prefix + stream->line + "\n", console);
+    if (stream->display)
+      report_dropped(console);
+    stream->line.clear();
+    stream->line.shrink_to_fit();
+    if (stream->file)
+    {
+      write_file(*stream);
+      std::fclose(stream->file);
+      stream->file = nullptr;
+      stream->file_buffer.shrink_to_fit();
+    }
+    break;
+
+  case message_type::flush:
+    if (!console.empty())
+    {
+      std::lock_guard<std::mutex> lck(m_console_mtx);
+      std::fwrite(console.data(), 1, console.size(), m_out);
+      std::fflush(m_out);
+      console.clear();
+    }
+    msg.done->set_value();
+    break;
+  }
+  msg.data.clear();
+}
+
+inline void log_sink::display(const std::string& logs, std::string& console)
+{
+  // a new window of 100 ms: report the dropped logs
+  const auto now = std::chrono::steady_clock::now();
+  if (now - m_window >= std::chrono::milliseconds(100))
+  {
+    m_window = now;
+    m_window_bytes = 0;
+    report_dropped(console);
+  }
+  if (m_window_bytes + logs.size() > g_console_budget)
+  {
+    m_dropped_bytes += logs.size();
+    return;
+  }
+  m_window_bytes += logs.size();
+  console += logs;
+}
+
+inline void log_sink::report_dropped(std::string& console)
+{
+  if (!m_dropped_bytes)
+    return;
+  console += fmt::format("\n[... {} KiB of logs not displayed{} ...]\n",
+    (m_dropped_bytes + 1023) / 1024,
+    m_log_dir.empty() ? "" : fmt::format(", see: {}", m_log_dir.u8string()));
+  m_dropped_bytes = 0;
+}
+
+inline void log_sink::write_file(log_stream& stream)
+{
+  if (!stream.file_buffer.empty())
+    std::fwrite(stream.file_buffer.data(), 1, stream.file_buffer.size(), stream.file);
+  stream.file_buffer.clear();
+}
@@ -0,0 +1,461 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <map>
+#include <list>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <filesystem>
+#include <stdexcept>
+#include <fmt/core.h>
+#include "process.hpp"
+#include "resource-lock.hpp"
+#ifdef _WIN32
+#include <condition_variable>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+
+/*============================================
+| Declaration
+==============================================*/
+// period of the rewrite of the metrics textfile
+constexpr std::chrono::milliseconds g_metrics_period{ 1000 };
+
+// live metrics of the executions in the prometheus text format
+//  the counters are updated without lock by the execution path: a running task is registered once, at its start
+class task_metrics
+{
+  struct running;
+
+public:
+  using clock = std::chrono::steady_clock;
+
+  // task started by a worker: registered until its end - failed if not done
+  class task
+  {
+  public:
+    task(task_metrics& metrics, const std::string& name);
+    ~task();
+
+    task(const task&) = delete;
+    task& operator=(const task&) = delete;
+
+    // process of the task: its cpu and memory are read by the export - null once terminated
+    void attach(process_runner* runner);
+
+    // output received from the process
+    void output(const std::size_t bytes);
+
+    // resources used by the terminated process
+    void process(const process_stats& stats);
+
+    // the task succeeded (or was skipped)
+    void done() { m_done = true; }
+
+  private:
+    task_metrics& m_metrics;
+    std::list<running>::iterator m_it;
+    bool m_done = false;
+  };
+
+  // tasks waiting for a worker: added when an execution starts, removed at their start (or the end of the execution)
+  void queue(const std::int64_t count) { m_queued += count; }
+
+  // time spent waiting for "protected" resources - added to each resource of the set
+  void lock_wait(const std::vector<resource>& resources, const std::chrono::microseconds& duration);
+
+  // metrics in the prometheus text format
+  std::string str() const;
+
+private:
+  struct running
+  {
+    std::string name;
+    std::uint64_t run = 0;                        // number of the registration: distinguishes the tasks with the same name
+    clock::time_point start;
+    std::atomic<std::uint64_t> output_bytes{ 0 };
+    process_runner* runner = nullptr;             // guarded by the mutex of the tasks
+  };
+
+  std::atomic<std::int64_t> m_queued{ 0 };
+  std::atomic<std::uint64_t> m_running{ 0 };
+  std::atomic<std::uint64_t> m_done{ 0 };
+  std::atomic<std::uint64_t> m_failed{ 0 };
+  std::atomic<std::uint64_t> m_output_bytes{ 0 };
+  std::atomic<std::uint64_t> m_cpu_us{ 0 };
+  std::atomic<std::uint64_t> m_peak_rss{ 0 };
+  mutable std::shared_mutex m_wait_mtx;           // the counters of the resources are only added under exclusive lock
+  std::map<std::string, std::atomic<std::uint64_t>> m_lock_wait_us;
+  mutable std::mutex m_tasks_mtx;
+  std::list<running> m_tasks;
+  std::uint64_t m_runs = 0;
+};
+
+// export of the metrics: textfile rewritten periodically (atomic rename for the node exporter)
+//  and/or unix socket sending the metrics to each connection ("nc -U socket" or "curl --unix-socket")
+class metrics_exporter
+{
+public:
+  // no textfile/socket if the path is empty - throw if the first export fails
+  metrics_exporter(const task_metrics& metrics, const std::filesystem::path& file, const std::filesystem::path& socket_path);
+  ~metrics_exporter();
+
+  metrics_exporter(const metrics_exporter&) = delete;
+  metrics_exporter& operator=(const metrics_exporter&) = delete;
+
+private:
+  // write the textfile - return false on error
+  bool write_file() const;
+
+  // thread of the export
+  void run();
+
+private:
+  const task_metrics& m_metrics;
+  const std::filesystem::path m_file;
+  const std::filesystem::path m_socket_path;
+  std::mutex m_mtx;
+  bool m_stop = false;
+#ifdef _WIN32
+  std::condition_variable m_cv;
+#else
+  int m_socket = -1;
+  int m_wake_fds[2] = { -1, -1 };
+#endif
+  std::thread m_thread;
+};
+
+/*============================================
+| Definition
+==============================================*/
+namespace metrics_detail
+{
+  // escape a label value: backslash, double-quote and line feed
+  inline std::string escape(const std::string& str)
+  {
+    std::string out;
+    out.reserve(str.size());
+    for (const char c : str)
+    {
+      if (c == '\\')
+        out += "\\\\";
+      else if (c == '"')
+        out += "\\\"";
+      else if (c == '\n')
+        out += "\\n";
+      else
+        out += c;
+    }
+    return out;
+  }
+
+  // cpu time (seconds) and resident memory (bytes) of a running process - false if unknown
+  inline bool get_process_usage(const long pid, double& cpu, std::uint64_t& rss)
+  {
+#ifdef _WIN32
+    return false;
+#else
+    // fields after the command name of /proc/<pid>/stat: utime and stime are the 12th and 13th, rss the 22nd
+    std::ifstream file(fmt::format("/proc/{}/stat", pid));
+    std::string line;
+    if ((pid <= 0) || !std::getline(file, line))
+      return false;
+    const std::size_t pos = line.rfind(')');
+    if (pos == std::string::npos)
+      return false;
+    std::istringstream fields(line.substr(pos + 1));
+    std::vector<std::string> values;
+    std::string value;
+    while ((values.size() < 22) && (fields >> value))
+      values.push_back(value);
+    if (values.size() < 22)
+      return false;
+    static const double ticks = static_cast<double>(::sysconf(_SC_CLK_TCK));
+    static const std::uint64_t page = static_cast<std::uint64_t>(::sysconf(_SC_PAGESIZE));
+    cpu = (std::stod(values[11]) + std::stod(values[12])) / ticks;
+    rss = std::stoull(values[21]) * page;
+    return true;
+#endif
+  }
+}
+
+inline task_metrics::task::task(task_metrics& metrics, const std::string& name) :
+  m_metrics(metrics)
+{
+  --metrics.m_queued;
+  ++metrics.m_running;
+  std::lock_guard<std::mutex> lck(metrics.m_tasks_mtx);
+  m_it = metrics.m_tasks.emplace(metrics.m_tasks.end());
+  m_it->name = name;
+  m_it->run = ++metrics.m_runs;
+  m_it->start = clock::now();
+}
+
+inline task_metrics::task::~task()
+{
+  {
+    std::lock_guard<std::mutex> lck(m_metrics.m_tasks_mtx);
+    m_metrics.m_tasks.erase(m_it);
+  }
+  --m_metrics.m_running;
+  ++(m_done ? m_metrics.m_done : m_metrics.m_failed);
+}
+
+inline void task_metrics::task::attach(process_runner* runner)
+{
+  std::lock_guard<std::mutex> lck(m_metrics.m_tasks_mtx);
+  m_it->runner = runner;
+}
+
+inline void task_metrics::task::output(const std::size_t bytes)
+{
+  m_it->output_bytes.fetch_add(bytes, std::memory_order_relaxed);
+  m_metrics.m_output_bytes.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+inline void task_metrics::task::process(const process_stats& stats)
+{
+  m_metrics.m_cpu_us += static_cast<std::uint64_t>((stats.user_cpu + stats.sys_cpu).count());
+  std::uint64_t peak = m_metrics.m_peak_rss;
+  while ((stats.peak_rss > peak) && !m_metrics.m_peak_rss.compare_exchange_weak(peak, stats.peak_rss))
+    ;
+}
+
+inline void task_metrics::lock_wait(const std::vector<resource>& resources, const std::chrono::microseconds& duration)
+{
+  for (const auto& r : resources)
+  {
+    {
+      std::shared_lock<std::shared_mutex> lck(m_wait_mtx);
+      const auto& it = m_lock_wait_us.find(r.name);
+      if (it != m_lock_wait_us.end())
+      {
+        it->second += static_cast<std::uint64_t>(duration.count());
+        continue;
+      }
+    }
+    std::unique_lock<std::shared_mutex> lck(m_wait_mtx);
+    m_lock_wait_us[r.name] += static_cast<std::uint64_t>(duration.count());
+  }
+}
+
+inline std::string task_metrics::str() const
+{
+  std::string out;
+  auto add_metric = [&](const std::string& name, const std::string& type, const std::string& help) -> void {
+    out += fmt::format("# HELP {} {}\n# TYPE {} {}\n", name, help, name, type);
+  };
+  add_metric("autolaunch_tasks", "gauge", "Tasks of the executions in progress by state.");
+  out += fmt::format("autolaunch_tasks{{state=\"queued\"}} {}\n", std::max<std::int64_t>(0, m_queued));
+  out += fmt::format("autolaunch_tasks{{state=\"running\"}} {}\n", m_running.load());
+  add_metric("autolaunch_tasks_completed_total", "counter", "Completed tasks by result.");
+  out += fmt::format("autolaunch_tasks_completed_total{{result=\"done\"}} {}\n", m_done.load());
+  out += fmt::format("autolaunch_tasks_completed_total{{result=\"failed\"}} {}\n", m_failed.load());
+  add_metric("autolaunch_output_bytes_total", "counter", "Output received from the processes.");
+  out += fmt::format("autolaunch_output_bytes_total {}\n", m_output_bytes.load());
+  add_metric("autolaunch_process_cpu_seconds_total", "counter", "CPU time of the terminated processes.");
+  out += fmt::format("autolaunch_process_cpu_seconds_total {:.6f}\n", m_cpu_us / 1e6);
+  add_metric("autolaunch_process_peak_rss_bytes", "gauge", "Highest peak resident memory of the terminated processes.");
+  out += fmt::format("autolaunch_process_peak_rss_bytes {}\n", m_peak_rss.load());
+  add_metric("autolaunch_resource_wait_seconds_total", "counter", "Time spent waiting for the protected resources.");
+  {
+    std::shared_lock<std::shared_mutex> lck(m_wait_mtx);
+    for (const auto& [name, us] : m_lock_wait_us)
+      out += fmt::format("autolaunch_resource_wait_seconds_total{{resource=\"{}\"}} {:.6f}\n", metrics_detail::escape(name), us / 1e6);
+  }
+
+  // running tasks: elapsed time since their start (locks included), output, cpu and memory of their process
+  std::string elapsed, output, cpu, rss;
+  {
+    const clock::time_point now = clock::now();
+    std::lock_guard<std::mutex> lck(m_tasks_mtx);
+    for (const auto& t : m_tasks)
+    {
+      const std::string labels = fmt::format("{{task=\"{}\",run=\"{}\"}}", metrics_detail::escape(t.name), t.run);
+      elapsed += fmt::format("autolaunch_task_elapsed_seconds{} {:.3f}\n", labels, std::chrono::duration<double>(now - t.start).count());
+      output += fmt::format("autolaunch_task_output_bytes{} {}\n", labels, t.output_bytes.load(std::memory_order_relaxed));
+      double seconds = 0.0;
+      std::uint64_t bytes = 0;
+      if (t.runner && metrics_detail::get_process_usage(t.runner->pid(), seconds, bytes))
+      {
+        cpu += fmt::format("autolaunch_task_cpu_seconds{} {:.2f}\n", labels, seconds);
+        rss += fmt::format("autolaunch_task_rss_bytes{} {}\n", labels, bytes);
+      }
+    }
+  }
+  add_metric("autolaunch_task_elapsed_seconds", "gauge", "Elapsed time of the running tasks.");
+  out += elapsed;
+  add_metric("autolaunch_task_output_bytes", "gauge", "Output received from the running tasks.");
+  out += output;
+  add_metric("autolaunch_task_cpu_seconds", "gauge", "CPU time of the process of the running tasks.");
+  out += cpu;
+  add_metric("autolaunch_task_rss_bytes", "gauge", "Resident memory of the process of the running tasks.");
+  out += rss;
+  return out;
+}
+
+inline metrics_exporter::metrics_exporter(const task_metrics& metrics,
+                                          const std::filesystem::path& file,
+                                          const std::filesystem::path& socket_path) :
+  m_metrics(metrics),
+  m_file(file),
+  m_socket_path(socket_path)
+{
+  if (!m_file.empty() && !write_file())
+    throw std::runtime_error(fmt::format("can't write the metrics file: {}", m_file.u8string()));
+#ifdef _WIN32
+  if (!m_socket_path.empty())
+    throw std::runtime_error("the metrics socket is not supported on Windows");
+#else
+  if (!m_socket_path.empty())
+  {
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    const std::string path = m_socket_path.string();
+    if (path.size() >= sizeof(addr.sun_path))
+      throw std::runtime_error(fmt::format("metrics socket path too long: {}", path));
+    std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    std::error_code ec;
+    std::filesystem::remove(m_socket_path, ec);
+    m_socket = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if ((m_socket == -1) ||
+        (::bind(m_socket, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) == -1) ||
+        (::listen(m_socket, SOMAXCONN) == -1))
+    {
+      const std::string err = std::strerror(errno);
+      if (m_socket != -1)
+        ::close(m_socket);
+      throw std::runtime_error(fmt::format("can't listen on the metrics socket {}: {}", path, err));
+    }
+  }
+  if (::pipe2(m_wake_fds, O_CLOEXEC | O_NONBLOCK) == -1)
+  {
+    if (m_socket != -1)
+      ::close(m_socket);
+    throw std::runtime_error(fmt::format("can't start the metrics export: {}", std::strerror(errno)));
+  }
+#endif
+  if (!m_file.empty() || !m_socket_path.empty())
+    m_thread = std::thread([this]() { run(); });
+}
+
+inline metrics_exporter::~metrics_exporter()
+{
+  {
+    std::lock_guard<std::mutex> lck(m_mtx);
+    m_stop = true;
+  }
+#ifdef _WIN32
+  m_cv.notify_all();
+#else
+  const char c = 0;
+  const ssize_t n = ::write(m_wake_fds[1], &c, 1);
+  (void)n;
+#endif
+  if (m_thread.joinable())
+    m_thread.join();
+
+  // the last state of the execution is kept in the textfile
+  if (!m_file.empty())
+    write_file();
+#ifndef _WIN32
+  ::close(m_wake_fds[0]);
+  ::close(m_wake_fds[1]);
+  if (m_socket != -1)
+  {
+    ::close(m_socket);
+    std::error_code ec;
+    std::filesystem::remove(m_socket_path, ec);
+  }
+#endif
+}
+
+inline bool metrics_exporter::write_file() const
+{
+  // written in a temporary file then renamed: the readers never see a partial file
+  std::filesystem::path tmp = m_file;
+  tmp += ".tmp";
+  {
+    std::ofstream file(tmp, std::ios::binary | std::ios::trunc);
+    file << m_metrics.str();
+    if (!file)
+      return false;
+  }
+  std::error_code ec;
+  std::filesystem::rename(tmp, m_file, ec);
+  return !ec;
+}
+
+inline void metrics_exporter::run()
+{
+  using clock = std::chrono::steady_clock;
+  clock::time_point next_write = clock::now() + g_metrics_period;
+#ifdef _WIN32
+  std::unique_lock<std::mutex> lck(m_mtx);
+  while (!m_cv.wait_until(lck, next_write, [&]() { return m_stop; }))
+  {
+    lck.unlock();
+    write_file();
+    lck.lock();
+    next_write += g_metrics_period;
+  }
+#else
+  while (true)
+  {
+    {
+      std::lock_guard<std::mutex> lck(m_mtx);
+      if (m_stop)
+        break;
+    }
+    int timeout = -1;
+    if (!m_file.empty())
+      timeout = static_cast<int>(std::max<long long>(0, std::chrono::duration_cast<std::chrono::milliseconds>(next_write - clock::now()).count()));
+    pollfd fds[2] = { { m_wake_fds[0], POLLIN, 0 }, { m_socket, POLLIN, 0 } };
+    const int n = ::poll(fds, (m_socket != -1) ? 2 : 1, timeout);
+    if ((n > 0) && (fds[0].revents & POLLIN))
+    {
+      char buffer[64];
+      while (::read(m_wake_fds[0], buffer, sizeof(buffer)) > 0)
+        ;
+    }
+
+    // each client receives the current metrics then the connection is closed
+    if ((n > 0) && (m_socket != -1) && (fds[1].revents & POLLIN))
+    {
+      const int fd = ::accept4(m_socket, nullptr, nullptr, SOCK_CLOEXEC);
+      if (fd != -1)
+      {
+        const std::string str = m_metrics.str();
+        for (std::size_t pos = 0; pos < str.size(); )
+        {
+          const ssize_t sent = ::send(fd, str.data() + pos, str.size() - pos, MSG_NOSIGNAL);
+          if ((sent <= 0) && (errno != EINTR))
+            break;
+          if (sent > 0)
+            pos += static_cast<std::size_t>(sent);
+        }
+        ::close(fd);
+      }
+    }
+    if (!m_file.empty() && (clock::now() >= next_write))
+    {
+      write_file();
+      next_write = clock::now() + g_metrics_period;
+    }
+  }
+#endif
+}
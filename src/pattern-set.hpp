@@ -0,0 +1,635 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <array>
+#include <bitset>
+#include <limits>
+#include <optional>
+#include <memory>
+#include <mutex>
+#include <cctype>
+#include <cstdint>
+#include <stdexcept>
+#include <algorithm>
+#include <fmt/core.h>
+
+/*============================================
+| Declaration
+==============================================*/
+// maximum number of instructions of the regexes of a task (counted repetitions are expanded)
+constexpr std::size_t g_max_pattern_program = 65536;
+
+// variable extracted from the logs of a task by a regex ("parse-variables")
+struct pattern_spec
+{
+  enum class match_mode { first, last, all };
+
+  std::string key;                              // variable of the first capture group (whole match if no group)
+  std::string regex;                            // regex searched in the logs
+  match_mode mode = match_mode::first;          // value of the first match, of the last one or of all of them
+  std::string separator = "\n";                 // separator of the values of all the matches
+};
+
+// get the mode of a "parse-variables" entry: "first", "last" or "all"
+inline pattern_spec::match_mode parse_match_mode(const std::string& str);
+
+// regexes of a task compiled into a single program: searched at once in a single pass over the logs by the log_parser
+//  the program is only compiled the first time the regexes are searched: loading a tasks file stays fast
+//  the syntax of the regexes is checked apart (parsing only) when the tasks file is loaded
+//  syntax (ECMAScript subset): literals and escapes, '.', classes ([a-z], [^0-9], \d \w \s \D \W \S), groups ((...),
+//  (?:...), (?<name>...)), alternation, greedy and lazy quantifiers (* + ? {n} {n,} {n,m}), assertions (^ $ \b \B)
+//  back-references and look-arounds are rejected: they can't be searched in linear time
+//  a named group also gives the value of the variable of its name
+class pattern_set
+{
+public:
+  pattern_set() = default;
+  explicit pattern_set(std::vector<pattern_spec> specs);
+
+  const std::vector<pattern_spec>& specs() const { return m_specs; }
+  bool empty() const { return m_specs.empty(); }
+
+  // check the syntax of the regexes without compiling them - throw if a regex is invalid
+  void check() const;
+
+private:
+  friend class log_parser;
+  class compiler;
+
+  // instructions of the program: each regex is "save 0, <regex>, save 1, match"
+  enum class op : std::uint8_t { bytes, split, jump, save, assert_begin, assert_end, word_boundary, not_word_boundary, match };
+  struct inst
+  {
+    op code = op::match;
+    std::uint32_t x = 0;                        // bytes: index of the set - split/jump: preferred target - save: slot
+    std::uint32_t y = 0;                        // split: other target
+    std::uint32_t pattern = 0;                  // index of the regex of the instruction
+  };
+
+  // compiled regex: first instruction, number of capture slots and extracted variables (name, group)
+  struct pattern
+  {
+    std::uint32_t start = 0;
+    std::uint32_t slots = 0;
+    std::vector<std::pair<std::string, std::size_t>> variables;
+  };
+
+  // program of all the regexes
+  struct program
+  {
+    std::vector<pattern> patterns;
+    std::vector<inst> code;
+    std::vector<std::bitset<256>> sets;         // classes of bytes accepted by the "bytes" instructions
+    std::array<std::uint8_t, 256> classes{};    // class of each byte: the bytes of a class are accepted by the same sets
+    std::size_t class_count = 1;
+    std::bitset<256> word_classes;              // classes of the word bytes [0-9A-Za-z_]
+    bool word_asserts = false;                  // the program uses \b or \B
+  };
+
+  // get the program - compiled by the first call (thread-safe), throw if a regex is invalid
+  const program& compile() const;
+  void compile(program& prog) const;
+
+private:
+  std::vector<pattern_spec> m_specs;
+  mutable std::once_flag m_once;
+  mutable std::unique_ptr<const program> m_program;
+};
+
+/*============================================
+| Definition
+==============================================*/
+inline pattern_spec::match_mode parse_match_mode(const std::string& str)
+{
+  if (str == "first")
+    return pattern_spec::match_mode::first;
+  if (str == "last")
+    return pattern_spec::match_mode::last;
+  if (str == "all")
+    return pattern_spec::match_mode::all;
+  throw std::runtime_error(fmt::format("invalid match mode: \"{}\" (\"first\", \"last\" or \"all\" expected)", str));
+}
+
+// parse a regex and append its instructions to the program
+class pattern_set::compiler
+{
+  struct node;
+
+public:
+  compiler(program& set, const std::string& regex, const std::uint32_t pattern) :
+    m_set(set),
+    m_regex(regex),
+    m_pattern(pattern)
+  {
+  }
+
+  // parse the whole regex - throw if its syntax is invalid
+  node parse()
+  {
+    node root = parse_alternation();
+    if (m_pos < m_regex.size())
+      error("unmatched ')'");
+    return root;
+  }
+
+  // compile the regex: its first instruction, number of slots and named groups are given to the pattern
+  void compile(pattern_set::pattern& p)
+  {
+    node root = parse();
+    p.start = static_cast<std::uint32_t>(m_set.code.size());
+    emit(op::save, 0);
+    emit(root);
+    emit(op::save, 1);
+    emit(op::match);
+    p.slots = static_cast<std::uint32_t>(2 * (m_groups + 1));
+    p.variables = std::move(m_names);
+  }
+
+private:
+  struct node
+  {
+    enum class kind { sequence, alternation, bytes, repeat, group, assertion };
+    kind type = kind::sequence;
+    std::vector<node> children;
+    std::bitset<256> bytes;
+    std::size_t min = 0;                        // repeat: number of repetitions - max: "unbounded" if none
+    std::size_t max = 0;
+    bool greedy = true;
+    std::size_t group = 0;                      // group: index of the capture group
+    op assertion = op::assert_begin;
+  };
+  static constexpr std::size_t unbounded = std::numeric_limits<std::size_t>::max();
+
+  [[noreturn]] void error(const std::string& what) const
+  {
+    throw std::runtime_error(fmt::format("invalid regex \"{}\": {}", m_regex, what));
+  }
+
+  bool eat(const char c)
+  {
+    if ((m_pos < m_regex.size()) && (m_regex[m_pos] == c))
+    {
+      ++m_pos;
+      return true;
+    }
+    return false;
+  }
+
+  static node bytes(const std::bitset<256>& set)
+  {
+    node n;
+    n.type = node::kind::bytes;
+    n.bytes = set;
+    return n;
+  }
+
+  static std::bitset<256> range(const unsigned char first, const unsigned char last)
+  {
+    std::bitset<256> set;
+    for (unsigned c = first; c <= last; ++c)
+      set.set(c);
+    return set;
+  }
+
+  // sets of the class escapes: \d \w \s (and their complements)
+  static bool class_escape(const char c, std::bitset<256>& set)
+  {
+    std::bitset<256> s;
+    switch (c)
+    {
+    case 'd': case 'D':
+      s = range('0', '9');
+      break;
+    case 'w': case 'W':
+      s = range('0', '9') | range('A', 'Z') | range('a', 'z');
+      s.set('_');
+      break;
+    case 's': case 'S':
+      for (const char space : { ' ', '\t', '\n', '\v', '\f', '\r' })
+        s.set(static_cast<unsigned char>(space));
+      break;
+    default:
+      return false;
+    }
+    set = ((c >= 'A') && (c <= 'Z')) ? ~s : s;
+    return true;
+  }
+
+  unsigned hex(const std::size_t digits)
+  {
+    unsigned value = 0;
+    for (std::size_t i = 0; i < digits; ++i, ++m_pos)
+    {
+      const char c = (m_pos < m_regex.size()) ? m_regex[m_pos] : '\0';
+      if (!std::isxdigit(static_cast<unsigned char>(c)))
+        error("invalid hexadecimal escape");
+      value = 16 * value + static_cast<unsigned>(std::isdigit(static_cast<unsigned char>(c)) ? c - '0' : (std::tolower(c) - 'a' + 10));
+    }
+    return value;
+  }
+
+  // character escape: the escaped bytes (a non-ASCII \u is encoded in UTF-8)
+  std::string char_escape(const char c)
+  {
+    switch (c)
+    {
+    case 't': return "\t";
+    case 'n': return "\n";
+    case 'r': return "\r";
+    case 'f': return "\f";
+    case 'v': return "\v";
+    case '0': return std::string(1, '\0');
+    case 'c':
+      if ((m_pos >= m_regex.size()) || !std::isalpha(static_cast<unsigned char>(m_regex[m_pos])))
+        error("invalid control escape");
+      return std::string(1, static_cast<char>(m_regex[m_pos++] % 32));
+    case 'x':
+      return std::string(1, static_cast<char>(hex(2)));
+    case 'u':
+    {
+      const unsigned u = hex(4);
+      if (u < 0x80)
+        return std::string(1, static_cast<char>(u));
+      if (u < 0x800)
+        return { static_cast<char>(0xC0 | (u >> 6)), static_cast<char>(0x80 | (u & 0x3F)) };
+      return { static_cast<char>(0xE0 | (u >> 12)), static_cast<char>(0x80 | ((u >> 6) & 0x3F)), static_cast<char>(0x80 | (u & 0x3F)) };
+    }
+    case 'k':
+      error("back-references are not supported");
+    default:
+      if ((c >= '1') && (c <= '9'))
+        error("back-references are not supported");
+      return std::string(1, c);
+    }
+  }
+
+  // alternation: sequence ('|' sequence)*
+  node parse_alternation()
+  {
+    node first = parse_sequence();
+    if ((m_pos >= m_regex.size()) || (m_regex[m_pos] != '|'))
+      return first;
+    node alt;
+    alt.type = node::kind::alternation;
+    alt.children.push_back(std::move(first));
+    while (eat('|'))
+      alt.children.push_back(parse_sequence());
+    return alt;
+  }
+
+  node parse_sequence()
+  {
+    node seq;
+    while ((m_pos < m_regex.size()) && (m_regex[m_pos] != '|') && (m_regex[m_pos] != ')'))
+      seq.children.push_back(parse_repeat());
+    return seq;
+  }
+
+  // quantifier: {n}, {n,} or {n,m} - false if the brace doesn't start a quantifier
+  bool parse_braces(std::size_t& min, std::size_t& max)
+  {
+    auto number = [&](std::size_t& value) -> bool {
+      const std::size_t start = m_pos;
+      value = 0;
+      while ((m_pos < m_regex.size()) && std::isdigit(static_cast<unsigned char>(m_regex[m_pos])))
+        value = std::min<std::size_t>(10 * value + static_cast<std::size_t>(m_regex[m_pos++] - '0'), g_max_pattern_program);
+      return m_pos > start;
+    };
+    const std::size_t start = m_pos;
+    ++m_pos;
+    if (number(min))
+    {
+      max = min;
+      if (eat(',') && !number(max))
+        max = unbounded;
+      if (eat('}'))
+      {
+        if (max < min)
+          error("invalid repetition range");
+        return true;
+      }
+    }
+    m_pos = start;
+    return false;
+  }
+
+  node parse_repeat()
+  {
+    node atom = parse_atom();
+    while (m_pos < m_regex.size())
+    {
+      std::size_t min;
+      std::size_t max;
+      const char c = m_regex[m_pos];
+      if (c == '*')
+        min = 0, max = unbounded, ++m_pos;
+      else if (c == '+')
+        min = 1, max = unbounded, ++m_pos;
+      else if (c == '?')
+        min = 0, max = 1, ++m_pos;
+      else if ((c != '{') || !parse_braces(min, max))
+        break;
+      if (atom.type == node::kind::assertion)
+        error("nothing to repeat");
+      node rep;
+      rep.type = node::kind::repeat;
+      rep.min = min;
+      rep.max = max;
+      rep.greedy = !eat('?');
+      rep.children.push_back(std::move(atom));
+      atom = std::move(rep);
+    }
+    return atom;
+  }
+
+  node parse_atom()
+  {
+    const char c = m_regex[m_pos++];
+    switch (c)
+    {
+    case '(':
+    {
+      node group;
+      if (eat('?'))
+      {
+        if (eat(':'))
+          group = parse_alternation();
+        else if (eat('<') && (m_pos < m_regex.size()) && (m_regex[m_pos] != '=') && (m_regex[m_pos] != '!'))
+        {
+          const std::size_t end = m_regex.find('>', m_pos);
+          const std::string name = m_regex.substr(m_pos, end - m_pos);
+          if ((end == std::string::npos) || name.empty() ||
+              !std::all_of(name.begin(), name.end(), [](const char n) { return std::isalnum(static_cast<unsigned char>(n)) || (n == '_') || (n == '-'); }))
+            error("invalid group name");
+          for (const auto& [n, g] : m_names)
+            if (n == name)
+              error(fmt::format("duplicated group name \"{}\"", name));
+          m_pos = end + 1;
+          group.type = node::kind::group;
+          group.group = ++m_groups;
+          m_names.emplace_back(name, group.group);
+          group.children.push_back(parse_alternation());
+        }
+        else
+          error("look-arounds are not supported");
+      }
+      else
+      {
+        group.type = node::kind::group;
+        group.group = ++m_groups;
+        group.children.push_back(parse_alternation());
+      }
+      if (!eat(')'))
+        error("missing ')'");
+      return group;
+    }
+    case '[':
+      return parse_class();
+    case '.':
+    {
+      std::bitset<256> set;
+      set.set();
+      set.reset('\n');
+      set.reset('\r');
+      return bytes(set);
+    }
+    case '^':
+    case '$':
+    {
+      node n;
+      n.type = node::kind::assertion;
+      n.assertion = (c == '^') ? op::assert_begin : op::assert_end;
+      return n;
+    }
+    case '*':
+    case '+':
+    case '?':
+    case '{':
+      error("nothing to repeat");
+    case '\\':
+    {
+      if (m_pos >= m_regex.size())
+        error("trailing '\\'");
+      const char e = m_regex[m_pos++];
+      std::bitset<256> set;
+      if (class_escape(e, set))
+        return bytes(set);
+      if ((e == 'b') || (e == 'B'))
+      {
+        node n;
+        n.type = node::kind::assertion;
+        n.assertion = (e == 'b') ? op::word_boundary : op::not_word_boundary;
+        return n;
+      }
+      node seq;
+      for (const char b : char_escape(e))
+        seq.children.push_back(bytes(std::bitset<256>().set(static_cast<unsigned char>(b))));
+      return (seq.children.size() == 1) ? std::move(seq.children.front()) : seq;
+    }
+    default:
+      return bytes(std::bitset<256>().set(static_cast<unsigned char>(c)));
+    }
+  }
+
+  // class: '[' '^'? (byte | byte '-' byte | class escape)* ']'
+  node parse_class()
+  {
+    const bool negate = eat('^');
+    std::bitset<256> set;
+    auto item = [&](std::bitset<256>& s) -> std::optional<unsigned char> {
+      const char c = m_regex[m_pos++];
+      if (c != '\\')
+        return static_cast<unsigned char>(c);
+      if (m_pos >= m_regex.size())
+        error("trailing '\\'");
+      const char e = m_regex[m_pos++];
+      if (class_escape(e, s))
+        return std::nullopt;
+      if (e == 'b')
+        return static_cast<unsigned char>('\b');
+      const std::string b = char_escape(e);
+      if (b.size() != 1)
+        error("non-ASCII escape in a class");
+      return static_cast<unsigned char>(b.front());
+    };
+    while (true)
+    {
+      if (m_pos >= m_regex.size())
+        error("missing ']'");
+      if (eat(']'))
+        break;
+      std::bitset<256> s;
+      const std::optional<unsigned char> first = item(s);
+      if (!first)
+      {
+        set |= s;
+        continue;
+      }
+      if ((m_pos + 1 < m_regex.size()) && (m_regex[m_pos] == '-') && (m_regex[m_pos + 1] != ']'))
+      {
+        ++m_pos;
+        const std::optional<unsigned char> last = item(s);
+        if (!last || (*last < *first))
+          error("invalid class range");
+        set |= range(*first, *last);
+      }
+      else
+        set.set(*first);
+    }
+    return bytes(negate ? ~set : set);
+  }
+
+  std::uint32_t emit(const op code, const std::uint32_t x = 0, const std::uint32_t y = 0)
+  {
+    if (m_set.code.size() >= g_max_pattern_program)
+      error("regex too large");
+    inst i;
+    i.code = code;
+    i.x = x;
+    i.y = y;
+    i.pattern = m_pattern;
+    m_set.code.push_back(i);
+    return static_cast<std::uint32_t>(m_set.code.size() - 1);
+  }
+
+  std::uint32_t next() const
+  {
+    return static_cast<std::uint32_t>(m_set.code.size());
+  }
+
+  void emit(const node& n)
+  {
+    switch (n.type)
+    {
+    case node::kind::sequence:
+      for (const auto& c : n.children)
+        emit(c);
+      break;
+    case node::kind::alternation:
+    {
+      // split to each alternative by order of priority, then jump to the end
+      std::vector<std::uint32_t> jumps;
+      for (std::size_t i = 0; i + 1 < n.children.size(); ++i)
+      {
+        const std::uint32_t split = emit(op::split, next() + 1);
+        emit(n.children[i]);
+        jumps.push_back(emit(op::jump));
+        m_set.code[split].y = next();
+      }
+      emit(n.children.back());
+      for (const auto& j : jumps)
+        m_set.code[j].x = next();
+      break;
+    }
+    case node::kind::bytes:
+      emit(op::bytes, static_cast<std::uint32_t>(m_set.sets.size()));
+      m_set.sets.push_back(n.bytes);
+      break;
+    case node::kind::repeat:
+    {
+      // the mandatory repetitions, then a loop or nested optional repetitions (the preferred target depends on the greediness)
+      for (std::size_t i = 0; i < n.min; ++i)
+        emit(n.children.front());
+      std::vector<std::uint32_t> splits;
+      for (std::size_t i = n.min; (n.max == unbounded) ? (i == n.min) : (i < n.max); ++i)
+      {
+        const std::uint32_t split = emit(op::split);
+        emit(n.children.front());
+        if (n.max == unbounded)
+          emit(op::jump, split);
+        splits.push_back(split);
+      }
+      for (const auto& s : splits)
+      {
+        m_set.code[s].x = n.greedy ? s + 1 : next();
+        m_set.code[s].y = n.greedy ? next() : s + 1;
+      }
+      break;
+    }
+    case node::kind::group:
+      emit(op::save, static_cast<std::uint32_t>(2 * n.group));
+      emit(n.children.front());
+      emit(op::save, static_cast<std::uint32_t>(2 * n.group + 1));
+      break;
+    case node::kind::assertion:
+      emit(n.assertion);
+      m_set.word_asserts |= (n.assertion == op::word_boundary) || (n.assertion == op::not_word_boundary);
+      break;
+    }
+  }
+
+  program& m_set;
+  const std::string& m_regex;
+  const std::uint32_t m_pattern;
+  std::size_t m_pos = 0;
+  std::size_t m_groups = 0;
+  std::vector<std::pair<std::string, std::size_t>> m_names;
+};
+
+inline pattern_set::pattern_set(std::vector<pattern_spec> specs) :
+  m_specs(std::move(specs))
+{
+}
+
+inline void pattern_set::check() const
+{
+  program prog;
+  for (std::size_t k = 0; k < m_specs.size(); ++k)
+    compiler(prog, m_specs[k].regex, static_cast<std::uint32_t>(k)).parse();
+}
+
+inline const pattern_set::program& pattern_set::compile() const
+{
+  std::call_once(m_once, [this]() {
+    std::unique_ptr<program> prog = std::make_unique<program>();
+    compile(*prog);
+    m_program = std::move(prog);
+    });
+  return *m_program;
+}
+
+inline void pattern_set::compile(program& prog) const
+{
+  // compile the regexes: the key gets the first capture group (whole match if none), the named groups their own variable
+  for (std::size_t k = 0; k < m_specs.size(); ++k)
+  {
+    pattern p;
+    compiler(prog, m_specs[k].regex, static_cast<std::uint32_t>(k)).compile(p);
+    p.variables.insert(p.variables.begin(), { m_specs[k].key, (p.slots > 2) ? 1 : 0 });
+    prog.patterns.push_back(std::move(p));
+  }
+
+  // split the bytes in classes: a new class starts at each byte where a set (or the word bytes) changes
+  std::bitset<256> word;
+  for (unsigned c = 0; c < 256; ++c)
+    word[c] = (c < 128) && (std::isalnum(static_cast<int>(c)) || (c == '_'));
+  std::bitset<256> boundaries;
+  auto add_boundaries = [&](const std::bitset<256>& set) -> void {
+    for (std::size_t c = 1; c < 256; ++c)
+      if (set[c] != set[c - 1])
+        boundaries.set(c);
+  };
+  add_boundaries(word);
+  for (const auto& s : prog.sets)
+    add_boundaries(s);
+  std::size_t cls = 0;
+  for (std::size_t c = 0; c < 256; ++c)
+  {
+    if (boundaries[c])
+      ++cls;
+    prog.classes[c] = static_cast<std::uint8_t>(cls);
+  }
+  prog.class_count = cls + 1;
+
+  // the sets and the word bytes are given by class
+  auto by_class = [&](const std::bitset<256>& set) -> std::bitset<256> {
+    std::bitset<256> classes;
+    for (std::size_t c = 0; c < 256; ++c)
+      if (set[c])
+        classes.set(prog.classes[c]);
+    return classes;
+  };
+  for (auto& s : prog.sets)
+    s = by_class(s);
+  prog.word_classes = by_class(word);
+}
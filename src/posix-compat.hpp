@@ -0,0 +1,147 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <iostream>
+#include <filesystem>
+#include <functional>
+#include <type_traits>
+#include <stdexcept>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <fmt/core.h>
+
+/*============================================
+| Declaration
+==============================================*/
+// replacement of the winpp helpers used by AutoLaunch on POSIX systems
+//  same namespaces and interfaces as winpp: console and utf8
+namespace console
+{
+  // nothing to initialize on POSIX terminals
+  inline void init(const int, const int)
+  {
+  }
+
+  // ask a yes/no question to the user
+  inline bool ask_user(const std::string& question)
+  {
+    while (true)
+    {
+      fmt::print("{} [y/n]: ", question);
+      std::fflush(stdout);
+      std::string answer;
+      if (!std::getline(std::cin, answer))
+        return false;
+      if (answer == "y" || answer == "Y" || answer == "yes")
+        return true;
+      if (answer == "n" || answer == "N" || answer == "no")
+        return false;
+    }
+  }
+
+  // command-line arguments parser: --long or -short options
+  class parser
+  {
+  public:
+    parser(const std::string& name, const std::string& version) :
+      m_name(name),
+      m_version(version)
+    {
+    }
+
+    // add an option: bool options are flags, the others need a value
+    template <typename T>
+    parser& add(const std::string& short_name,
+                const std::string& long_name,
+                const std::string& description,
+                T& value,
+                const bool required = false)
+    {
+      option opt{ short_name, long_name, description, required, false, false, {} };
+      if constexpr (std::is_same_v<T, bool>)
+      {
+        opt.is_flag = true;
+        opt.set = [&value](const std::string&) { value = true; };
+      }
+      else if constexpr (std::is_same_v<T, std::vector<std::string>>)
+        opt.set = [&value](const std::string& v) { value.push_back(v); };
+      else if constexpr (std::is_integral_v<T>)
+        opt.set = [&value](const std::string& v) { value = static_cast<T>(std::stoll(v)); };
+      else if constexpr (std::is_floating_point_v<T>)
+        opt.set = [&value](const std::string& v) { value = static_cast<T>(std::stod(v)); };
+      else
+        opt.set = [&value](const std::string& v) { value = T(v); };
+      m_options.push_back(std::move(opt));
+      return *this;
+    }
+
+    // parse the command-line arguments - return false if invalid
+    bool parse(int argc, char** argv)
+    {
+      try
+      {
+        for (int i = 1; i < argc; ++i)
+        {
+          const std::string arg = argv[i];
+          auto it = std::find_if(m_options.begin(), m_options.end(), [&](const option& o) {
+            return (arg == "--" + o.long_name) || (arg == "-" + o.short_name);
+          });
+          if (it == m_options.end())
+            return false;
+          if (it->is_flag)
+            it->set("");
+          else if (i + 1 < argc)
+            it->set(argv[++i]);
+          else
+            return false;
+          it->found = true;
+        }
+      }
+      catch (const std::exception&)
+      {
+        return false;
+      }
+      return std::all_of(m_options.begin(), m_options.end(), [](const option& o) { return !o.required || o.found; });
+    }
+
+    // display the program usage
+    void print_usage() const
+    {
+      fmt::print("{} v{}\n\nusage:\n", m_name, m_version);
+      for (const auto& o : m_options)
+        fmt::print("  -{}, --{:<20} {}{}\n", o.short_name, o.long_name, o.description, o.required ? " (required)" : "");
+    }
+
+  private:
+    struct option
+    {
+      std::string short_name;
+      std::string long_name;
+      std::string description;
+      bool required;
+      bool is_flag;
+      bool found;
+      std::function<void(const std::string&)> set;
+    };
+    const std::string m_name;
+    const std::string m_version;
+    std::vector<option> m_options;
+  };
+}
+
+// strings are already utf-8 encoded on POSIX systems
+namespace utf8
+{
+  inline std::string from_utf8(const std::string& str)
+  {
+    return str;
+  }
+
+  inline std::string to_utf8(const std::string& str)
+  {
+    return str;
+  }
+}
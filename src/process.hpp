@@ -0,0 +1,815 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <memory>
+#include <optional>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <filesystem>
+#include <stdexcept>
+#include <fmt/core.h>
+#ifdef _WIN32
+#include <mutex>
+#include <condition_variable>
+#include <winpp/win.hpp>
+#else
+#include <mutex>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <cstdlib>
+#include <fcntl.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <poll.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+extern char** environ;
+#endif
+
+/*============================================
+| Declaration
+==============================================*/
+// redirections of a process to the pipes of a pipeline (POSIX only)
+//  the runner owns the file descriptors: they are closed once the process is started
+struct process_pipes
+{
+  int in = -1;                                      // stdin: read end of a pipe - /dev/null if -1
+  int out = -1;                                     // stdout: write end of a pipe - forwarded to the logs if -1
+  bool err = false;                                 // stderr is also written in the stdout pipe
+  bool tee = false;                                 // the stdout pipe is also forwarded to the logs
+};
+
+// scheduling and limits of a process (POSIX only): applied by the child before its execution
+struct process_limits
+{
+  std::vector<int> cpus;                            // cores of the process (affinity) - all if empty
+  std::optional<int> nice;                          // priority: -20 (highest) to 19 (lowest)
+  std::size_t max_memory = 0;                       // maximum virtual memory in bytes - none if 0
+  std::size_t max_open_files = 0;                   // maximum number of open files - none if 0
+  int io_class = 0;                                 // io scheduling class: 1 realtime, 2 best-effort, 3 idle - none if 0
+  int io_level = 0;                                 // io priority in the class: 0 (highest) to 7 (lowest)
+
+  bool empty() const { return cpus.empty() && !nice && !max_memory && !max_open_files && !io_class; }
+};
+
+// parameters of a process execution
+struct process_options
+{
+  std::string cmd;                                  // executable
+  std::string args;                                 // command-line arguments
+  std::filesystem::path working_dir;                // working directory - current one if empty
+  std::chrono::milliseconds timeout{ 0 };           // the process is killed after this timeout - none if 0
+  process_pipes pipes;                              // pipes connected to stdin/stdout - none by default
+  process_limits limits;                            // scheduling and limits - none by default
+};
+
+// resources used by a process execution
+struct process_stats
+{
+  std::chrono::microseconds spawn{ 0 };             // latency to start the process
+  std::chrono::microseconds user_cpu{ 0 };          // user cpu time of the process and its waited children
+  std::chrono::microseconds sys_cpu{ 0 };           // system cpu time of the process and its waited children
+  std::size_t peak_rss = 0;                         // peak resident memory in bytes
+  std::size_t output_bytes = 0;                     // number of bytes of stdout/stderr output
+};
+
+// execute a process and forward its output continuously
+class process_runner
+{
+public:
+  using logs_callback = std::function<void(const std::string&)>;
+
+  virtual ~process_runner() = default;
+
+  // execute the process until it terminates and return its exit code - blocking
+  //  the logs callback is called for each chunk of stdout/stderr output
+  virtual int execute(const process_options& options, const logs_callback& cb_logs) = 0;
+
+  // kill the running process and all its children - can be called from any thread
+  virtual void kill() = 0;
+
+  // send a signal to the running process and all its children - false if no process is running
+  //  can be called from any thread
+  virtual bool send_signal(const int sig) = 0;
+
+  // identifier of the running process - 0 if none (or unknown)
+  virtual long pid() const = 0;
+
+  // get the resources used by the last execution - only the spawn latency and output on Windows
+  const process_stats& stats() const { return m_stats; }
+
+protected:
+  process_stats m_stats;
+};
+
+// create the process runner of the current platform
+inline std::unique_ptr<process_runner> create_process_runner();
+
+// connect the stdout of a process to the stdin of the next one
+inline void open_pipe(process_pipes& from, process_pipes& to);
+
+// close the pipes which are not given to a runner
+inline void close_pipes(process_pipes& pipes);
+
+// quote an argument which contains spaces or quotes: it is split back as a single argument by the runner
+inline std::string quote_argument(const std::string& arg);
+
+// maximum length of a command-line (executable and arguments) accepted by the system
+inline std::size_t max_command_line();
+
+/*============================================
+| Definition
+==============================================*/
+#ifdef _WIN32
+// process runner using the winpp asynchronous process
+class win_process_runner : public process_runner
+{
+public:
+  int execute(const process_options& options, const logs_callback& cb_logs) override
+  {
+    if ((options.pipes.in != -1) || (options.pipes.out != -1))
+      throw std::runtime_error("pipelines are not supported on Windows");
+    if (!options.limits.empty())
+      throw std::runtime_error("cpus, priority and limits of the tasks are not supported on Windows");
+
+    // define callback for the program exit
+    std::mutex mtx;
+    std::condition_variable cv;
+    int exit_code = 0;
+    bool stopped = false;
+    auto cb_exit = [&](const int ret) -> void {
+      {
+        std::lock_guard<std::mutex> lck(mtx);
+        exit_code = ret;
+        stopped = true;
+      }
+      cv.notify_all();
+    };
+
+    // start process in async mode (to display logs continuously)
+    win::async_process process;
+    process.set_default_error_code(-1);
+    process.set_working_dir(options.working_dir.empty() ? std::filesystem::current_path() : options.working_dir);
+    if (options.timeout.count())
+      process.set_timeout(options.timeout);
+    m_stats = process_stats();
+    auto cb_output = [&](const std::string& logs) -> void {
+      m_stats.output_bytes += logs.size();
+      cb_logs(logs);
+    };
+    const auto start = std::chrono::steady_clock::now();
+    if (!process.execute(fmt::format("{} {}", options.cmd, options.args), cb_output, cb_exit))
+      throw std::runtime_error("can't start process");
+    m_stats.spawn = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+
+    // wait for process to terminate
+    std::unique_lock<std::mutex> lock(mtx);
+    cv.wait(lock, [&] { return stopped; });
+    return exit_code;
+  }
+
+  void kill() override
+  {
+    // the winpp asynchronous process is only stopped by its timeout
+  }
+
+  bool send_signal(const int) override
+  {
+    return false;
+  }
+
+  long pid() const override
+  {
+    return 0;
+  }
+};
+
+inline std::unique_ptr<process_runner> create_process_runner()
+{
+  return std::make_unique<win_process_runner>();
+}
+
+inline void open_pipe(process_pipes&, process_pipes&)
+{
+  throw std::runtime_error("pipelines are not supported on Windows");
+}
+
+inline void close_pipes(process_pipes&)
+{
+}
+
+inline std::string quote_argument(const std::string& arg)
+{
+  // backslashes are only escaped before a quote (CommandLineToArgvW rules)
+  if (!arg.empty() && (arg.find_first_of(" \t\"") == std::string::npos))
+    return arg;
+  std::string quoted = "\"";
+  std::size_t backslashes = 0;
+  for (const char c : arg)
+  {
+    if (c == '\\')
+      ++backslashes;
+    else
+    {
+      if (c == '\"')
+        quoted.append(backslashes + 1, '\\');
+      backslashes = 0;
+    }
+    quoted += c;
+  }
+  quoted.append(backslashes, '\\');
+  return quoted + "\"";
+}
+
+inline std::size_t max_command_line()
+{
+  // limit of CreateProcess: 32767 characters
+  return 32000;
+}
+#else
+// split a command-line into arguments: separated by spaces, grouped by single/double quotes
+inline std::vector<std::string> split_command_line(const std::string& str)
+{
+  std::vector<std::string> args;
+  std::string arg;
+  bool in_arg = false;
+  char quote = 0;
+  for (std::size_t i = 0; i < str.size(); ++i)
+  {
+    const char c = str[i];
+    if (quote)
+    {
+      if (c == quote)
+        quote = 0;
+      else if ((c == '\\') && (quote == '\"') && (i + 1 < str.size()) && (str[i + 1] == '\"' || str[i + 1] == '\\'))
+        arg += str[++i];
+      else
+        arg += c;
+    }
+    else if ((c == '\"') || (c == '\''))
+    {
+      quote = c;
+      in_arg = true;
+    }
+    else if ((c == '\\') && (i + 1 < str.size()))
+    {
+      arg += str[++i];
+      in_arg = true;
+    }
+    else if ((c == ' ') || (c == '\t') || (c == '\n') || (c == '\r'))
+    {
+      if (in_arg)
+        args.push_back(std::move(arg));
+      arg.clear();
+      in_arg = false;
+    }
+    else
+    {
+      arg += c;
+      in_arg = true;
+    }
+  }
+  if (quote)
+    throw std::runtime_error(fmt::format("unterminated quote in command-line: {}", str));
+  if (in_arg)
+    args.push_back(std::move(arg));
+  return args;
+}
+
+// find an executable in the PATH like execvp - the command is used as is if it contains a '/'
+inline std::string find_executable(const std::string& cmd)
+{
+  if (cmd.find('/') != std::string::npos)
+    return cmd;
+  const char* env = std::getenv("PATH");
+  const std::string paths = env ? env : "/usr/local/bin:/usr/bin:/bin";
+  std::size_t start = 0;
+  while (start <= paths.size())
+  {
+    const std::size_t end = std::min(paths.find(':', start), paths.size());
+    const std::string dir = (end > start) ? paths.substr(start, end - start) : std::string(".");
+    start = end + 1;
+    const std::string path = dir + "/" + cmd;
+    std::error_code ec;
+    if ((::access(path.c_str(), X_OK) == 0) && !std::filesystem::is_directory(path, ec))
+      return path;
+  }
+  throw std::runtime_error(fmt::format("can't start process: {}", std::strerror(ENOENT)));
+}
+
+// process runner using posix_spawn, non-blocking pipes multiplexed with epoll and pidfd
+//  the process is started in its own process group to kill all its children at once
+class posix_process_runner : public process_runner
+{
+public:
+  int execute(const process_options& options, const logs_callback& cb_logs) override
+  {
+    // the pipes of the pipeline are owned by the runner
+    unique_fd pipe_in;
+    unique_fd pipe_out;
+    pipe_in.reset(options.pipes.in);
+    pipe_out.reset(options.pipes.out);
+    const bool direct_out = (pipe_out.get() != -1) && !options.pipes.tee;
+
+    // build the arguments: the executable is never split (it can contain spaces)
+    std::vector<std::string> args = split_command_line(options.args);
+    std::string cmd = options.cmd;
+    if ((cmd.size() >= 2) && ((cmd.front() == '\"') || (cmd.front() == '\'')) && (cmd.back() == cmd.front()))
+      cmd = cmd.substr(1, cmd.size() - 2);
+    args.insert(args.begin(), cmd);
+    std::vector<char*> argv;
+    for (auto& a : args)
+      argv.push_back(a.data());
+    argv.push_back(nullptr);
+
+    // create the pipes for stdout/stderr: not needed when they are written in the pipe of a pipeline
+    pipe_fds out;
+    pipe_fds err;
+    auto create_pipe = [](pipe_fds& p) -> void {
+      int fds[2];
+      if (::pipe2(fds, O_CLOEXEC) == -1)
+        throw std::runtime_error("can't start process (pipe)");
+      p.read.reset(fds[0]);
+      p.write.reset(fds[1]);
+    };
+    if (!direct_out)
+      create_pipe(out);
+    if (!options.pipes.err)
+      create_pipe(err);
+
+    // start the process: stdin is redirected to the pipeline or /dev/null
+    //  fork/exec is only used to apply the limits: posix_spawn is faster (no copy of the page tables)
+    const int stdout_fd = direct_out ? pipe_out.get() : out.write.get();
+    const int stderr_fd = options.pipes.err ? stdout_fd : err.write.get();
+    m_stats = process_stats();
+    const auto start = std::chrono::steady_clock::now();
+    const pid_t pid = options.limits.empty() ?
+      spawn_process(argv, pipe_in.get(), stdout_fd, stderr_fd, options.working_dir) :
+      fork_process(argv, pipe_in.get(), stdout_fd, stderr_fd, options.working_dir, options.limits);
+    m_stats.spawn = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+    m_pid = pid;
+    out.write.reset();
+    err.write.reset();
+    pipe_in.reset();
+    if (direct_out)
+      pipe_out.reset();
+    return wait(pid, out.read, err.read, pipe_out, options.timeout, cb_logs);
+  }
+
+  // the signals are sent under the lock of the reaping of the process: while it's not reaped, its pid
+  //  (and process group) can't be reused by another process
+  void kill() override
+  {
+    std::lock_guard<std::mutex> lck(m_signal_mtx);
+    const pid_t pid = m_pid;
+    if (pid > 0)
+      ::kill(-pid, SIGKILL);
+  }
+
+  bool send_signal(const int sig) override
+  {
+    std::lock_guard<std::mutex> lck(m_signal_mtx);
+    const pid_t pid = m_pid;
+    return (pid > 0) && (::kill(-pid, sig) == 0);
+  }
+
+  long pid() const override
+  {
+    return static_cast<long>(m_pid.load());
+  }
+
+private:
+  // file descriptor closed automatically
+  class unique_fd
+  {
+  public:
+    unique_fd() = default;
+    ~unique_fd() { reset(); }
+    unique_fd(const unique_fd&) = delete;
+    unique_fd& operator=(const unique_fd&) = delete;
+    int get() const { return m_fd; }
+    void reset(const int fd = -1)
+    {
+      if (m_fd != -1)
+        ::close(m_fd);
+      m_fd = fd;
+    }
+
+  private:
+    int m_fd = -1;
+  };
+  struct pipe_fds
+  {
+    unique_fd read;
+    unique_fd write;
+  };
+
+  // start the process with posix_spawn in its own process group
+  pid_t spawn_process(std::vector<char*>& argv,
+                      const int stdin_fd,
+                      const int stdout_fd,
+                      const int stderr_fd,
+                      const std::filesystem::path& working_dir)
+  {
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawnattr_init(&attr);
+    if (stdin_fd != -1)
+      posix_spawn_file_actions_adddup2(&actions, stdin_fd, STDIN_FILENO);
+    else
+      posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+    posix_spawn_file_actions_adddup2(&actions, stdout_fd, STDOUT_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, stderr_fd, STDERR_FILENO);
+    const std::string dir = working_dir.string();
+    if (!dir.empty())
+      posix_spawn_file_actions_addchdir_np(&actions, dir.c_str());
+    sigset_t sigs;
+    sigemptyset(&sigs);
+    posix_spawnattr_setsigmask(&attr, &sigs);
+    sigaddset(&sigs, SIGINT);
+    sigaddset(&sigs, SIGPIPE);
+    posix_spawnattr_setsigdefault(&attr, &sigs);
+    posix_spawnattr_setpgroup(&attr, 0);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+    pid_t pid;
+    const int ret = ::posix_spawnp(&pid, argv[0], &actions, &attr, argv.data(), environ);
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+    if (ret != 0)
+      throw std::runtime_error(fmt::format("can't start process: {}", std::strerror(ret)));
+    return pid;
+  }
+
+  // start the process with fork/exec in its own process group: the child applies the limits before exec
+  //  everything is prepared before the fork: the child only makes async-signal-safe calls
+  //  a failure of the child is reported with its step and errno in a close-on-exec pipe
+  pid_t fork_process(std::vector<char*>& argv,
+                     const int stdin_fd,
+                     const int stdout_fd,
+                     const int stderr_fd,
+                     const std::filesystem::path& working_dir,
+                     const process_limits& limits)
+  {
+    static const char* const steps[] = { "redirections", "working directory", "cpus", "nice", "io-priority", "max-memory", "max-open-files", "exec" };
+    const std::string path = find_executable(argv[0]);
+    const std::string dir = working_dir.string();
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    for (const int c : limits.cpus)
+      CPU_SET(c, &cpus);
+    const rlimit memory{ static_cast<rlim_t>(limits.max_memory), static_cast<rlim_t>(limits.max_memory) };
+    const rlimit files{ static_cast<rlim_t>(limits.max_open_files), static_cast<rlim_t>(limits.max_open_files) };
+    struct sigaction sig_default;
+    std::memset(&sig_default, 0, sizeof(sig_default));
+    sig_default.sa_handler = SIG_DFL;
+    sigset_t sigs;
+    sigemptyset(&sigs);
+    int fds[2];
+    if (::pipe2(fds, O_CLOEXEC) == -1)
+      throw std::runtime_error("can't start process (pipe)");
+    unique_fd status_read;
+    unique_fd status_write;
+    status_read.reset(fds[0]);
+    status_write.reset(fds[1]);
+
+    const pid_t pid = ::fork();
+    if (pid == -1)
+      throw std::runtime_error(fmt::format("can't start process: {}", std::strerror(errno)));
+    if (pid == 0)
+    {
+      auto fail = [&](const int step) -> void {
+        const int status[2] = { step, errno };
+        const ssize_t written = ::write(status_write.get(), status, sizeof(status));
+        (void)written;
+        ::_exit(127);
+      };
+      ::setpgid(0, 0);
+      ::sigaction(SIGINT, &sig_default, nullptr);
+      ::sigaction(SIGPIPE, &sig_default, nullptr);
+      ::sigprocmask(SIG_SETMASK, &sigs, nullptr);
+      const int in = (stdin_fd != -1) ? stdin_fd : ::open("/dev/null", O_RDONLY | O_CLOEXEC);
+      if ((in == -1) || (::dup2(in, STDIN_FILENO) == -1) ||
+          (::dup2(stdout_fd, STDOUT_FILENO) == -1) || (::dup2(stderr_fd, STDERR_FILENO) == -1))
+        fail(0);
+      if (!dir.empty() && (::chdir(dir.c_str()) == -1))
+        fail(1);
+      if (!limits.cpus.empty() && (::sched_setaffinity(0, sizeof(cpus), &cpus) == -1))
+        fail(2);
+      if (limits.nice && (::setpriority(PRIO_PROCESS, 0, *limits.nice) == -1))
+        fail(3);
+#ifdef SYS_ioprio_set
+      if (limits.io_class && (::syscall(SYS_ioprio_set, 1 /* IOPRIO_WHO_PROCESS */, 0, (limits.io_class << 13) | limits.io_level) == -1))
+        fail(4);
+#else
+      if (limits.io_class)
+      {
+        errno = ENOSYS;
+        fail(4);
+      }
+#endif
+      if (limits.max_memory && (::setrlimit(RLIMIT_AS, &memory) == -1))
+        fail(5);
+      if (limits.max_open_files && (::setrlimit(RLIMIT_NOFILE, &files) == -1))
+        fail(6);
+      ::execve(path.c_str(), argv.data(), environ);
+      fail(7);
+    }
+
+    // the status pipe is closed without data by a successful exec
+    ::setpgid(pid, pid);
+    status_write.reset();
+    int status[2];
+    ssize_t size;
+    do
+      size = ::read(status_read.get(), status, sizeof(status));
+    while ((size == -1) && (errno == EINTR));
+    if (size != sizeof(status))
+      return pid;
+    ::waitpid(pid, nullptr, 0);
+    const int step = std::min(std::max(status[0], 0), 7);
+    throw std::runtime_error(fmt::format("can't start process ({}): {}", steps[step], std::strerror(status[1])));
+  }
+
+  // read the output of the process until it terminates and collect its exit code
+  //  the stdout is also copied into the tee pipe (if any) without being read: tee() on Linux
+  int wait(const pid_t pid,
+           unique_fd& out,
+           unique_fd& err,
+           unique_fd& tee_out,
+           const std::chrono::milliseconds& timeout,
+           const logs_callback& cb_logs)
+  {
+    // the pidfd signals the process termination - fallback to polling on older kernels
+    unique_fd pidfd;
+#ifdef SYS_pidfd_open
+    pidfd.reset(static_cast<int>(::syscall(SYS_pidfd_open, pid, 0)));
+#endif
+    unique_fd epoll;
+    epoll.reset(::epoll_create1(EPOLL_CLOEXEC));
+    if (epoll.get() == -1)
+    {
+      kill();
+      {
+        std::lock_guard<std::mutex> lck(m_signal_mtx);
+        m_pid = 0;
+      }
+      ::waitpid(pid, nullptr, 0);
+      throw std::runtime_error("can't wait for process (epoll)");
+    }
+    auto add = [&](const unique_fd& f) -> void {
+      if (f.get() == -1)
+        return;
+      ::fcntl(f.get(), F_SETFL, ::fcntl(f.get(), F_GETFL) | O_NONBLOCK);
+      epoll_event ev{};
+      ev.events = EPOLLIN;
+      ev.data.fd = f.get();
+      ::epoll_ctl(epoll.get(), EPOLL_CTL_ADD, f.get(), &ev);
+    };
+    add(out);
+    add(err);
+    add(pidfd);
+
+    // read all the available data of a pipe - close it at the end of file
+    std::string buffer(64 * 1024, '\0');
+    std::size_t opened = (out.get() != -1) + (err.get() != -1);
+    auto drain = [&](unique_fd& f) -> void {
+      while (f.get() != -1)
+      {
+        const ssize_t n = ::read(f.get(), buffer.data(), buffer.size());
+        if (n > 0)
+        {
+          m_stats.output_bytes += static_cast<std::size_t>(n);
+          cb_logs(std::string(buffer.data(), static_cast<std::size_t>(n)));
+        }
+        else if ((n == -1) && (errno == EINTR))
+          continue;
+        else
+        {
+          if ((n == 0) || (errno != EAGAIN))
+          {
+            ::epoll_ctl(epoll.get(), EPOLL_CTL_DEL, f.get(), nullptr);
+            f.reset();
+            --opened;
+          }
+          break;
+        }
+      }
+    };
+
+    // copy the available stdout into the tee pipe then read the copied data for the logs
+    //  return true if the tee pipe is full: the stdout is watched again when it becomes writable
+    auto forward = [&]() -> bool {
+      while ((out.get() != -1) && (tee_out.get() != -1))
+      {
+        const ssize_t n = ::tee(out.get(), tee_out.get(), buffer.size(), SPLICE_F_NONBLOCK);
+        if (n > 0)
+        {
+          std::size_t remaining = static_cast<std::size_t>(n);
+          while (remaining)
+          {
+            const ssize_t r = ::read(out.get(), buffer.data(), remaining);
+            if ((r == -1) && (errno == EINTR))
+              continue;
+            if (r <= 0)
+              break;
+            remaining -= static_cast<std::size_t>(r);
+            m_stats.output_bytes += static_cast<std::size_t>(r);
+            cb_logs(std::string(buffer.data(), static_cast<std::size_t>(r)));
+          }
+        }
+        else if ((n == -1) && (errno == EINTR))
+          continue;
+        else if ((n == -1) && (errno == EAGAIN))
+        {
+          int available = 0;
+          return (::ioctl(out.get(), FIONREAD, &available) == 0) && (available > 0);
+        }
+        else if (n == 0)
+        {
+          drain(out);
+          break;
+        }
+        else
+        {
+          // the next process doesn't read its stdin anymore: the stdout is closed like in a shell pipeline
+          tee_out.reset();
+          drain(out);
+          if (out.get() != -1)
+          {
+            ::epoll_ctl(epoll.get(), EPOLL_CTL_DEL, out.get(), nullptr);
+            out.reset();
+            --opened;
+          }
+          return false;
+        }
+      }
+      drain(out);
+      return false;
+    };
+    auto watch_tee = [&](const bool full) -> void {
+      epoll_event ev{};
+      ev.events = full ? EPOLLOUT : EPOLLIN;
+      ev.data.fd = full ? tee_out.get() : out.get();
+      ::epoll_ctl(epoll.get(), EPOLL_CTL_DEL, full ? out.get() : tee_out.get(), nullptr);
+      ::epoll_ctl(epoll.get(), EPOLL_CTL_ADD, ev.data.fd, &ev);
+    };
+    auto read_out = [&]() -> void {
+      if (tee_out.get() == -1)
+        drain(out);
+      else if (forward() && (tee_out.get() != -1))
+        watch_tee(true);
+    };
+
+    // wait for the events: output, process termination or timeout
+    using clock = std::chrono::steady_clock;
+    const clock::time_point deadline = clock::now() + timeout;
+    bool exited = false;
+    bool timed_out = false;
+    int status = 0;
+    auto reap = [&](const bool block) -> bool {
+      // a blocking wait leaves the process as a zombie (WNOWAIT): the lock is not held while waiting
+      if (block)
+      {
+        siginfo_t info{};
+        while ((::waitid(P_PID, static_cast<id_t>(pid), &info, WEXITED | WNOWAIT) == -1) && (errno == EINTR))
+          ;
+      }
+
+      // the process is reaped and forgotten at once: no signal is sent to its pid once reused
+      std::lock_guard<std::mutex> lck(m_signal_mtx);
+      struct rusage usage{};
+      const pid_t r = ::wait4(pid, &status, WNOHANG, &usage);
+      exited = (r == pid) || ((r == -1) && (errno == ECHILD));
+      if (r == pid)
+      {
+        auto to_us = [](const timeval& tv) { return std::chrono::microseconds(tv.tv_sec * 1000000LL + tv.tv_usec); };
+        m_stats.user_cpu = to_us(usage.ru_utime);
+        m_stats.sys_cpu = to_us(usage.ru_stime);
+        m_stats.peak_rss = static_cast<std::size_t>(usage.ru_maxrss) * 1024;
+      }
+      if (exited)
+        m_pid = 0;
+      return exited;
+    };
+    while (!exited)
+    {
+      int wait_ms = -1;
+      if (pidfd.get() == -1)
+        wait_ms = opened ? 100 : 10;
+      if (timeout.count())
+      {
+        const auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - clock::now()).count();
+        if (remaining <= 0)
+        {
+          timed_out = true;
+          kill();
+          reap(true);
+          break;
+        }
+        wait_ms = (wait_ms == -1) ? static_cast<int>(remaining) : std::min(wait_ms, static_cast<int>(remaining));
+      }
+
+      epoll_event events[4];
+      const int n = ::epoll_wait(epoll.get(), events, 4, wait_ms);
+      for (int i = 0; i < n; ++i)
+      {
+        if (events[i].data.fd == out.get())
+          read_out();
+        else if (events[i].data.fd == err.get())
+          drain(err);
+        else if (events[i].data.fd == pidfd.get())
+          reap(true);
+        else if ((tee_out.get() != -1) && (events[i].data.fd == tee_out.get()))
+        {
+          watch_tee(false);
+          read_out();
+        }
+      }
+      if ((pidfd.get() == -1) && !exited)
+        reap(false);
+    }
+
+    // read the remaining output - the children of the process could keep the pipes opened
+    //  the remaining stdout is copied into the tee pipe while the next process reads it
+    while (!timed_out && (tee_out.get() != -1) && forward() && (tee_out.get() != -1))
+    {
+      pollfd pfd{ tee_out.get(), POLLOUT, 0 };
+      ::poll(&pfd, 1, -1);
+    }
+    tee_out.reset();
+    drain(out);
+    drain(err);
+    if (timed_out)
+      return -1;
+    if (WIFEXITED(status))
+      return WEXITSTATUS(status);
+    if (WIFSIGNALED(status))
+      return 128 + WTERMSIG(status);
+    return -1;
+  }
+
+private:
+  std::mutex m_signal_mtx;
+  std::atomic<pid_t> m_pid = 0;
+};
+
+inline std::unique_ptr<process_runner> create_process_runner()
+{
+  return std::make_unique<posix_process_runner>();
+}
+
+inline void open_pipe(process_pipes& from, process_pipes& to)
+{
+  int fds[2];
+  if (::pipe2(fds, O_CLOEXEC) == -1)
+    throw std::runtime_error(fmt::format("can't create pipe: {}", std::strerror(errno)));
+  from.out = fds[1];
+  to.in = fds[0];
+}
+
+inline void close_pipes(process_pipes& pipes)
+{
+  if (pipes.in != -1)
+    ::close(pipes.in);
+  if (pipes.out != -1)
+    ::close(pipes.out);
+  pipes.in = -1;
+  pipes.out = -1;
+}
+
+inline std::string quote_argument(const std::string& arg)
+{
+  if (!arg.empty() && (arg.find_first_of(" \t\n\r\"'\\") == std::string::npos))
+    return arg;
+  std::string quoted = "\"";
+  for (const char c : arg)
+  {
+    if ((c == '\"') || (c == '\\'))
+      quoted += '\\';
+    quoted += c;
+  }
+  return quoted + "\"";
+}
+
+inline std::size_t max_command_line()
+{
+  // the arguments share the ARG_MAX limit with the environment (and the pointers of both arrays)
+  //  only half of the remaining space is used to keep a safe margin
+  static const std::size_t limit = []() -> std::size_t {
+    const long arg_max = ::sysconf(_SC_ARG_MAX);
+    std::size_t env_size = 0;
+    for (char** e = environ; e && *e; ++e)
+      env_size += std::strlen(*e) + 1 + sizeof(char*);
+    const std::size_t available = (arg_max > 0) ? static_cast<std::size_t>(arg_max) : 131072;
+    return (available > env_size + 8192) ? (available - env_size) / 2 : 4096;
+  }();
+  return limit;
+}
+#endif
@@ -0,0 +1,562 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+#include <functional>
+#include <stdexcept>
+#include <filesystem>
+#include <fmt/core.h>
+#ifdef _WIN32
+#include <future>
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <cerrno>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#endif
+
+/*============================================
+| Declaration
+==============================================*/
+// name of the resource used by the "protected: true" flag - same system mutex as previous versions
+const std::string g_default_resource = "AutoLaunchSystemMtx";
+
+// maximum number of concurrent holders of a resource
+constexpr std::size_t g_max_resource_capacity = 64;
+
+// resource shared between the tasks and all the AutoLaunch instances
+struct resource
+{
+  std::string name;
+  std::size_t capacity = 1;
+};
+
+// parse a resource definition: "name" or "name:capacity"
+inline resource parse_resource(const std::string& str);
+
+// system wide counting lock: at most "capacity" holders between all the AutoLaunch instances
+//  each holder owns one slot of the resource, a slot is released by the system if its owner crashes
+//  Linux: the waiters are served by order of arrival - each one has a locked file in the queue directory of the resource,
+//  it waits for the release of the previous waiter, then for the release of a slot (inotify: no polling)
+//  Windows: the waiters go through a turnstile (system mutex) - served in the order chosen by the system
+class resource_lock
+{
+public:
+  resource_lock(const std::string& name, const std::size_t capacity);
+  ~resource_lock();
+
+  resource_lock(const resource_lock&) = delete;
+  resource_lock& operator=(const resource_lock&) = delete;
+
+  // wait for a free slot of the resource - can be released from any thread
+  //  the wait is given up (exception) when the cancelled function returns true
+  std::size_t acquire(const std::function<bool()>& cancelled = nullptr);
+
+  // release a slot of the resource
+  void release(const std::size_t slot);
+
+  const std::string& name() const { return m_name; }
+  std::size_t capacity() const { return m_capacity; }
+
+private:
+  // name of the system object of a slot (or the turnstile / queue directory if slot == capacity)
+  std::string system_name(const std::size_t slot) const;
+
+  // acquire/release a slot between the AutoLaunch instances
+  std::size_t acquire_slot(const std::function<bool()>& cancelled);
+  bool release_slot(const std::size_t slot);
+#ifndef _WIN32
+  // open a lock file shared by all the users - created writable by all
+  static int open_lock_file(const std::string& path);
+#endif
+
+  // error of a wait given up by a cancellation
+  std::runtime_error cancelled_error() const
+  {
+    return std::runtime_error(fmt::format("cancelled while waiting for the resource \"{}\"", m_name));
+  }
+
+private:
+  // period of the checks of the cancellation while waiting
+  static constexpr std::chrono::milliseconds g_cancel_check{ 100 };
+  const std::string m_name;
+  const std::size_t m_capacity;
+  std::mutex m_mtx;
+  std::condition_variable m_cv;
+  std::size_t m_users = 0;
+  std::vector<bool> m_held;
+#ifdef _WIN32
+  struct keeper
+  {
+    std::thread thread;
+    std::promise<void> release;
+  };
+  std::vector<HANDLE> m_handles;
+  HANDLE m_turnstile = nullptr;
+  std::map<std::size_t, keeper> m_keepers;
+#else
+  std::vector<int> m_fds;                       // slots held by this process: closed when released (wakes the waiters)
+  std::uint64_t m_tickets = 0;
+#endif
+};
+
+// list of the resources used by this process
+class resource_manager
+{
+public:
+  // get the lock of a resource - created on first use
+  resource_lock& get(const resource& r);
+
+private:
+  std::mutex m_mtx;
+  std::map<std::string, std::unique_ptr<resource_lock>> m_locks;
+};
+
+// hold a list of resources - acquired by order of name to avoid deadlocks
+class resource_guard
+{
+public:
+  resource_guard() = default;
+  ~resource_guard() { unlock(); }
+
+  resource_guard(const resource_guard&) = delete;
+  resource_guard& operator=(const resource_guard&) = delete;
+
+  // acquire all the resources - the wait is given up (exception) when the cancelled function returns true
+  void lock(resource_manager& manager, std::vector<resource> resources, const std::function<bool()>& cancelled = nullptr);
+
+  // release all the resources - by reverse order
+  void unlock();
+
+  bool owns_lock() const { return !m_slots.empty(); }
+
+private:
+  std::vector<std::pair<resource_lock*, std::size_t>> m_slots;
+};
+
+/*============================================
+| Definition
+==============================================*/
+inline resource parse_resource(const std::string& str)
+{
+  resource r;
+  const std::size_t pos = str.find(':');
+  r.name = str.substr(0, pos);
+  if (pos != std::string::npos)
+  {
+    const std::string capacity = str.substr(pos + 1);
+    if (capacity.empty() || !std::all_of(capacity.begin(), capacity.end(), [](const char c) { return (c >= '0') && (c <= '9'); }))
+      throw std::runtime_error(fmt::format("invalid resource capacity: \"{}\"", str));
+    r.capacity = std::stoul(capacity);
+  }
+  if (r.name.empty() || !std::all_of(r.name.begin(), r.name.end(), [](const char c) {
+        return ((c >= 'a') && (c <= 'z')) || ((c >= 'A') && (c <= 'Z')) || ((c >= '0') && (c <= '9')) || (c == '-') || (c == '_') || (c == '.');
+      }))
+    throw std::runtime_error(fmt::format("invalid resource name: \"{}\"", str));
+  if ((r.capacity == 0) || (r.capacity > g_max_resource_capacity))
+    throw std::runtime_error(fmt::format("invalid resource capacity: \"{}\" (1 to {})", str, g_max_resource_capacity));
+  return r;
+}
+
+inline std::string resource_lock::system_name(const std::size_t slot) const
+{
+  // the default resource keeps the name of the system mutex of the previous versions
+  std::string name = (m_name == g_default_resource) ? m_name : "AutoLaunch-" + m_name;
+  if (slot == m_capacity)
+    name += ".queue";
+  else if (m_capacity > 1)
+    name += fmt::format(".{}", slot);
+#ifdef _WIN32
+  return "Global\\" + name;
+#else
+  return (std::filesystem::temp_directory_path() / ((slot == m_capacity) ? name : name + ".lock")).string();
+#endif
+}
+
+inline resource_lock::resource_lock(const std::string& name, const std::size_t capacity) :
+  m_name(name),
+  m_capacity(capacity),
+  m_held(capacity, false)
+{
+#ifdef _WIN32
+  for (std::size_t i = 0; i <= m_capacity; ++i)
+  {
+    HANDLE h = ::CreateMutexA(nullptr, FALSE, system_name(i).c_str());
+    if (!h)
+    {
+      for (auto& handle : m_handles)
+        ::CloseHandle(handle);
+      throw std::runtime_error(fmt::format("can't create system mutex: \"{}\"", system_name(i)));
+    }
+    if (i == m_capacity)
+      m_turnstile = h;
+    else
+      m_handles.push_back(h);
+  }
+#else
+  // the queue directory and the lock files are shared by all the users
+  const std::string queue = system_name(m_capacity);
+  if (::mkdir(queue.c_str(), 0777) == 0)
+    ::chmod(queue.c_str(), 0777);
+  else if (errno != EEXIST)
+    throw std::runtime_error(fmt::format("can't create lock directory: \"{}\"", queue));
+  for (std::size_t i = 0; i < m_capacity; ++i)
+  {
+    const int fd = open_lock_file(system_name(i));
+    if (fd == -1)
+      throw std::runtime_error(fmt::format("can't open lock file: \"{}\"", system_name(i)));
+    ::close(fd);
+  }
+  m_fds.assign(m_capacity, -1);
+#endif
+}
+
+inline resource_lock::~resource_lock()
+{
+  for (std::size_t i = 0; i < m_capacity; ++i)
+    if (m_held[i])
+      release(i);
+#ifdef _WIN32
+  for (auto& h : m_handles)
+    ::CloseHandle(h);
+  ::CloseHandle(m_turnstile);
+#endif
+}
+
+inline std::size_t resource_lock::acquire(const std::function<bool()>& cancelled)
+{
+  // at most "capacity" threads of this process compete for the slots
+  {
+    std::unique_lock<std::mutex> lck(m_mtx);
+    while (!m_cv.wait_for(lck, g_cancel_check, [&]() { return m_users < m_capacity; }))
+      if (cancelled && cancelled())
+        throw cancelled_error();
+    ++m_users;
+  }
+  try
+  {
+    return acquire_slot(cancelled);
+  }
+  catch (...)
+  {
+    {
+      std::lock_guard<std::mutex> lck(m_mtx);
+      --m_users;
+    }
+    m_cv.notify_one();
+    throw;
+  }
+}
+
+inline void resource_lock::release(const std::size_t slot)
+{
+  if (!release_slot(slot))
+    return;
+  {
+    std::lock_guard<std::mutex> lck(m_mtx);
+    --m_users;
+  }
+  m_cv.notify_one();
+}
+
+#ifdef _WIN32
+inline std::size_t resource_lock::acquire_slot(const std::function<bool()>& cancelled)
+{
+  // the slot mutex is owned by a dedicated thread because it must be released by its owner
+  //  the thread gives up the wait when the execution is cancelled
+  std::promise<std::size_t> acquired;
+  std::future<std::size_t> slot_acquired = acquired.get_future();
+  std::promise<void> release;
+  std::future<void> released = release.get_future();
+  std::thread thread([this, cancelled, acquired = std::move(acquired), released = std::move(released)]() mutable {
+    auto wait = [&](const DWORD count, const HANDLE* handles) -> DWORD {
+      while (true)
+      {
+        const DWORD ret = ::WaitForMultipleObjects(count, handles, FALSE, static_cast<DWORD>(g_cancel_check.count()));
+        if ((ret != WAIT_TIMEOUT) || (cancelled && cancelled()))
+          return ret;
+      }
+    };
+    if (wait(1, &m_turnstile) == WAIT_TIMEOUT)
+    {
+      acquired.set_exception(std::make_exception_ptr(cancelled_error()));
+      return;
+    }
+    const DWORD ret = wait(static_cast<DWORD>(m_handles.size()), m_handles.data());
+    ::ReleaseMutex(m_turnstile);
+    if (ret == WAIT_TIMEOUT)
+    {
+      acquired.set_exception(std::make_exception_ptr(cancelled_error()));
+      return;
+    }
+    const std::size_t slot = (ret >= WAIT_ABANDONED_0) ? (ret - WAIT_ABANDONED_0) : (ret - WAIT_OBJECT_0);
+    acquired.set_value(slot);
+    released.wait();
+    ::ReleaseMutex(m_handles[slot]);
+  });
+  std::size_t slot = 0;
+  try
+  {
+    slot = slot_acquired.get();
+  }
+  catch (...)
+  {
+    thread.join();
+    throw;
+  }
+  std::lock_guard<std::mutex> lck(m_mtx);
+  m_held[slot] = true;
+  m_keepers[slot] = keeper{ std::move(thread), std::move(release) };
+  return slot;
+}
+
+inline bool resource_lock::release_slot(const std::size_t slot)
+{
+  keeper k;
+  {
+    std::lock_guard<std::mutex> lck(m_mtx);
+    if ((slot >= m_capacity) || !m_held[slot])
+      return false;
+    k = std::move(m_keepers[slot]);
+    m_keepers.erase(slot);
+    m_held[slot] = false;
+  }
+  k.release.set_value();
+  k.thread.join();
+  return true;
+}
+#else
+inline int resource_lock::open_lock_file(const std::string& path)
+{
+  // flock only needs a read-only descriptor: the files of the other users can be opened
+  //  the creator sets the mode 0666 (ignoring the umask), an existing file is opened without O_CREAT (protected_regular)
+  while (true)
+  {
+    const int fd = ::open(path.c_str(), O_RDONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0666);
+    if (fd != -1)
+    {
+      ::fchmod(fd, 0666);
+      return fd;
+    }
+    if (errno != EEXIST)
+      return -1;
+    const int existing = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if ((existing != -1) || (errno != ENOENT))
+      return existing;
+  }
+}
+
+inline std::size_t resource_lock::acquire_slot(const std::function<bool()>& cancelled)
+{
+  struct fd_guard
+  {
+    int fd = -1;
+    ~fd_guard()
+    {
+      if (fd != -1)
+        ::close(fd);
+    }
+  };
+  auto flock = [](const int fd, const int op) -> bool {
+    while (::flock(fd, op) == -1)
+      if (errno != EINTR)
+        return false;
+    return true;
+  };
+
+  // wait for a change of the watched files: closed (released or crashed owner) or removed
+  //  without inotify (limit of instances reached): the files are tested again after a delay
+  //  the cancellation is checked periodically (and when ctrl-c interrupts the poll): the queue is left
+  fd_guard events{ ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC) };
+  std::chrono::milliseconds backoff(1);
+  auto wait = [&]() -> void {
+    if (events.fd == -1)
+    {
+      std::this_thread::sleep_for(backoff);
+      backoff = std::min(backoff * 2, std::chrono::milliseconds(50));
+      if (cancelled && cancelled())
+        throw cancelled_error();
+      return;
+    }
+    pollfd p{ events.fd, POLLIN, 0 };
+    while (::poll(&p, 1, static_cast<int>(g_cancel_check.count())) <= 0)
+      if (cancelled && cancelled())
+        throw cancelled_error();
+    char buffer[4096];
+    while (::read(events.fd, buffer, sizeof(buffer)) > 0)
+      ;
+  };
+  auto watch = [&](const std::string& path, const std::uint32_t mask) -> int {
+    return (events.fd != -1) ? ::inotify_add_watch(events.fd, path.c_str(), mask) : -1;
+  };
+  auto unwatch = [&](const int wd) -> void {
+    if (wd != -1)
+      ::inotify_rm_watch(events.fd, wd);
+  };
+
+  // enter the queue: a file named by the time of arrival, locked by its owner while it waits (unlocked by the system if it crashes)
+  //  the file is locked before it's renamed: a waiter is never taken for a crashed one
+  const std::string queue = system_name(m_capacity);
+  std::string name;
+  {
+    std::lock_guard<std::mutex> lck(m_mtx);
+    name = fmt::format("{:020}-{:010}-{:020}.wait", std::chrono::steady_clock::now().time_since_epoch().count(), ::getpid(), ++m_tickets);
+  }
+  const std::string path = queue + "/" + name;
+  const std::string temp = queue + "/." + name;
+  struct queue_entry
+  {
+    std::string path;
+    int fd = -1;
+    ~queue_entry()
+    {
+      // removed before it's unlocked: the next waiter never finds it unlocked in the queue
+      ::unlink(path.c_str());
+      if (fd != -1)
+        ::close(fd);
+    }
+  } entry{ temp, ::open(temp.c_str(), O_RDONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0666) };
+  if ((entry.fd == -1) || !flock(entry.fd, LOCK_EX) || (::rename(temp.c_str(), path.c_str()) == -1))
+    throw std::runtime_error(fmt::format("can't enter the queue: \"{}\"", queue));
+  entry.path = path;
+
+  // wait for the previous waiters: the last one still locked is watched until it leaves the queue
+  //  an unlocked file is the file of a crashed waiter: removed
+  bool first = false;
+  while (!first)
+  {
+    std::vector<std::string> previous;
+    std::error_code ec;
+    for (const auto& e : std::filesystem::directory_iterator(queue, ec))
+    {
+      const std::string n = e.path().filename().string();
+      if ((n.size() == name.size()) && (n[0] != '.') && (n < name))
+        previous.push_back(n);
+    }
+    std::sort(previous.begin(), previous.end(), std::greater<std::string>());
+    first = true;
+    for (const auto& n : previous)
+    {
+      const std::string other = queue + "/" + n;
+      fd_guard waiter{ ::open(other.c_str(), O_RDONLY | O_CLOEXEC) };
+      if (waiter.fd == -1)
+        continue;
+      const int wd = watch(other, IN_CLOSE | IN_ATTRIB);
+      if (::flock(waiter.fd, LOCK_SH | LOCK_NB) == 0)
+      {
+        unwatch(wd);
+        ::unlink(other.c_str());
+        continue;
+      }
+      wait();
+      unwatch(wd);
+      first = false;
+      break;
+    }
+  }
+
+  // first waiter: wait for a free slot - the slots are watched before they are tested and stay opened while tested
+  //  (the closes of the other descriptors wake the waiter: a release or a crash of a holder)
+  std::vector<int> fds(m_capacity, -1);
+  std::vector<int> wds;
+  struct fds_guard
+  {
+    std::vector<int>& fds;
+    ~fds_guard()
+    {
+      for (const int fd : fds)
+        if (fd != -1)
+          ::close(fd);
+    }
+  } guard{ fds };
+  for (std::size_t i = 0; i < m_capacity; ++i)
+  {
+    wds.push_back(watch(system_name(i), IN_CLOSE));
+    fds[i] = open_lock_file(system_name(i));
+    if (fds[i] == -1)
+      throw std::runtime_error(fmt::format("can't open lock file: \"{}\"", system_name(i)));
+  }
+  while (true)
+  {
+    {
+      std::lock_guard<std::mutex> lck(m_mtx);
+      for (std::size_t i = 0; i < m_capacity; ++i)
+      {
+        if (m_held[i] || !flock(fds[i], LOCK_EX | LOCK_NB))
+          continue;
+        m_held[i] = true;
+        m_fds[i] = fds[i];
+        fds[i] = -1;
+        return i;
+      }
+    }
+    wait();
+  }
+}
+
+inline bool resource_lock::release_slot(const std::size_t slot)
+{
+  // the slot is closed: its release wakes the first waiter
+  std::lock_guard<std::mutex> lck(m_mtx);
+  if ((slot >= m_capacity) || !m_held[slot])
+    return false;
+  ::close(m_fds[slot]);
+  m_fds[slot] = -1;
+  m_held[slot] = false;
+  return true;
+}
+#endif
+
+inline resource_lock& resource_manager::get(const resource& r)
+{
+  std::lock_guard<std::mutex> lck(m_mtx);
+  std::unique_ptr<resource_lock>& lock = m_locks[r.name];
+  if (!lock)
+    lock = std::make_unique<resource_lock>(r.name, r.capacity);
+  else if (lock->capacity() != r.capacity)
+    throw std::runtime_error(fmt::format("resource \"{}\" declared with different capacities: {} and {}", r.name, lock->capacity(), r.capacity));
+  return *lock;
+}
+
+inline void resource_guard::lock(resource_manager& manager, std::vector<resource> resources, const std::function<bool()>& cancelled)
+{
+  std::sort(resources.begin(), resources.end(), [](const resource& a, const resource& b) { return a.name < b.name; });
+  for (std::size_t i = 1; i < resources.size(); ++i)
+    if ((resources[i - 1].name == resources[i].name) && (resources[i - 1].capacity != resources[i].capacity))
+      throw std::runtime_error(fmt::format("resource \"{}\" declared with different capacities: {} and {}", resources[i].name, resources[i - 1].capacity, resources[i].capacity));
+  resources.erase(std::unique(resources.begin(), resources.end(), [](const resource& a, const resource& b) { return a.name == b.name; }), resources.end());
+  try
+  {
+    for (const auto& r : resources)
+    {
+      resource_lock& l = manager.get(r);
+      m_slots.emplace_back(&l, l.acquire(cancelled));
+    }
+  }
+  catch (...)
+  {
+    unlock();
+    throw;
+  }
+}
+
+inline void resource_guard::unlock()
+{
+  for (auto it = m_slots.rbegin(); it != m_slots.rend(); ++it)
+    it->first->release(it->second);
+  m_slots.clear();
+}
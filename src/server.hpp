@@ -0,0 +1,325 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <functional>
+#include <filesystem>
+#include <stdexcept>
+#include <fmt/core.h>
+#include <nlohmann/json.hpp>
+#include <sched.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "execution.hpp"
+
+/*============================================
+| Declaration
+==============================================*/
+// resident AutoLaunch: executes the tasks files submitted on a unix domain socket
+//  protocol: the client sends its request as a json line,
+//  the server answers with frames: type (1 byte), size (4 bytes, little-endian) and data
+//  'o': output of the execution, 'x': exit code of the execution (int32)
+class task_server
+{
+public:
+  // execute a request: the output is written in the file - return the exit code
+  using handler = std::function<int(const run_request& request, std::FILE* out)>;
+
+  task_server(const std::filesystem::path& socket_path, const handler& fct);
+  ~task_server();
+
+  task_server(const task_server&) = delete;
+  task_server& operator=(const task_server&) = delete;
+
+  // accept the clients until stopped - each one is served by its own thread
+  //  return once the clients being served are completed
+  void run();
+
+  // stop accepting the clients - can be called from any thread
+  void stop();
+
+private:
+  // execute the request of a client
+  void serve(int fd);
+
+private:
+  const std::filesystem::path m_path;
+  const handler m_handler;
+  int m_fd = -1;
+  std::atomic<bool> m_stopped = false;
+  std::mutex m_mtx;
+  std::condition_variable m_cv;
+  std::size_t m_clients = 0;                    // number of clients being served
+};
+
+// submit a request to the server and display its output - return the exit code of the execution
+inline int submit(const std::filesystem::path& socket_path, const run_request& request);
+
+/*============================================
+| Definition
+==============================================*/
+namespace server_detail
+{
+  // connect a unix domain socket
+  inline sockaddr_un get_address(const std::filesystem::path& path)
+  {
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    const std::string str = path.string();
+    if (str.size() >= sizeof(addr.sun_path))
+      throw std::runtime_error(fmt::format("socket path too long: \"{}\"", str));
+    std::memcpy(addr.sun_path, str.c_str(), str.size() + 1);
+    return addr;
+  }
+
+  // write all the data on the socket
+  inline bool send_all(const int fd, const char* data, std::size_t size)
+  {
+    while (size)
+    {
+      const ssize_t n = ::send(fd, data, size, MSG_NOSIGNAL);
+      if ((n == -1) && (errno == EINTR))
+        continue;
+      if (n <= 0)
+        return false;
+      data += n;
+      size -= static_cast<std::size_t>(n);
+    }
+    return true;
+  }
+
+  // read exactly size bytes from the socket
+  inline bool recv_all(const int fd, char* data, std::size_t size)
+  {
+    while (size)
+    {
+      const ssize_t n = ::recv(fd, data, size, 0);
+      if ((n == -1) && (errno == EINTR))
+        continue;
+      if (n <= 0)
+        return false;
+      data += n;
+      size -= static_cast<std::size_t>(n);
+    }
+    return true;
+  }
+
+  // write a frame: type, size and data
+  inline bool send_frame(const int fd, const char type, const char* data, const std::size_t size)
+  {
+    char header[5] = { type };
+    for (int i = 0; i < 4; ++i)
+      header[1 + i] = static_cast<char>((size >> (8 * i)) & 0xff);
+    return send_all(fd, header, sizeof(header)) && send_all(fd, data, size);
+  }
+
+  // file of the output of an execution: each write is sent as an 'o' frame
+  inline std::FILE* open_output(int* fd)
+  {
+    cookie_io_functions_t io{};
+    io.write = [](void* cookie, const char* data, std::size_t size) -> ssize_t {
+      return send_frame(*static_cast<int*>(cookie), 'o', data, size) ? static_cast<ssize_t>(size) : -1;
+    };
+    std::FILE* f = ::fopencookie(fd, "w", io);
+    if (f)
+      std::setvbuf(f, nullptr, _IOLBF, 64 * 1024);
+    return f;
+  }
+}
+
+inline task_server::task_server(const std::filesystem::path& socket_path, const handler& fct) :
+  m_path(socket_path),
+  m_handler(fct)
+{
+  const sockaddr_un addr = server_detail::get_address(m_path);
+
+  // a remaining socket file is removed if no server is listening on it
+  if (std::filesystem::exists(m_path))
+  {
+    const int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    const bool used = (fd != -1) && (::connect(fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) == 0);
+    if (fd != -1)
+      ::close(fd);
+    if (used)
+      throw std::runtime_error(fmt::format("a server is already listening on: \"{}\"", m_path.string()));
+    std::filesystem::remove(m_path);
+  }
+
+  m_fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if ((m_fd == -1) ||
+      (::bind(m_fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) == -1) ||
+      (::listen(m_fd, SOMAXCONN) == -1))
+  {
+    const std::string err = std::strerror(errno);
+    if (m_fd != -1)
+      ::close(m_fd);
+    throw std::runtime_error(fmt::format("can't listen on: \"{}\" ({})", m_path.string(), err));
+  }
+}
+
+inline task_server::~task_server()
+{
+  ::close(m_fd);
+  std::error_code ec;
+  std::filesystem::remove(m_path, ec);
+}
+
+inline void task_server::run()
+{
+  // a client which disconnects must not stop the server
+  ::signal(SIGPIPE, SIG_IGN);
+  while (!m_stopped)
+  {
+    const int fd = ::accept4(m_fd, nullptr, nullptr, SOCK_CLOEXEC);
+    if (fd == -1)
+    {
+      if (m_stopped)
+        break;
+      if ((errno == EINTR) || (errno == ECONNABORTED) || (errno == EMFILE) || (errno == ENFILE))
+        continue;
+      throw std::runtime_error(fmt::format("can't accept clients: {}", std::strerror(errno)));
+    }
+    {
+      std::lock_guard<std::mutex> lck(m_mtx);
+      ++m_clients;
+    }
+    std::thread([this, fd]() {
+      serve(fd);
+      {
+        std::lock_guard<std::mutex> lck(m_mtx);
+        --m_clients;
+      }
+      m_cv.notify_all();
+      }).detach();
+  }
+
+  std::unique_lock<std::mutex> lck(m_mtx);
+  m_cv.wait(lck, [&]() { return !m_clients; });
+}
+
+inline void task_server::stop()
+{
+  // the blocked accept fails once the socket is shut down
+  m_stopped = true;
+  ::shutdown(m_fd, SHUT_RDWR);
+}
+
+inline void task_server::serve(int fd)
+{
+  int ret = -1;
+  std::FILE* out = nullptr;
+  try
+  {
+    // read the request: a json line
+    std::string line;
+    char c;
+    while (server_detail::recv_all(fd, &c, 1) && (c != '\n'))
+      line += c;
+    const nlohmann::json obj = nlohmann::json::parse(line);
+    run_request request;
+    request.tasks_file = obj.at("tasks").get<std::string>();
+    request.variables = obj.at("variables").get<std::vector<std::string>>();
+    request.jobs = obj.at("jobs").get<int>();
+    request.trace_file = obj.at("trace").get<std::string>();
+    request.log_dir = obj.at("log-dir").get<std::string>();
+    request.plan = obj.value("plan", false);
+    request.resume = obj.value("resume", false);
+
+    // the execution uses the working directory of the client: the thread gets its own file-system context
+    if ((::unshare(CLONE_FS) == -1) || (::chdir(obj.at("working-dir").get<std::string>().c_str()) == -1))
+      throw std::runtime_error(fmt::format("can't change the working directory: {}", std::strerror(errno)));
+
+    out = server_detail::open_output(&fd);
+    if (!out)
+      throw std::runtime_error("can't create the output of the execution");
+    ret = m_handler(request, out);
+    std::fflush(out);
+  }
+  catch (const std::exception& ex)
+  {
+    const std::string err = fmt::format("error: {}\n", ex.what());
+    server_detail::send_frame(fd, 'o', err.data(), err.size());
+  }
+  if (out)
+    std::fclose(out);
+
+  // send the exit code
+  const std::int32_t code = ret;
+  char data[4];
+  for (int i = 0; i < 4; ++i)
+    data[i] = static_cast<char>((static_cast<std::uint32_t>(code) >> (8 * i)) & 0xff);
+  server_detail::send_frame(fd, 'x', data, sizeof(data));
+  ::close(fd);
+}
+
+inline int submit(const std::filesystem::path& socket_path, const run_request& request)
+{
+  // the paths are relative to the working directory of the client
+  auto to_absolute = [](const std::filesystem::path& p) -> std::string {
+    return p.empty() ? std::string() : std::filesystem::absolute(p).string();
+  };
+  const nlohmann::json obj = {
+    { "tasks", to_absolute(request.tasks_file) },
+    { "variables", request.variables },
+    { "jobs", request.jobs },
+    { "trace", to_absolute(request.trace_file) },
+    { "log-dir", to_absolute(request.log_dir) },
+    { "plan", request.plan },
+    { "resume", request.resume },
+    { "working-dir", std::filesystem::current_path().string() } };
+
+  const sockaddr_un addr = server_detail::get_address(socket_path);
+  const int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if ((fd == -1) || (::connect(fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) == -1))
+  {
+    const std::string err = std::strerror(errno);
+    if (fd != -1)
+      ::close(fd);
+    throw std::runtime_error(fmt::format("can't connect to the server: \"{}\" ({})", socket_path.string(), err));
+  }
+  const std::string line = obj.dump() + "\n";
+  if (!server_detail::send_all(fd, line.data(), line.size()))
+  {
+    ::close(fd);
+    throw std::runtime_error("can't send the request to the server");
+  }
+
+  // display the output until the exit code is received
+  std::string data;
+  while (true)
+  {
+    char header[5];
+    if (!server_detail::recv_all(fd, header, sizeof(header)))
+      break;
+    std::size_t size = 0;
+    for (int i = 0; i < 4; ++i)
+      size |= static_cast<std::size_t>(static_cast<unsigned char>(header[1 + i])) << (8 * i);
+    data.resize(size);
+    if (!server_detail::recv_all(fd, data.data(), size))
+      break;
+    if (header[0] == 'o')
+    {
+      std::fwrite(data.data(), 1, data.size(), stdout);
+      std::fflush(stdout);
+    }
+    else if ((header[0] == 'x') && (size == 4))
+    {
+      std::uint32_t code = 0;
+      for (int i = 0; i < 4; ++i)
+        code |= static_cast<std::uint32_t>(static_cast<unsigned char>(data[i])) << (8 * i);
+      ::close(fd);
+      return static_cast<std::int32_t>(code);
+    }
+  }
+  ::close(fd);
+  throw std::runtime_error("connection to the server lost");
+}
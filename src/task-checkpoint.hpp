@@ -0,0 +1,178 @@
+#pragma once
+#include <string>
+#include <map>
+#include <mutex>
+#include <cstdio>
+#include <optional>
+#include <fstream>
+#include <filesystem>
+#include <system_error>
+#include <fmt/core.h>
+#include <nlohmann/json.hpp>
+#include "task-state.hpp"
+#ifdef _WIN32
+#include <io.h>
+#include <share.h>
+#else
+#include <cerrno>
+#include <unistd.h>
+#include <sys/file.h>
+#endif
+
+/*============================================
+| Declaration
+==============================================*/
+// journal of the tasks completed by an execution: a line is appended and synced on the disk after each task
+//  a failed or interrupted execution can be resumed: its completed tasks are skipped and their variables restored
+//  an incomplete line (crash while it was written) is dropped when the journal is loaded
+//  the journal is locked during the execution: a second execution using the same journal is rejected
+class task_checkpoint
+{
+public:
+  // open the journal: its records are loaded to resume the execution - cleared otherwise
+  //  throw if the journal is used by another execution
+  task_checkpoint(const std::filesystem::path& path, const bool resume);
+  ~task_checkpoint();
+
+  task_checkpoint(const task_checkpoint&) = delete;
+  task_checkpoint& operator=(const task_checkpoint&) = delete;
+
+  // number of completed tasks loaded from the journal
+  std::size_t size() const;
+
+  // get the variables produced by a completed task - none if it was not completed with the same command
+  std::optional<std::map<std::string, std::string>> check(const std::string& key, const std::string& command) const;
+
+  // append a completed task - the errors are ignored (read-only directory...)
+  void record(const std::string& key, const std::string& command, const std::map<std::string, std::string>& variables);
+
+  // all the tasks are completed: the journal is removed
+  void remove();
+
+private:
+  struct entry
+  {
+    std::string command;                        // hash of the expanded command
+    std::map<std::string, std::string> variables;
+  };
+
+private:
+  const std::filesystem::path m_path;
+  mutable std::mutex m_mtx;
+  std::map<std::string, entry> m_tasks;
+  std::FILE* m_file = nullptr;
+};
+
+/*============================================
+| Definition
+==============================================*/
+inline task_checkpoint::task_checkpoint(const std::filesystem::path& path, const bool resume) :
+  m_path(path)
+{
+  // the journal is opened and locked before it's read or cleared - the other errors are ignored (read-only directory...)
+  std::error_code ec;
+#ifdef _WIN32
+  m_file = ::_wfsopen(m_path.c_str(), L"ab", _SH_DENYWR);
+  const bool locked = !m_file && (errno == EACCES) && std::filesystem::exists(m_path, ec);
+#else
+  m_file = std::fopen(m_path.c_str(), "ab");
+  const bool locked = m_file && (::flock(::fileno(m_file), LOCK_EX | LOCK_NB) == -1) && (errno == EWOULDBLOCK);
+#endif
+  if (locked)
+  {
+    if (m_file)
+      std::fclose(m_file);
+    m_file = nullptr;
+    throw std::runtime_error(fmt::format("the checkpoint journal is used by another execution: \"{}\"", m_path.filename().u8string()));
+  }
+
+  // the records are read up to the first invalid line: the next ones are appended after the valid ones
+  std::uintmax_t valid = 0;
+  if (resume)
+  {
+    std::ifstream file(m_path, std::ios::binary);
+    std::string line;
+    while (std::getline(file, line) && !file.eof())
+    {
+      const nlohmann::json record = nlohmann::json::parse(line, nullptr, false);
+      if (record.is_discarded() || !record.is_object() ||
+          !record.contains("key") || !record["key"].is_string() ||
+          !record.contains("command") || !record["command"].is_string() ||
+          !record.contains("variables") || !record["variables"].is_object())
+        break;
+      entry& e = m_tasks[record["key"].get<std::string>()];
+      e.command = record["command"].get<std::string>();
+      e.variables.clear();
+      for (const auto& [key, value] : record["variables"].items())
+        if (value.is_string())
+          e.variables[key] = value.get<std::string>();
+      valid += line.size() + 1;
+    }
+  }
+  if (m_file && (std::filesystem::file_size(m_path, ec) != valid))
+  {
+#ifdef _WIN32
+    ::_chsize_s(::_fileno(m_file), static_cast<long long>(valid));
+#else
+    static_cast<void>(::ftruncate(::fileno(m_file), static_cast<off_t>(valid)));
+#endif
+  }
+}
+
+inline task_checkpoint::~task_checkpoint()
+{
+  if (m_file)
+    std::fclose(m_file);
+}
+
+inline std::size_t task_checkpoint::size() const
+{
+  std::lock_guard<std::mutex> lck(m_mtx);
+  return m_tasks.size();
+}
+
+inline std::optional<std::map<std::string, std::string>> task_checkpoint::check(const std::string& key, const std::string& command) const
+{
+  std::lock_guard<std::mutex> lck(m_mtx);
+  const auto& it = m_tasks.find(key);
+  if ((it == m_tasks.end()) || (it->second.command != fmt::format("{:016x}", hash64::of(command))))
+    return std::nullopt;
+  return it->second.variables;
+}
+
+inline void task_checkpoint::record(const std::string& key, const std::string& command, const std::map<std::string, std::string>& variables)
+{
+  const nlohmann::json record = {
+    {"key", key},
+    {"command", fmt::format("{:016x}", hash64::of(command))},
+    {"variables", variables} };
+  const std::string line = record.dump() + "\n";
+
+  // the line is on the disk before the next tasks are started
+  std::lock_guard<std::mutex> lck(m_mtx);
+  if (!m_file || (std::fwrite(line.data(), 1, line.size(), m_file) != line.size()) || (std::fflush(m_file) != 0))
+    return;
+#ifdef _WIN32
+  ::_commit(::_fileno(m_file));
+#else
+  ::fsync(::fileno(m_file));
+#endif
+}
+
+inline void task_checkpoint::remove()
+{
+  // removed while it's locked (an open file can't be removed on Windows)
+  std::lock_guard<std::mutex> lck(m_mtx);
+  std::error_code ec;
+#ifdef _WIN32
+  if (m_file)
+    std::fclose(m_file);
+  std::filesystem::remove(m_path, ec);
+#else
+  std::filesystem::remove(m_path, ec);
+  if (m_file)
+    std::fclose(m_file);
+#endif
+  m_file = nullptr;
+  m_tasks.clear();
+}
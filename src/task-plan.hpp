@@ -0,0 +1,640 @@
+#pragma once
+#include <string>
+#include <map>
+#include <vector>
+#include <optional>
+#include <chrono>
+#include <thread>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <filesystem>
+#include <functional>
+#include <stdexcept>
+#include <system_error>
+#include <fmt/core.h>
+#include "tasks.hpp"
+#include "task-state.hpp"
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+/*============================================
+| Declaration
+==============================================*/
+// tasks file compiled for the execution: typed flags, compiled templates and resolved graph
+//  cached next to the tasks file ("<tasks-file>.plan") and reused while the tasks file is unchanged
+struct task_plan
+{
+  var_template description;                                   // description of the tasks file
+  std::vector<std::pair<std::string, var_template>> variables; // json-file variables - by order of declaration
+  std::vector<task_node> nodes;                               // tasks execution graph
+};
+
+// append the binary representation of values to a buffer - integers are encoded on 7 bits per byte (LEB128)
+class binary_writer
+{
+public:
+  void write(const std::string& str);
+  void write(const std::uint8_t value);
+  void write(std::uint64_t value);
+
+  const std::string& data() const { return m_data; }
+
+private:
+  std::string m_data;
+};
+
+// read the values of a binary buffer - throw if the buffer is truncated
+class binary_reader
+{
+public:
+  binary_reader(const char* data, const std::size_t size) : m_data(data), m_size(size) {}
+
+  std::string read_string();
+  std::uint8_t read_u8();
+  std::uint64_t read_u64();
+
+  // read a number of elements: can't exceed the remaining bytes
+  std::size_t read_size();
+
+  bool empty() const { return m_pos == m_size; }
+
+private:
+  const char* get(const std::size_t size);
+
+private:
+  const char* m_data;
+  const std::size_t m_size;
+  std::size_t m_pos = 0;
+};
+
+// read-only memory mapping of a whole file
+class mapped_file
+{
+public:
+  // an empty or missing file is not mapped
+  explicit mapped_file(const std::filesystem::path& path);
+  ~mapped_file();
+
+  mapped_file(const mapped_file&) = delete;
+  mapped_file& operator=(const mapped_file&) = delete;
+
+  const char* data() const { return m_data; }
+  std::size_t size() const { return m_size; }
+
+private:
+  const char* m_data = nullptr;
+  std::size_t m_size = 0;
+#ifdef _WIN32
+  HANDLE m_file = INVALID_HANDLE_VALUE;
+  HANDLE m_mapping = nullptr;
+#endif
+};
+
+// compile a parsed tasks file
+inline task_plan compile_plan(const json& db);
+
+// load the compiled tasks file: from its cache if the tasks file is unchanged, otherwise it is compiled and cached
+inline task_plan load_plan(const std::filesystem::path& path);
+
+// expand the variables of a compiled tasks file
+inline var_map get_json_variables(const task_plan& plan, const var_map& variables);
+
+// identifier and version of the binary format of the compiled tasks files
+constexpr char g_plan_magic[] = "ALPLAN";
+constexpr std::uint64_t g_plan_version = 8;
+
+/*============================================
+| Definition
+==============================================*/
+inline void binary_writer::write(const std::string& str)
+{
+  write(static_cast<std::uint64_t>(str.size()));
+  m_data += str;
+}
+
+inline void binary_writer::write(const std::uint8_t value)
+{
+  m_data += static_cast<char>(value);
+}
+
+inline void binary_writer::write(std::uint64_t value)
+{
+  while (value >= 0x80)
+  {
+    m_data += static_cast<char>((value & 0x7f) | 0x80);
+    value >>= 7;
+  }
+  m_data += static_cast<char>(value);
+}
+
+inline const char* binary_reader::get(const std::size_t size)
+{
+  if (size > m_size - m_pos)
+    throw std::runtime_error("invalid compiled tasks file (truncated)");
+  const char* data = m_data + m_pos;
+  m_pos += size;
+  return data;
+}
+
+inline std::string binary_reader::read_string()
+{
+  const std::size_t size = read_size();
+  return std::string(get(size), size);
+}
+
+inline std::uint8_t binary_reader::read_u8()
+{
+  return static_cast<std::uint8_t>(*get(1));
+}
+
+inline std::uint64_t binary_reader::read_u64()
+{
+  std::uint64_t value = 0;
+  for (int shift = 0; shift < 64; shift += 7)
+  {
+    const std::uint8_t byte = read_u8();
+    value |= static_cast<std::uint64_t>(byte & 0x7f) << shift;
+    if (!(byte & 0x80))
+      return value;
+  }
+  throw std::runtime_error("invalid compiled tasks file (integer overflow)");
+}
+
+inline std::size_t binary_reader::read_size()
+{
+  const std::uint64_t size = read_u64();
+  if (size > m_size - m_pos)
+    throw std::runtime_error("invalid compiled tasks file (truncated)");
+  return static_cast<std::size_t>(size);
+}
+
+inline mapped_file::mapped_file(const std::filesystem::path& path)
+{
+#ifdef _WIN32
+  m_file = ::CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+  LARGE_INTEGER size;
+  if ((m_file == INVALID_HANDLE_VALUE) || !::GetFileSizeEx(m_file, &size) || (size.QuadPart == 0))
+    return;
+  m_mapping = ::CreateFileMappingW(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  if (!m_mapping)
+    return;
+  m_data = static_cast<const char*>(::MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+  if (m_data)
+    m_size = static_cast<std::size_t>(size.QuadPart);
+#else
+  const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd == -1)
+    return;
+  struct stat st;
+  if ((::fstat(fd, &st) == 0) && (st.st_size > 0))
+  {
+    void* data = ::mmap(nullptr, static_cast<std::size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data != MAP_FAILED)
+    {
+      m_data = static_cast<const char*>(data);
+      m_size = static_cast<std::size_t>(st.st_size);
+    }
+  }
+  ::close(fd);
+#endif
+}
+
+inline mapped_file::~mapped_file()
+{
+#ifdef _WIN32
+  if (m_data)
+    ::UnmapViewOfFile(m_data);
+  if (m_mapping)
+    ::CloseHandle(m_mapping);
+  if (m_file != INVALID_HANDLE_VALUE)
+    ::CloseHandle(m_file);
+#else
+  if (m_data)
+    ::munmap(const_cast<char*>(m_data), m_size);
+#endif
+}
+
+namespace plan_detail
+{
+  // write/read the optional flags: presence byte then value
+  inline void write(binary_writer& writer, const std::optional<bool>& value)
+  {
+    writer.write(static_cast<std::uint8_t>(value ? (*value ? 2 : 1) : 0));
+  }
+
+  inline void write(binary_writer& writer, const std::optional<float>& value)
+  {
+    writer.write(static_cast<std::uint8_t>(value.has_value()));
+    if (!value)
+      return;
+    std::uint32_t bits;
+    std::memcpy(&bits, &*value, sizeof(bits));
+    writer.write(static_cast<std::uint64_t>(bits));
+  }
+
+  inline void write(binary_writer& writer, const std::optional<std::string>& value)
+  {
+    writer.write(static_cast<std::uint8_t>(value.has_value()));
+    if (value)
+      writer.write(*value);
+  }
+
+  inline void read(binary_reader& reader, std::optional<bool>& value)
+  {
+    const std::uint8_t v = reader.read_u8();
+    value = v ? std::optional<bool>(v == 2) : std::nullopt;
+  }
+
+  inline void read(binary_reader& reader, std::optional<float>& value)
+  {
+    value.reset();
+    if (!reader.read_u8())
+      return;
+    const std::uint32_t bits = static_cast<std::uint32_t>(reader.read_u64());
+    float f;
+    std::memcpy(&f, &bits, sizeof(f));
+    value = f;
+  }
+
+  inline void read(binary_reader& reader, std::optional<std::string>& value)
+  {
+    value.reset();
+    if (reader.read_u8())
+      value = reader.read_string();
+  }
+
+  // write/read the lists of indexes, templates and resources
+  inline void write(binary_writer& writer, const std::vector<std::size_t>& values)
+  {
+    writer.write(static_cast<std::uint64_t>(values.size()));
+    for (const auto& v : values)
+      writer.write(static_cast<std::uint64_t>(v));
+  }
+
+  // write/read an optional index of task: index + 1 - 0 if none
+  inline void write(binary_writer& writer, const std::optional<std::size_t>& value)
+  {
+    writer.write(static_cast<std::uint64_t>(value ? *value + 1 : 0));
+  }
+
+  inline void read(binary_reader& reader, std::optional<std::size_t>& value, const std::size_t count)
+  {
+    const std::uint64_t v = reader.read_u64();
+    if (v > count)
+      throw std::runtime_error("invalid compiled tasks file (unknown task)");
+    value = v ? std::optional<std::size_t>(static_cast<std::size_t>(v - 1)) : std::nullopt;
+  }
+
+  inline void read(binary_reader& reader, std::vector<std::size_t>& values, const std::size_t count)
+  {
+    values.resize(reader.read_size());
+    for (auto& v : values)
+    {
+      v = static_cast<std::size_t>(reader.read_u64());
+      if (v >= count)
+        throw std::runtime_error("invalid compiled tasks file (unknown task)");
+    }
+  }
+
+  inline void write(binary_writer& writer, const std::vector<var_template>& values)
+  {
+    writer.write(static_cast<std::uint64_t>(values.size()));
+    for (const auto& v : values)
+      v.save(writer);
+  }
+
+  inline void read(binary_reader& reader, std::vector<var_template>& values)
+  {
+    values.resize(reader.read_size());
+    for (auto& v : values)
+      v = var_template::load(reader);
+  }
+
+  inline void write(binary_writer& writer, const std::vector<resource>& values)
+  {
+    writer.write(static_cast<std::uint64_t>(values.size()));
+    for (const auto& r : values)
+    {
+      writer.write(r.name);
+      writer.write(static_cast<std::uint64_t>(r.capacity));
+    }
+  }
+
+  inline void read(binary_reader& reader, std::vector<resource>& values)
+  {
+    values.resize(reader.read_size());
+    for (auto& r : values)
+    {
+      r.name = reader.read_string();
+      r.capacity = static_cast<std::size_t>(reader.read_u64());
+    }
+  }
+
+  // write/read the cores, priority and limits of a task: the cores of the limits are given by the scheduler
+  inline void write(binary_writer& writer, const cpu_request& cpus, const process_limits& limits)
+  {
+    writer.write(static_cast<std::uint64_t>(cpus.count));
+    writer.write(static_cast<std::uint64_t>(cpus.set.size()));
+    for (const int c : cpus.set)
+      writer.write(static_cast<std::uint64_t>(c));
+    writer.write(static_cast<std::uint64_t>(limits.nice ? *limits.nice + 21 : 0));
+    writer.write(static_cast<std::uint64_t>(limits.max_memory));
+    writer.write(static_cast<std::uint64_t>(limits.max_open_files));
+    writer.write(static_cast<std::uint8_t>(limits.io_class));
+    writer.write(static_cast<std::uint8_t>(limits.io_level));
+  }
+
+  inline void read(binary_reader& reader, cpu_request& cpus, process_limits& limits)
+  {
+    cpus.count = static_cast<std::size_t>(reader.read_u64());
+    cpus.set.resize(reader.read_size());
+    for (auto& c : cpus.set)
+    {
+      const std::uint64_t v = reader.read_u64();
+      if (v >= g_max_cpus)
+        throw std::runtime_error("invalid compiled tasks file (invalid core)");
+      c = static_cast<int>(v);
+    }
+    const std::uint64_t nice = reader.read_u64();
+    if (nice > 40)
+      throw std::runtime_error("invalid compiled tasks file (invalid nice)");
+    limits.nice = nice ? std::optional<int>(static_cast<int>(nice) - 21) : std::nullopt;
+    limits.max_memory = static_cast<std::size_t>(reader.read_u64());
+    limits.max_open_files = static_cast<std::size_t>(reader.read_u64());
+    limits.io_class = reader.read_u8();
+    limits.io_level = reader.read_u8();
+    if ((limits.io_class > 3) || (limits.io_level > 7))
+      throw std::runtime_error("invalid compiled tasks file (invalid io-priority)");
+  }
+
+  // write/read the items of a "foreach" task: presence byte then value
+  inline void write(binary_writer& writer, const std::optional<task_foreach>& foreach)
+  {
+    writer.write(static_cast<std::uint8_t>(foreach.has_value()));
+    if (!foreach)
+      return;
+    write(writer, foreach->items);
+    write(writer, foreach->globs);
+    writer.write(foreach->separator);
+    writer.write(foreach->var);
+    writer.write(static_cast<std::uint64_t>(foreach->batch));
+  }
+
+  inline void read(binary_reader& reader, std::optional<task_foreach>& foreach)
+  {
+    foreach.reset();
+    if (!reader.read_u8())
+      return;
+    foreach.emplace();
+    read(reader, foreach->items);
+    read(reader, foreach->globs);
+    foreach->separator = reader.read_string();
+    foreach->var = reader.read_string();
+    foreach->batch = static_cast<std::size_t>(reader.read_u64());
+  }
+
+  // write/read a compiled tasks file
+  inline void write(binary_writer& writer, const task_plan& plan)
+  {
+    plan.description.save(writer);
+    writer.write(static_cast<std::uint64_t>(plan.variables.size()));
+    for (const auto& [key, value] : plan.variables)
+    {
+      writer.write(key);
+      value.save(writer);
+    }
+    writer.write(static_cast<std::uint64_t>(plan.nodes.size()));
+    for (const auto& node : plan.nodes)
+    {
+      writer.write(node.id);
+      writer.write(static_cast<std::uint64_t>(node.group_idx));
+      write(writer, node.flags.display);
+      write(writer, node.flags.debug);
+      write(writer, node.flags.ignore_error);
+      write(writer, node.flags.ask_execute);
+      write(writer, node.flags.ask_continue);
+      write(writer, node.flags.force);
+      write(writer, node.flags.timeout);
+      write(writer, node.flags.idle_timeout);
+      write(writer, node.flags.kill_grace);
+      write(writer, node.flags.kill_signal);
+      write(writer, node.flags.logs_tail);
+      write(writer, node.flags.retries);
+      write(writer, node.flags.retry_delay);
+      write(writer, node.deps);
+      write(writer, node.waits);
+      write(writer, node.next);
+      writer.write(static_cast<std::uint64_t>(node.pending));
+      node.description.save(writer);
+      node.cmd.save(writer);
+      node.args.save(writer);
+      writer.write(static_cast<std::uint64_t>(node.variables.size()));
+      for (const auto& [key, value] : node.variables)
+      {
+        writer.write(key);
+        value.save(writer);
+      }
+      const std::vector<pattern_spec> specs = node.parse_variables ? node.parse_variables->specs() : std::vector<pattern_spec>();
+      writer.write(static_cast<std::uint64_t>(specs.size()));
+      for (const auto& spec : specs)
+      {
+        writer.write(spec.key);
+        writer.write(spec.regex);
+        writer.write(static_cast<std::uint64_t>(spec.mode));
+        writer.write(spec.separator);
+      }
+      writer.write(node.output_variable);
+      write(writer, node.foreach);
+      write(writer, node.inputs);
+      write(writer, node.outputs);
+      writer.write(node.key);
+      write(writer, node.resources);
+      write(writer, node.group_resources);
+      write(writer, node.stdin_task);
+      write(writer, node.stdout_task);
+      writer.write(static_cast<std::uint8_t>(node.pipe_stderr));
+      writer.write(static_cast<std::uint8_t>(node.pipe_logs));
+      write(writer, node.cpus, node.limits);
+    }
+  }
+
+  inline task_plan read(binary_reader& reader)
+  {
+    task_plan plan;
+    plan.description = var_template::load(reader);
+    plan.variables.resize(reader.read_size());
+    for (auto& [key, value] : plan.variables)
+    {
+      key = reader.read_string();
+      value = var_template::load(reader);
+    }
+    plan.nodes.resize(reader.read_size());
+    const std::size_t count = plan.nodes.size();
+    for (auto& node : plan.nodes)
+    {
+      node.id = reader.read_string();
+      node.group_idx = static_cast<std::size_t>(reader.read_u64());
+      read(reader, node.flags.display);
+      read(reader, node.flags.debug);
+      read(reader, node.flags.ignore_error);
+      read(reader, node.flags.ask_execute);
+      read(reader, node.flags.ask_continue);
+      read(reader, node.flags.force);
+      read(reader, node.flags.timeout);
+      read(reader, node.flags.idle_timeout);
+      read(reader, node.flags.kill_grace);
+      read(reader, node.flags.kill_signal);
+      read(reader, node.flags.logs_tail);
+      read(reader, node.flags.retries);
+      read(reader, node.flags.retry_delay);
+      read(reader, node.deps, count);
+      read(reader, node.waits, count);
+      read(reader, node.next, count);
+      node.pending = static_cast<std::size_t>(reader.read_u64());
+      node.description = var_template::load(reader);
+      node.cmd = var_template::load(reader);
+      node.args = var_template::load(reader);
+      node.variables.resize(reader.read_size());
+      for (auto& [key, value] : node.variables)
+      {
+        key = reader.read_string();
+        value = var_template::load(reader);
+      }
+      std::vector<pattern_spec> specs(reader.read_size());
+      for (auto& spec : specs)
+      {
+        spec.key = reader.read_string();
+        spec.regex = reader.read_string();
+        spec.mode = static_cast<pattern_spec::match_mode>(reader.read_u64());
+        spec.separator = reader.read_string();
+      }
+      if (!specs.empty())
+        node.parse_variables = std::make_shared<const pattern_set>(std::move(specs));
+      node.output_variable = reader.read_string();
+      read(reader, node.foreach);
+      read(reader, node.inputs);
+      read(reader, node.outputs);
+      node.key = reader.read_string();
+      read(reader, node.resources);
+      read(reader, node.group_resources);
+      read(reader, node.stdin_task, count);
+      read(reader, node.stdout_task, count);
+      node.pipe_stderr = reader.read_u8() != 0;
+      node.pipe_logs = reader.read_u8() != 0;
+      read(reader, node.cpus, node.limits);
+    }
+
+    // the groups are ordered: the execution allocates one state per group
+    for (std::size_t i = 1; i < count; ++i)
+      if (plan.nodes[i].group_idx < plan.nodes[i - 1].group_idx)
+        throw std::runtime_error("invalid compiled tasks file (unordered groups)");
+    if (!reader.empty())
+      throw std::runtime_error("invalid compiled tasks file (unexpected data)");
+    return plan;
+  }
+
+  // write the header of the compiled tasks file: magic, version, hash and size of the tasks file
+  inline void write_header(binary_writer& writer, const std::uint64_t hash, const std::size_t size)
+  {
+    writer.write(std::string(g_plan_magic));
+    writer.write(g_plan_version);
+    writer.write(hash);
+    writer.write(static_cast<std::uint64_t>(size));
+  }
+
+  // check the header of the compiled tasks file
+  inline bool read_header(binary_reader& reader, const std::uint64_t hash, const std::size_t size)
+  {
+    return (reader.read_string() == g_plan_magic) &&
+           (reader.read_u64() == g_plan_version) &&
+           (reader.read_u64() == hash) &&
+           (reader.read_u64() == size);
+  }
+}
+
+inline task_plan compile_plan(const json& db)
+{
+  task_plan plan;
+  plan.description = var_template(db["description"].get<std::string>());
+  for (const auto& v : db["variables"])
+    for (const auto& [key, value] : v.items())
+      plan.variables.emplace_back(key, var_template(value.get<std::string>()));
+  plan.nodes = build_tasks_graph(db["tasks-groups"]);
+  return plan;
+}
+
+inline task_plan load_plan(const std::filesystem::path& path)
+{
+  // read the tasks file: its hash identifies the compiled file
+  std::string content;
+  {
+    std::ifstream file(path, std::ios::binary);
+    if (!file.good())
+      throw std::runtime_error(fmt::format("can't open file: \"{}\"", path.filename().u8string()));
+    content.resize(static_cast<std::size_t>(std::filesystem::file_size(path)));
+    file.read(content.data(), static_cast<std::streamsize>(content.size()));
+    content.resize(static_cast<std::size_t>(file.gcount()));
+  }
+  const std::uint64_t hash = hash64::of(content);
+  std::filesystem::path plan_path = path;
+  plan_path += ".plan";
+
+  // use the compiled file if it matches the tasks file - an invalid one is replaced
+  {
+    const mapped_file cache(plan_path);
+    if (cache.data())
+    {
+      try
+      {
+        binary_reader reader(cache.data(), cache.size());
+        if (plan_detail::read_header(reader, hash, content.size()))
+          return plan_detail::read(reader);
+      }
+      catch (const std::exception&)
+      {
+      }
+    }
+  }
+
+  // compile the tasks file
+  json db = json::parse(content);
+  check_tasks_file(db, path);
+  task_plan plan = compile_plan(db);
+
+  // write the compiled file: the cache is optional, the errors are ignored (read-only directory...)
+  binary_writer writer;
+  plan_detail::write_header(writer, hash, content.size());
+  plan_detail::write(writer, plan);
+  std::filesystem::path tmp_path = plan_path;
+  tmp_path += fmt::format(".{}.tmp", std::hash<std::thread::id>()(std::this_thread::get_id()) ^
+                                     static_cast<std::size_t>(std::chrono::steady_clock::now().time_since_epoch().count()));
+  {
+    std::ofstream file(tmp_path, std::ios::binary);
+    file.write(writer.data().data(), static_cast<std::streamsize>(writer.data().size()));
+    file.close();
+    std::error_code ec;
+    if (file.good())
+      std::filesystem::rename(tmp_path, plan_path, ec);
+    if (!file.good() || ec)
+      std::filesystem::remove(tmp_path, ec);
+  }
+  return plan;
+}
+
+inline var_map get_json_variables(const task_plan& plan, const var_map& variables)
+{
+  var_map json_vars;
+  for (const auto& [key, value] : plan.variables)
+    json_vars.set(key, value.render(var_env().push(variables).push(json_vars)));
+  return json_vars;
+}
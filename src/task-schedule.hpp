@@ -0,0 +1,357 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <mutex>
+#include <chrono>
+#include <ctime>
+#include <fstream>
+#include <cstdint>
+#include <optional>
+#include <algorithm>
+#include <filesystem>
+#include <system_error>
+#include <fmt/core.h>
+#include <nlohmann/json.hpp>
+#include "tasks.hpp"
+#include "task-state.hpp"
+
+/*============================================
+| Declaration
+==============================================*/
+// number of durations kept for each task in the history
+constexpr std::size_t g_history_size = 8;
+
+// number of days before an unused entry of the history is removed
+constexpr std::int64_t g_history_retention_days = 30;
+
+// durations of the last executions of the tasks - persistent
+//  a task is identified by its description and its expanded command (hash)
+//  and by its key in the tasks file: used when its command can't be expanded before its execution
+class task_history
+{
+public:
+  using duration = std::chrono::milliseconds;
+
+  explicit task_history(const std::filesystem::path& path);
+
+  // identity of an execution: hash of the description and the expanded command
+  static std::string identity(const std::string& description, const std::string& cmd, const std::string& args);
+
+  // predicted duration of a task: median of its last durations - none if never executed
+  //  the durations of the same command first, then the durations of the task whatever its command
+  std::optional<duration> estimate(const std::string& key, const std::string& identity) const;
+
+  // add the duration of a successful execution
+  void record(const std::string& key, const std::string& identity, const duration& d);
+
+  // write the history if it has been modified - the errors are ignored (read-only directory...)
+  void save();
+
+private:
+  struct entry
+  {
+    std::int64_t used = 0;                        // last use (seconds since epoch)
+    std::vector<std::int64_t> durations;          // in milliseconds - from the oldest to the newest
+  };
+  static std::optional<duration> median(const std::map<std::string, entry>& entries, const std::string& key);
+  static void add(std::map<std::string, entry>& entries, const std::string& key, const duration& d, const std::int64_t now);
+
+private:
+  const std::filesystem::path m_path;
+  mutable std::mutex m_mtx;
+  std::map<std::string, entry> m_commands;
+  std::map<std::string, entry> m_tasks;
+  bool m_modified = false;
+};
+
+// scheduling of the tasks graph: longest remaining path first
+struct task_schedule
+{
+  std::vector<task_history::duration> estimates; // predicted duration of each task
+  std::vector<bool> known;                       // the task has a history
+  std::vector<std::int64_t> ranks;               // longest path from the start of the task to the end of the graph (ms)
+};
+
+// predict the durations of the tasks and their critical path
+//  the commands are expanded with the global variables: a task using the variables of its dependencies
+//  is predicted by the durations of its previous executions whatever its command
+//  the tasks without history are predicted by the mean duration of the others (0 if none)
+inline task_schedule schedule_tasks(const std::vector<task_node>& nodes, const var_env& vars, const task_history& history);
+
+// priority of a ready task (first task of a pipeline): the longest critical path of its pipeline
+inline std::int64_t get_priority(const std::vector<task_node>& nodes, const task_schedule& schedule, std::size_t idx);
+
+// predicted execution of a task by a dry-run
+struct planned_task
+{
+  std::size_t idx = 0;
+  std::size_t worker = 0;
+  task_history::duration start{ 0 };
+  task_history::duration end{ 0 };
+  bool critical = false;                          // on the critical path of the graph
+};
+
+// simulate the execution of the tasks graph with a number of workers: by order of start
+//  the "protected" resources and the cores are not simulated
+inline std::vector<planned_task> plan_tasks(const std::vector<task_node>& nodes, const task_schedule& schedule, const std::size_t jobs);
+
+/*============================================
+| Definition
+==============================================*/
+inline task_history::task_history(const std::filesystem::path& path) :
+  m_path(path)
+{
+  std::ifstream file(m_path);
+  if (!file.good())
+    return;
+  try
+  {
+    // an invalid history only means that the tasks are not predicted
+    const nlohmann::json db = nlohmann::json::parse(file);
+    auto read = [](const nlohmann::json& obj, std::map<std::string, entry>& entries) -> void {
+      for (const auto& [key, value] : obj.items())
+        entries[key] = entry{ value.at("used").get<std::int64_t>(), value.at("durations").get<std::vector<std::int64_t>>() };
+    };
+    read(db.at("commands"), m_commands);
+    read(db.at("tasks"), m_tasks);
+  }
+  catch (const std::exception&)
+  {
+    m_commands.clear();
+    m_tasks.clear();
+  }
+}
+
+inline std::string task_history::identity(const std::string& description, const std::string& cmd, const std::string& args)
+{
+  return fmt::format("{:016x}", hash64::of(fmt::format("{}\n{}\n{}", description, cmd, args)));
+}
+
+inline std::optional<task_history::duration> task_history::median(const std::map<std::string, entry>& entries, const std::string& key)
+{
+  const auto& it = entries.find(key);
+  if ((it == entries.end()) || it->second.durations.empty())
+    return std::nullopt;
+  std::vector<std::int64_t> d = it->second.durations;
+  std::nth_element(d.begin(), d.begin() + static_cast<std::ptrdiff_t>(d.size() / 2), d.end());
+  return duration(d[d.size() / 2]);
+}
+
+inline std::optional<task_history::duration> task_history::estimate(const std::string& key, const std::string& identity) const
+{
+  std::lock_guard<std::mutex> lck(m_mtx);
+  if (!identity.empty())
+    if (const auto& d = median(m_commands, identity))
+      return d;
+  return median(m_tasks, key);
+}
+
+inline void task_history::add(std::map<std::string, entry>& entries, const std::string& key, const duration& d, const std::int64_t now)
+{
+  entry& e = entries[key];
+  e.used = now;
+  e.durations.push_back(static_cast<std::int64_t>(d.count()));
+  if (e.durations.size() > g_history_size)
+    e.durations.erase(e.durations.begin(), e.durations.end() - static_cast<std::ptrdiff_t>(g_history_size));
+}
+
+inline void task_history::record(const std::string& key, const std::string& identity, const duration& d)
+{
+  const std::int64_t now = static_cast<std::int64_t>(std::time(nullptr));
+  std::lock_guard<std::mutex> lck(m_mtx);
+  add(m_commands, identity, d, now);
+  add(m_tasks, key, d, now);
+  m_modified = true;
+}
+
+inline void task_history::save()
+{
+  std::lock_guard<std::mutex> lck(m_mtx);
+  if (!m_modified)
+    return;
+
+  // the commands not executed for a while are removed: their arguments have changed
+  const std::int64_t limit = static_cast<std::int64_t>(std::time(nullptr)) - g_history_retention_days * 24 * 3600;
+  auto to_json = [&](std::map<std::string, entry>& entries) -> nlohmann::json {
+    nlohmann::json obj = nlohmann::json::object();
+    for (auto it = entries.begin(); it != entries.end(); )
+    {
+      if (it->second.used < limit)
+      {
+        it = entries.erase(it);
+        continue;
+      }
+      obj[it->first] = { { "used", it->second.used }, { "durations", it->second.durations } };
+      ++it;
+    }
+    return obj;
+  };
+  const nlohmann::json db = { { "commands", to_json(m_commands) }, { "tasks", to_json(m_tasks) } };
+
+  // write a temporary file then rename it: the history is never partially written
+  const std::filesystem::path tmp = m_path.string() + ".tmp";
+  {
+    std::ofstream file(tmp, std::ios::trunc);
+    if (!file.good())
+      return;
+    file << db.dump();
+    if (!file.good())
+      return;
+  }
+  std::error_code ec;
+  std::filesystem::rename(tmp, m_path, ec);
+  m_modified = false;
+}
+
+inline task_schedule schedule_tasks(const std::vector<task_node>& nodes, const var_env& vars, const task_history& history)
+{
+  task_schedule schedule;
+  schedule.estimates.resize(nodes.size());
+  schedule.known.resize(nodes.size());
+  schedule.ranks.resize(nodes.size());
+
+  // durations of the previous executions
+  std::int64_t total = 0;
+  std::size_t count = 0;
+  for (std::size_t i = 0; i < nodes.size(); ++i)
+  {
+    const task_node& node = nodes[i];
+    std::string identity;
+    try
+    {
+      identity = task_history::identity(node.description.render(vars), node.cmd.render(vars), node.args.render(vars));
+    }
+    catch (const std::exception&)
+    {
+      // the command uses the variables of the dependencies of the task
+    }
+    if (const auto& d = history.estimate(node.key, identity))
+    {
+      schedule.estimates[i] = *d;
+      schedule.known[i] = true;
+      total += d->count();
+      ++count;
+    }
+  }
+  const task_history::duration unknown(count ? total / static_cast<std::int64_t>(count) : 0);
+  for (std::size_t i = 0; i < nodes.size(); ++i)
+    if (!schedule.known[i])
+      schedule.estimates[i] = unknown;
+
+  // longest path to the end of the graph: computed by reverse topological order
+  std::vector<std::size_t> pending(nodes.size());
+  std::vector<std::size_t> order;
+  order.reserve(nodes.size());
+  for (std::size_t i = 0; i < nodes.size(); ++i)
+  {
+    pending[i] = nodes[i].pending;
+    if (!pending[i])
+      order.push_back(i);
+  }
+  for (std::size_t k = 0; k < order.size(); ++k)
+    for (const auto& n : nodes[order[k]].next)
+      if (--pending[n] == 0)
+        order.push_back(n);
+  for (auto it = order.rbegin(); it != order.rend(); ++it)
+  {
+    std::int64_t next = 0;
+    for (const auto& n : nodes[*it].next)
+      next = std::max(next, schedule.ranks[n]);
+    schedule.ranks[*it] = static_cast<std::int64_t>(schedule.estimates[*it].count()) + next;
+  }
+  return schedule;
+}
+
+inline std::int64_t get_priority(const std::vector<task_node>& nodes, const task_schedule& schedule, std::size_t idx)
+{
+  std::int64_t priority = schedule.ranks[idx];
+  while (nodes[idx].stdout_task)
+  {
+    idx = *nodes[idx].stdout_task;
+    priority = std::max(priority, schedule.ranks[idx]);
+  }
+  return priority;
+}
+
+inline std::vector<planned_task> plan_tasks(const std::vector<task_node>& nodes, const task_schedule& schedule, const std::size_t jobs)
+{
+  using duration = task_history::duration;
+  std::vector<planned_task> plan;
+
+  // same order as the execution: longest critical path first (by order of declaration with a single job)
+  std::vector<std::size_t> pending(nodes.size());
+  std::set<std::pair<std::int64_t, std::size_t>> ready;
+  auto add_ready = [&](const std::size_t i) -> void {
+    ready.emplace((jobs > 1) ? -get_priority(nodes, schedule, i) : 0, i);
+  };
+  for (std::size_t i = 0; i < nodes.size(); ++i)
+  {
+    pending[i] = nodes[i].pending;
+    if (!pending[i] && !nodes[i].stdin_task)
+      add_ready(i);
+  }
+
+  // workers: the pipelines in progress by end time, the free workers by index
+  std::set<std::pair<duration, std::size_t>> running;
+  std::map<std::size_t, std::vector<std::size_t>> pipelines;
+  std::set<std::size_t> free_workers;
+  for (std::size_t w = 0; w < std::max<std::size_t>(1, jobs); ++w)
+    free_workers.insert(w);
+  duration now(0);
+  while (!ready.empty() || !running.empty())
+  {
+    while (!ready.empty() && !free_workers.empty())
+    {
+      const std::size_t i = ready.begin()->second;
+      ready.erase(ready.begin());
+      const std::size_t w = *free_workers.begin();
+      free_workers.erase(free_workers.begin());
+      std::vector<std::size_t> pipeline = { i };
+      while (nodes[pipeline.back()].stdout_task)
+        pipeline.push_back(*nodes[pipeline.back()].stdout_task);
+      duration end = now;
+      for (const auto& p : pipeline)
+      {
+        plan.push_back(planned_task{ p, w, now, now + schedule.estimates[p], false });
+        end = std::max(end, now + schedule.estimates[p]);
+      }
+      running.emplace(end, w);
+      pipelines[w] = std::move(pipeline);
+    }
+    if (running.empty())
+      break;
+
+    // completion of the first pipeline: its next tasks can be ready
+    const auto [end, w] = *running.begin();
+    running.erase(running.begin());
+    now = end;
+    free_workers.insert(w);
+    for (const auto& p : pipelines[w])
+      for (const auto& n : nodes[p].next)
+        if (--pending[n] == 0)
+          add_ready(n);
+  }
+
+  // critical path: from the task with the longest path, the next task with the longest path - none without history
+  std::vector<std::size_t> position(nodes.size(), plan.size());
+  for (std::size_t k = 0; k < plan.size(); ++k)
+    position[plan[k].idx] = k;
+  std::optional<std::size_t> cur;
+  for (std::size_t i = 0; i < nodes.size(); ++i)
+    if (!nodes[i].pending && (!cur || (schedule.ranks[i] > schedule.ranks[*cur])))
+      cur = i;
+  if (cur && !schedule.ranks[*cur])
+    cur.reset();
+  while (cur && (position[*cur] < plan.size()))
+  {
+    plan[position[*cur]].critical = true;
+    std::optional<std::size_t> next;
+    for (const auto& n : nodes[*cur].next)
+      if (!next || (schedule.ranks[n] > schedule.ranks[*next]))
+        next = n;
+    cur = next;
+  }
+  return plan;
+}
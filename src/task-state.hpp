@@ -0,0 +1,434 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <future>
+#include <atomic>
+#include <fstream>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <algorithm>
+#include <functional>
+#include <filesystem>
+#include <system_error>
+#include <fmt/core.h>
+#include <nlohmann/json.hpp>
+
+/*============================================
+| Declaration
+==============================================*/
+// fast non-cryptographic 64 bits hash of a buffer - can be computed by chunks
+class hash64
+{
+public:
+  void update(const char* data, std::size_t size);
+  std::uint64_t digest() const;
+
+  // hash of a string
+  static std::uint64_t of(const std::string& str)
+  {
+    hash64 h;
+    h.update(str.data(), str.size());
+    return h.digest();
+  }
+
+private:
+  static std::uint64_t mix(std::uint64_t h, const std::uint64_t v)
+  {
+    h ^= v * 0x9e3779b97f4a7c15ULL;
+    h = (h << 31) | (h >> 33);
+    return h * 0xbf58476d1ce4e5b9ULL;
+  }
+
+private:
+  std::uint64_t m_state = 0x27d4eb2f165667c5ULL;
+  std::uint64_t m_size = 0;
+  char m_tail[8];
+  std::size_t m_tail_size = 0;
+};
+
+// expand a list of paths which can contain wildcards: '*', '?' or '**' (any sub-directories)
+//  directories are expanded to all the files they contain
+inline std::vector<std::filesystem::path> expand_paths(const std::vector<std::string>& patterns);
+
+// persistent state of the last successful execution of the tasks:
+//  hash of the command, content of the input/output files and produced variables
+class task_state_db
+{
+public:
+  explicit task_state_db(const std::filesystem::path& path);
+
+  // check if a task is up-to-date and return the variables it produced
+  std::optional<std::map<std::string, std::string>> check(const std::string& key,
+                                                          const std::string& command,
+                                                          const std::vector<std::string>& inputs,
+                                                          const std::vector<std::string>& outputs);
+
+  // store the state of a task after its successful execution
+  void update(const std::string& key,
+              const std::string& command,
+              const std::vector<std::string>& inputs,
+              const std::vector<std::string>& outputs,
+              const std::map<std::string, std::string>& variables);
+
+  // write the database if it has been modified - the errors are ignored (read-only directory...)
+  void save();
+
+private:
+  struct file_state
+  {
+    std::uint64_t size = 0;
+    std::int64_t mtime = 0;
+    std::uint64_t hash = 0;
+  };
+  using files_state = std::map<std::string, file_state>;
+
+  // get the size/mtime of the files and compute their hash if it can't be reused from the previous state
+  //  return false if a file can't be read or if a required file (without wildcard) doesn't exist
+  static bool read_files(const std::vector<std::string>& patterns,
+                         const bool required,
+                         const files_state& previous,
+                         files_state& files);
+
+  // hash the content of a list of files in parallel
+  static bool hash_files(const std::vector<std::pair<std::string, file_state*>>& files);
+
+  static nlohmann::json to_json(const files_state& files);
+  static files_state from_json(const nlohmann::json& obj);
+
+private:
+  const std::filesystem::path m_path;
+  std::mutex m_mtx;
+  nlohmann::json m_db;
+  bool m_modified = false;
+};
+
+/*============================================
+| Definition
+==============================================*/
+inline void hash64::update(const char* data, std::size_t size)
+{
+  m_size += size;
+  if (m_tail_size)
+  {
+    const std::size_t n = std::min(size, sizeof(m_tail) - m_tail_size);
+    std::memcpy(m_tail + m_tail_size, data, n);
+    m_tail_size += n;
+    data += n;
+    size -= n;
+    if (m_tail_size < sizeof(m_tail))
+      return;
+    std::uint64_t v;
+    std::memcpy(&v, m_tail, sizeof(v));
+    m_state = mix(m_state, v);
+    m_tail_size = 0;
+  }
+  for (; size >= sizeof(std::uint64_t); data += sizeof(std::uint64_t), size -= sizeof(std::uint64_t))
+  {
+    std::uint64_t v;
+    std::memcpy(&v, data, sizeof(v));
+    m_state = mix(m_state, v);
+  }
+  std::memcpy(m_tail, data, size);
+  m_tail_size = size;
+}
+
+inline std::uint64_t hash64::digest() const
+{
+  std::uint64_t v = 0;
+  std::memcpy(&v, m_tail, m_tail_size);
+  std::uint64_t h = mix(mix(m_state, v), m_size);
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  return h;
+}
+
+inline std::vector<std::filesystem::path> expand_paths(const std::vector<std::string>& patterns)
+{
+  // match a path with a pattern: '*' and '?' don't match '/', '**' matches everything
+  auto match = [](const std::string& pattern, const std::string& str) -> bool {
+    std::vector<std::vector<signed char>> memo(pattern.size() + 1, std::vector<signed char>(str.size() + 1, -1));
+    std::function<bool(std::size_t, std::size_t)> m = [&](std::size_t p, std::size_t s) -> bool {
+      signed char& r = memo[p][s];
+      if (r != -1)
+        return r;
+      if (p == pattern.size())
+        r = (s == str.size());
+      else if (pattern.compare(p, 2, "**") == 0)
+      {
+        const std::size_t next = ((p + 2 < pattern.size()) && (pattern[p + 2] == '/')) ? p + 3 : p + 2;
+        r = m(next, s) || ((s < str.size()) && m(p, s + 1));
+      }
+      else if (pattern[p] == '*')
+        r = m(p + 1, s) || ((s < str.size()) && (str[s] != '/') && m(p, s + 1));
+      else if (pattern[p] == '?')
+        r = (s < str.size()) && (str[s] != '/') && m(p + 1, s + 1);
+      else
+        r = (s < str.size()) && (str[s] == pattern[p]) && m(p + 1, s + 1);
+      return r;
+    };
+    return m(0, 0);
+  };
+
+  std::vector<std::filesystem::path> paths;
+  auto add_path = [&](const std::filesystem::path& path) -> void {
+    std::error_code ec;
+    if (std::filesystem::is_directory(path, ec))
+    {
+      for (const auto& entry : std::filesystem::recursive_directory_iterator(path, ec))
+        if (entry.is_regular_file(ec))
+          paths.push_back(entry.path());
+    }
+    else if (std::filesystem::exists(path, ec))
+      paths.push_back(path);
+  };
+  for (std::string pattern : patterns)
+  {
+    // remove the quotes added by the absolute path conversion
+    pattern.erase(std::remove(pattern.begin(), pattern.end(), '\"'), pattern.end());
+    std::replace(pattern.begin(), pattern.end(), '\\', '/');
+    const std::size_t wildcard = pattern.find_first_of("*?");
+    if (wildcard == std::string::npos)
+    {
+      add_path(std::filesystem::path(pattern));
+      continue;
+    }
+
+    // iterate from the last directory before the first wildcard
+    const std::size_t sep = pattern.find_last_of('/', wildcard);
+    const std::string base = (sep == std::string::npos) ? "." : pattern.substr(0, sep + 1);
+    const std::string filter = (sep == std::string::npos) ? pattern : pattern.substr(sep + 1);
+    std::error_code ec;
+    for (const auto& entry : std::filesystem::recursive_directory_iterator(base, ec))
+    {
+      if (!entry.is_regular_file(ec))
+        continue;
+      if (match(filter, entry.path().lexically_relative(base).generic_string()))
+        paths.push_back(entry.path());
+    }
+  }
+  std::sort(paths.begin(), paths.end());
+  paths.erase(std::unique(paths.begin(), paths.end()), paths.end());
+  return paths;
+}
+
+inline task_state_db::task_state_db(const std::filesystem::path& path) :
+  m_path(path),
+  m_db(nlohmann::json::object())
+{
+  std::ifstream file(m_path);
+  if (!file.good())
+    return;
+  try
+  {
+    m_db = nlohmann::json::parse(file);
+  }
+  catch (const std::exception&)
+  {
+    // an invalid state only means that all the tasks will be executed
+    m_db = nlohmann::json::object();
+  }
+  if (!m_db.is_object())
+    m_db = nlohmann::json::object();
+}
+
+inline std::optional<std::map<std::string, std::string>> task_state_db::check(const std::string& key,
+                                                                              const std::string& command,
+                                                                              const std::vector<std::string>& inputs,
+                                                                              const std::vector<std::string>& outputs)
+{
+  files_state prev_inputs;
+  files_state prev_outputs;
+  std::map<std::string, std::string> variables;
+  {
+    std::lock_guard<std::mutex> lck(m_mtx);
+    if (!m_db.contains(key))
+      return std::nullopt;
+    const nlohmann::json& entry = m_db[key];
+    try
+    {
+      if (entry.at("command").get<std::string>() != fmt::format("{:016x}", hash64::of(command)))
+        return std::nullopt;
+      prev_inputs = from_json(entry.at("inputs"));
+      prev_outputs = from_json(entry.at("outputs"));
+      variables = entry.at("variables").get<std::map<std::string, std::string>>();
+    }
+    catch (const std::exception&)
+    {
+      return std::nullopt;
+    }
+  }
+
+  // the list of files and their content must be the same
+  auto same = [](const files_state& prev, const files_state& cur) -> bool {
+    return (prev.size() == cur.size()) &&
+           std::equal(prev.begin(), prev.end(), cur.begin(), [](const auto& a, const auto& b) {
+             return (a.first == b.first) && (a.second.size == b.second.size) && (a.second.hash == b.second.hash);
+           });
+  };
+  files_state cur_inputs;
+  files_state cur_outputs;
+  if (!read_files(inputs, false, prev_inputs, cur_inputs) || !same(prev_inputs, cur_inputs) ||
+      !read_files(outputs, true, prev_outputs, cur_outputs) || !same(prev_outputs, cur_outputs))
+    return std::nullopt;
+  return variables;
+}
+
+inline void task_state_db::update(const std::string& key,
+                                  const std::string& command,
+                                  const std::vector<std::string>& inputs,
+                                  const std::vector<std::string>& outputs,
+                                  const std::map<std::string, std::string>& variables)
+{
+  files_state prev_inputs;
+  files_state prev_outputs;
+  {
+    std::lock_guard<std::mutex> lck(m_mtx);
+    if (m_db.contains(key))
+    {
+      try
+      {
+        prev_inputs = from_json(m_db[key].at("inputs"));
+        prev_outputs = from_json(m_db[key].at("outputs"));
+      }
+      catch (const std::exception&)
+      {
+      }
+    }
+  }
+  files_state cur_inputs;
+  files_state cur_outputs;
+  const bool valid = read_files(inputs, false, prev_inputs, cur_inputs) &&
+                     read_files(outputs, true, prev_outputs, cur_outputs);
+
+  std::lock_guard<std::mutex> lck(m_mtx);
+  if (!valid)
+    m_db.erase(key);
+  else
+    m_db[key] = {
+      {"command", fmt::format("{:016x}", hash64::of(command))},
+      {"inputs", to_json(cur_inputs)},
+      {"outputs", to_json(cur_outputs)},
+      {"variables", variables}
+    };
+  m_modified = true;
+}
+
+inline void task_state_db::save()
+{
+  std::lock_guard<std::mutex> lck(m_mtx);
+  if (!m_modified)
+    return;
+
+  // write a temporary file then rename it: the state is never partially written
+  const std::filesystem::path tmp = m_path.string() + ".tmp";
+  //  kept as modified if it can't be written: written by the next execution of the server
+  {
+    std::ofstream file(tmp, std::ios::trunc);
+    if (!file.good())
+      return;
+    file << m_db.dump();
+    if (!file.good())
+      return;
+  }
+  std::error_code ec;
+  std::filesystem::rename(tmp, m_path, ec);
+  if (!ec)
+    m_modified = false;
+}
+
+inline bool task_state_db::read_files(const std::vector<std::string>& patterns,
+                                      const bool required,
+                                      const files_state& previous,
+                                      files_state& files)
+{
+  for (std::string pattern : patterns)
+  {
+    pattern.erase(std::remove(pattern.begin(), pattern.end(), '\"'), pattern.end());
+    std::error_code ec;
+    if (required && (pattern.find_first_of("*?") == std::string::npos) && !std::filesystem::exists(std::filesystem::path(pattern), ec))
+      return false;
+  }
+
+  // fast check using size/mtime: the hash of unmodified files is reused
+  std::vector<std::pair<std::string, file_state*>> to_hash;
+  for (const auto& path : expand_paths(patterns))
+  {
+    std::error_code ec;
+    file_state state;
+    state.size = static_cast<std::uint64_t>(std::filesystem::file_size(path, ec));
+    if (ec)
+      return false;
+    state.mtime = static_cast<std::int64_t>(std::filesystem::last_write_time(path, ec).time_since_epoch().count());
+    if (ec)
+      return false;
+    const std::string name = path.generic_u8string();
+    const auto& it = previous.find(name);
+    const bool unchanged = (it != previous.end()) && (it->second.size == state.size) && (it->second.mtime == state.mtime);
+    if (unchanged)
+      state.hash = it->second.hash;
+    file_state& f = files[name];
+    f = state;
+    if (!unchanged)
+      to_hash.emplace_back(name, &f);
+  }
+  return hash_files(to_hash);
+}
+
+inline bool task_state_db::hash_files(const std::vector<std::pair<std::string, file_state*>>& files)
+{
+  std::atomic<std::size_t> next = 0;
+  std::atomic<bool> valid = true;
+  auto worker = [&]() -> void {
+    std::vector<char> buffer(1024 * 1024);
+    for (std::size_t i = next++; valid && (i < files.size()); i = next++)
+    {
+      std::ifstream file(std::filesystem::u8path(files[i].first), std::ios::binary);
+      if (!file.good())
+      {
+        valid = false;
+        return;
+      }
+      hash64 h;
+      while (file)
+      {
+        file.read(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+        h.update(buffer.data(), static_cast<std::size_t>(file.gcount()));
+      }
+      files[i].second->hash = h.digest();
+    }
+  };
+  const std::size_t nb_threads = std::min<std::size_t>(files.size(), std::max(1u, std::thread::hardware_concurrency()));
+  std::vector<std::future<void>> pool;
+  for (std::size_t i = 1; i < nb_threads; ++i)
+    pool.push_back(std::async(std::launch::async, worker));
+  worker();
+  for (auto& f : pool)
+    f.wait();
+  return valid;
+}
+
+inline nlohmann::json task_state_db::to_json(const files_state& files)
+{
+  nlohmann::json obj = nlohmann::json::object();
+  for (const auto& [name, state] : files)
+    obj[name] = { state.size, state.mtime, fmt::format("{:016x}", state.hash) };
+  return obj;
+}
+
+inline task_state_db::files_state task_state_db::from_json(const nlohmann::json& obj)
+{
+  files_state files;
+  for (const auto& [name, value] : obj.items())
+  {
+    file_state& f = files[name];
+    f.size = value.at(0).get<std::uint64_t>();
+    f.mtime = value.at(1).get<std::int64_t>();
+    f.hash = std::stoull(value.at(2).get<std::string>(), nullptr, 16);
+  }
+  return files;
+}
@@ -0,0 +1,209 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <mutex>
+#include <cstdio>
+#include <chrono>
+#include <fstream>
+#include <filesystem>
+#include <algorithm>
+#include <stdexcept>
+#include <fmt/core.h>
+#include <fmt/color.h>
+#include <nlohmann/json.hpp>
+#include "process.hpp"
+
+/*============================================
+| Declaration
+==============================================*/
+// timings of a task execution
+struct task_timings
+{
+  using clock = std::chrono::steady_clock;
+
+  // step of the task (lock wait, variables expansion...) - with its real timestamps
+  struct span
+  {
+    std::string name;
+    std::string cat;
+    clock::time_point start;
+    clock::time_point end;
+  };
+
+  std::string name;                             // description of the task
+  std::size_t group_idx = 0;                    // index of its tasks-group
+  std::size_t worker = 0;                       // index of the worker which executed it
+  std::string status;                           // OK, KO, UP-TO-DATE, DEBUG or SKIPPED
+  clock::time_point start;                      // start of the task (before locking its resources)
+  clock::time_point end;                        // end of the task
+  std::chrono::microseconds lock_wait{ 0 };     // time spent waiting for the "protected" resources
+  std::chrono::microseconds slot_wait{ 0 };     // time spent waiting for a job slot
+  std::chrono::microseconds expansion{ 0 };     // time spent to expand the variables of the task
+  std::vector<span> spans;                      // steps of the task - in the order they were executed
+  clock::time_point process_start;              // execution of the process - empty if not executed
+  clock::time_point process_end;
+  process_stats process;                        // resources used by the process
+};
+
+// collect the timings of a run: exported as chrome trace-event json (for chrome://tracing or perfetto)
+class task_trace
+{
+public:
+  using clock = task_timings::clock;
+
+  task_trace() :
+    m_origin(clock::now())
+  {
+  }
+
+  // add a step of the run (parsing, locking...) - executed by the main thread
+  void add_step(const std::string& name, const clock::time_point& start, const clock::time_point& end = clock::now());
+
+  // add the timings of a task - can be called from any thread
+  void add_task(task_timings timings);
+
+  // write the trace-event json file
+  void save(const std::filesystem::path& path) const;
+
+  // display the slowest tasks and the total time spent waiting for the resources
+  void print_summary(std::FILE* out, const std::size_t count) const;
+
+private:
+  long long to_us(const clock::time_point& t) const
+  {
+    return std::chrono::duration_cast<std::chrono::microseconds>(t - m_origin).count();
+  }
+
+private:
+  struct step
+  {
+    std::string name;
+    clock::time_point start;
+    clock::time_point end;
+  };
+  const clock::time_point m_origin;
+  mutable std::mutex m_mtx;
+  std::vector<step> m_steps;
+  std::vector<task_timings> m_tasks;
+};
+
+/*============================================
+| Definition
+==============================================*/
+inline void task_trace::add_step(const std::string& name, const clock::time_point& start, const clock::time_point& end)
+{
+  std::lock_guard<std::mutex> lck(m_mtx);
+  m_steps.push_back(step{ name, start, end });
+}
+
+inline void task_trace::add_task(task_timings timings)
+{
+  std::lock_guard<std::mutex> lck(m_mtx);
+  m_tasks.push_back(std::move(timings));
+}
+
+inline void task_trace::save(const std::filesystem::path& path) const
+{
+  using json = nlohmann::ordered_json;
+  std::lock_guard<std::mutex> lck(m_mtx);
+
+  // complete event ("X") on a thread of the process
+  json events = json::array();
+  auto add_event = [&](const std::string& name, const std::string& cat, const std::size_t tid,
+                       const clock::time_point& start, const clock::time_point& end, json args) -> void {
+    json ev = { { "name", name }, { "cat", cat }, { "ph", "X" }, { "pid", 1 }, { "tid", tid },
+                { "ts", to_us(start) }, { "dur", std::max(0LL, to_us(end) - to_us(start)) } };
+    if (!args.is_null())
+      ev["args"] = std::move(args);
+    events.push_back(std::move(ev));
+  };
+
+  // name the threads: the steps of the run and one thread per worker
+  std::size_t workers = 0;
+  for (const auto& t : m_tasks)
+    workers = std::max(workers, t.worker + 1);
+  events.push_back({ { "name", "thread_name" }, { "ph", "M" }, { "pid", 1 }, { "tid", 0 }, { "args", { { "name", "AutoLaunch" } } } });
+  for (std::size_t w = 0; w < workers; ++w)
+    events.push_back({ { "name", "thread_name" }, { "ph", "M" }, { "pid", 1 }, { "tid", w + 1 }, { "args", { { "name", fmt::format("worker {}", w) } } } });
+  for (const auto& s : m_steps)
+    add_event(s.name, "step", 0, s.start, s.end, json());
+
+  // tasks: the lock waits, the slot wait, the variables expansion and the process are nested in the task
+  std::vector<std::pair<clock::time_point, clock::time_point>> groups;
+  for (const auto& t : m_tasks)
+  {
+    const std::size_t tid = t.worker + 1;
+    json args = {
+      { "status", t.status },
+      { "group", t.group_idx },
+      { "lock-wait-us", t.lock_wait.count() },
+      { "slot-wait-us", t.slot_wait.count() },
+      { "expansion-us", t.expansion.count() },
+      { "spawn-us", t.process.spawn.count() },
+      { "user-cpu-us", t.process.user_cpu.count() },
+      { "sys-cpu-us", t.process.sys_cpu.count() },
+      { "peak-rss-bytes", t.process.peak_rss },
+      { "output-bytes", t.process.output_bytes } };
+    add_event(t.name, "task", tid, t.start, t.end, std::move(args));
+    for (const auto& sp : t.spans)
+      if (to_us(sp.end) > to_us(sp.start))
+        add_event(sp.name, sp.cat, tid, sp.start, sp.end, json());
+    if (t.process_end > t.process_start)
+      add_event("process", "process", tid, t.process_start, t.process_end, json());
+
+    // span of the tasks-groups
+    if (groups.size() <= t.group_idx)
+      groups.resize(t.group_idx + 1, { clock::time_point::max(), clock::time_point::min() });
+    groups[t.group_idx].first = std::min(groups[t.group_idx].first, t.start);
+    groups[t.group_idx].second = std::max(groups[t.group_idx].second, t.end);
+  }
+
+  // tasks-groups can overlap: displayed as async events
+  for (std::size_t g = 0; g < groups.size(); ++g)
+  {
+    if (groups[g].first > groups[g].second)
+      continue;
+    const std::string name = fmt::format("group {}", g);
+    events.push_back({ { "name", name }, { "cat", "group" }, { "ph", "b" }, { "id", g }, { "pid", 1 }, { "tid", 0 }, { "ts", to_us(groups[g].first) } });
+    events.push_back({ { "name", name }, { "cat", "group" }, { "ph", "e" }, { "id", g }, { "pid", 1 }, { "tid", 0 }, { "ts", to_us(groups[g].second) } });
+  }
+
+  std::ofstream file(path, std::ios::binary);
+  if (!file)
+    throw std::runtime_error(fmt::format("can't write trace file: \"{}\"", path.u8string()));
+  file << json({ { "traceEvents", std::move(events) }, { "displayTimeUnit", "ms" } }).dump();
+}
+
+inline void task_trace::print_summary(std::FILE* out, const std::size_t count) const
+{
+  std::lock_guard<std::mutex> lck(m_mtx);
+  auto to_s = [](const auto& d) -> double { return std::chrono::duration<double>(d).count(); };
+
+  // slowest tasks first
+  std::vector<const task_timings*> tasks;
+  for (const auto& t : m_tasks)
+    tasks.push_back(&t);
+  std::sort(tasks.begin(), tasks.end(), [](const task_timings* a, const task_timings* b) { return (a->end - a->start) > (b->end - b->start); });
+
+  fmt::print(out, fmt::emphasis::bold, "\n{:<50} {:>9} {:>9} {:>9} {:>9} {:>9} {:>10}\n", "slowest tasks:", "wall (s)", "user (s)", "sys (s)", "lock (s)", "slot (s)", "rss (MiB)");
+  for (std::size_t i = 0; i < std::min(count, tasks.size()); ++i)
+  {
+    const task_timings& t = *tasks[i];
+    std::string name = t.name;
+    if (name.size() > 50)
+      name = name.substr(0, 47) + "...";
+    fmt::print(out, "{:<50} {:>9.3f} {:>9.3f} {:>9.3f} {:>9.3f} {:>9.3f} {:>10.1f}\n",
+      name, to_s(t.end - t.start), to_s(t.process.user_cpu), to_s(t.process.sys_cpu), to_s(t.lock_wait), to_s(t.slot_wait),
+      static_cast<double>(t.process.peak_rss) / (1024.0 * 1024.0));
+  }
+
+  std::chrono::microseconds lock_wait{ 0 };
+  std::chrono::microseconds slot_wait{ 0 };
+  for (const auto& t : m_tasks)
+  {
+    lock_wait += t.lock_wait;
+    slot_wait += t.slot_wait;
+  }
+  fmt::print(out, fmt::emphasis::bold, "{:<50} {:>9.3f}\n", "total lock wait (s):", to_s(lock_wait));
+  fmt::print(out, fmt::emphasis::bold, "{:<50} {:>9.3f}\n", "total job slot wait (s):", to_s(slot_wait));
+}
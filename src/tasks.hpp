@@ -0,0 +1,940 @@
+#pragma once
+#include <string>
+#include <map>
+#include <vector>
+#include <memory>
+#include <optional>
+#include <tuple>
+#include <chrono>
+#include <fstream>
+#include <filesystem>
+#include <functional>
+#include <algorithm>
+#include <stdexcept>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <exception>
+#include <fmt/core.h>
+#include <nlohmann/json.hpp>
+#include "var-template.hpp"
+#include "process.hpp"
+#include "resource-lock.hpp"
+#include "cpu-set.hpp"
+#include "watchdog.hpp"
+#include "metrics.hpp"
+#include "task-state.hpp"
+#include "pattern-set.hpp"
+using json = nlohmann::ordered_json;
+
+/*============================================
+| Definition
+==============================================*/
+// tasks file model: variables, tasks graph and execution of one task
+//  shared by the AutoLaunch program and its benchmark
+
+// update string with existing variables
+inline const std::string update_var(const std::string& str,
+                                    const var_env& variables)
+{
+  return var_template(str).render(variables);
+}
+
+// parse command-line option as key:value - a value can use the previous options
+inline var_map parse_cmd(const std::vector<std::string>& vars)
+{
+  auto split = [](const std::string& str) -> std::pair<std::string, std::string> {
+    std::size_t pos = str.find(':');
+    if (pos == std::string::npos)
+      throw std::runtime_error(fmt::format("invalid command-line option: \"{}\"", str));
+    return std::pair<std::string, std::string>{str.substr(0, pos), str.substr(pos+1)};
+  };
+  var_map variables;
+  for (const auto& v : vars)
+  {
+    auto [key, value] = split(v);
+    variables.set(key, update_var(value, var_env().push(variables)));
+  }
+  return variables;
+}
+
+// execution flags of a task: from the task or its tasks-group - none if not defined (command-line value)
+struct task_flags
+{
+  std::optional<bool> display;
+  std::optional<bool> debug;
+  std::optional<bool> ignore_error;
+  std::optional<bool> ask_execute;
+  std::optional<bool> ask_continue;
+  std::optional<bool> force;
+  std::optional<float> timeout;
+  std::optional<float> idle_timeout;
+  std::optional<float> kill_grace;
+  std::optional<std::string> kill_signal;
+  std::optional<float> logs_tail;
+  std::optional<float> retries;
+  std::optional<float> retry_delay;
+};
+
+// items of a "foreach" task: one process is executed per item (or per batch of items)
+struct task_foreach
+{
+  std::vector<var_template> items;            // lists of items: each rendered value is split by the separator
+  std::vector<var_template> globs;            // wildcards of files - expanded at the execution
+  std::string separator = "\n";               // separator of the items of a list
+  std::string var = "item";                   // variable of the item (or of the quoted items of a batch)
+  std::size_t batch = 1;                      // maximum number of items per process - 0: up to the command-line limit
+};
+
+// node of the tasks execution graph
+struct task_node
+{
+  std::string id;                             // identifier of the task - empty if none
+  std::size_t group_idx = 0;                  // index of the tasks-group
+  task_flags flags;                           // execution flags
+  std::vector<std::size_t> deps;              // tasks which provide their variables to this task
+  std::vector<std::size_t> waits;             // tasks which must be completed before (ordering only)
+  std::vector<std::size_t> next;              // tasks waiting for the completion of this task
+  std::size_t pending = 0;                    // number of deps/waits not yet completed
+  var_map vars;                               // variables produced by this task and its dependencies
+  var_template description;                   // compiled task parameters
+  var_template cmd;
+  var_template args;
+  std::vector<std::pair<std::string, var_template>> variables;
+  std::shared_ptr<const pattern_set> parse_variables;  // regexes extracting variables from the logs - none if null
+  std::string output_variable;                // variable set with the whole output of the task - none if empty
+  std::optional<task_foreach> foreach;        // items of the task - executed once if none
+  std::vector<var_template> inputs;           // files used/generated by the task - incremental execution
+  std::vector<var_template> outputs;
+  std::string key;                            // identifier of the task in the state database
+  std::vector<resource> resources;            // resources locked by the task ("protected" flag)
+  std::vector<resource> group_resources;      // resources locked by its tasks-group
+  std::optional<std::size_t> stdin_task;      // task whose output is piped to the stdin of this task
+  std::optional<std::size_t> stdout_task;     // task reading the output of this task on its stdin
+  bool pipe_stderr = false;                   // the stderr of this task is also piped
+  bool pipe_logs = false;                     // the piped output of this task is also written in its logs
+  cpu_request cpus;                           // cores reserved by the task - none if empty
+  process_limits limits;                      // priority and limits of the process
+};
+
+// read the execution flags of a task: the task flags override the flags of its group
+inline task_flags get_task_flags(const json& tasks_group, const json& task)
+{
+  const json& group_flags = (tasks_group.contains("flags") && tasks_group["flags"].is_object()) ? tasks_group["flags"] : json::object();
+  auto get_bool = [&](const std::string& key) -> std::optional<bool> {
+    if (task.contains(key))
+    {
+      if (!task[key].is_boolean())
+        throw std::runtime_error(fmt::format("invalid \"{}\" flag (boolean expected): {}", key, task[key].dump()));
+      return task[key].get<bool>();
+    }
+    if (group_flags.contains(key) && group_flags[key].is_boolean())
+      return group_flags[key].get<bool>();
+    return std::nullopt;
+  };
+  auto get_float = [&](const std::string& key) -> std::optional<float> {
+    if (task.contains(key))
+    {
+      if (!task[key].is_number())
+        throw std::runtime_error(fmt::format("invalid \"{}\" flag (number expected): {}", key, task[key].dump()));
+      return task[key].get<float>();
+    }
+    if (group_flags.contains(key) && group_flags[key].is_number())
+      return group_flags[key].get<float>();
+    return std::nullopt;
+  };
+  auto get_string = [&](const std::string& key) -> std::optional<std::string> {
+    if (task.contains(key))
+    {
+      if (!task[key].is_string())
+        throw std::runtime_error(fmt::format("invalid \"{}\" flag (string expected): {}", key, task[key].dump()));
+      return task[key].get<std::string>();
+    }
+    if (group_flags.contains(key) && group_flags[key].is_string())
+      return group_flags[key].get<std::string>();
+    return std::nullopt;
+  };
+  task_flags flags;
+  flags.display = get_bool("display");
+  flags.debug = get_bool("debug");
+  flags.ignore_error = get_bool("ignore-error");
+  flags.ask_execute = get_bool("ask-execute");
+  flags.ask_continue = get_bool("ask-continue");
+  flags.force = get_bool("force");
+  flags.timeout = get_float("timeout");
+  flags.idle_timeout = get_float("idle-timeout");
+  flags.kill_grace = get_float("kill-grace");
+  flags.kill_signal = get_string("kill-signal");
+  if (flags.kill_signal)
+    parse_signal(*flags.kill_signal);
+  flags.logs_tail = get_float("logs-tail");
+  flags.retries = get_float("retries");
+  if (flags.retries && ((*flags.retries < 0.0f) || (*flags.retries != static_cast<float>(static_cast<int>(*flags.retries)))))
+    throw std::runtime_error(fmt::format("invalid \"retries\" flag (integer >= 0 expected): {}", *flags.retries));
+  flags.retry_delay = get_float("retry-delay");
+  return flags;
+}
+
+// read the cores, priority and limits of a task: the task flags override the flags of its group
+//  "cpus": number of cores or set of cores ("0-3,6" or [0, 1, 2]), "nice": -20 to 19, "max-memory": MiB,
+//  "max-open-files": number of files, "io-priority": "idle", "best-effort[:level]" or "realtime[:level]" (level 0-7)
+inline process_limits get_process_limits(const json& tasks_group, const json& task, cpu_request& cpus)
+{
+  const json& group_flags = (tasks_group.contains("flags") && tasks_group["flags"].is_object()) ? tasks_group["flags"] : json::object();
+  auto get = [&](const std::string& key) -> const json* {
+    if (task.contains(key))
+      return &task[key];
+    if (group_flags.contains(key))
+      return &group_flags[key];
+    return nullptr;
+  };
+  auto invalid = [](const std::string& key, const std::string& expected, const json& value) -> std::runtime_error {
+    return std::runtime_error(fmt::format("invalid \"{}\" flag ({} expected): {}", key, expected, value.dump()));
+  };
+
+  cpus = cpu_request();
+  if (const json* value = get("cpus"))
+  {
+    if (value->is_number_unsigned() && (value->get<std::size_t>() > 0))
+      cpus.count = value->get<std::size_t>();
+    else if (value->is_string())
+      cpus.set = parse_cpu_set(value->get<std::string>());
+    else if (value->is_array() && !value->empty())
+    {
+      std::string set;
+      for (const auto& c : *value)
+      {
+        if (!c.is_number_unsigned())
+          throw invalid("cpus", "number or set of cores", *value);
+        set += fmt::format("{}{}", set.empty() ? "" : ",", c.get<std::size_t>());
+      }
+      cpus.set = parse_cpu_set(set);
+    }
+    else
+      throw invalid("cpus", "number or set of cores", *value);
+  }
+
+  process_limits limits;
+  if (const json* value = get("nice"))
+  {
+    if (!value->is_number_integer() || (value->get<int>() < -20) || (value->get<int>() > 19))
+      throw invalid("nice", "integer from -20 to 19", *value);
+    limits.nice = value->get<int>();
+  }
+  if (const json* value = get("max-memory"))
+  {
+    if (!value->is_number() || (value->get<double>() < 1.0))
+      throw invalid("max-memory", "number of MiB", *value);
+    limits.max_memory = static_cast<std::size_t>(value->get<double>() * 1024.0 * 1024.0);
+  }
+  if (const json* value = get("max-open-files"))
+  {
+    if (!value->is_number_unsigned() || (value->get<std::size_t>() == 0))
+      throw invalid("max-open-files", "number of files", *value);
+    limits.max_open_files = value->get<std::size_t>();
+  }
+  if (const json* value = get("io-priority"))
+  {
+    const std::string str = value->is_string() ? value->get<std::string>() : std::string();
+    const std::size_t pos = str.find(':');
+    const std::string name = str.substr(0, pos);
+    const std::string level = (pos != std::string::npos) ? str.substr(pos + 1) : std::string();
+    limits.io_class = (name == "realtime") ? 1 : (name == "best-effort") ? 2 : (name == "idle") ? 3 : 0;
+    limits.io_level = (pos == std::string::npos) ? 4 : (level.size() == 1) ? (level[0] - '0') : -1;
+    if (!limits.io_class || (limits.io_level < 0) || (limits.io_level > 7) || ((limits.io_class == 3) && (pos != std::string::npos)))
+      throw invalid("io-priority", "\"idle\", \"best-effort[:0-7]\" or \"realtime[:0-7]\"", *value);
+    if (limits.io_class == 3)
+      limits.io_level = 0;
+  }
+  return limits;
+}
+
+// read the "foreach" field of a task - none if not defined
+//  {"items": list or [lists], "glob": pattern or [patterns], "var": name, "separator": str, "batch": n or "max"}
+inline std::optional<task_foreach> get_foreach(const json& task)
+{
+  if (!task.contains("foreach"))
+    return std::nullopt;
+  const json& value = task["foreach"];
+  auto invalid = [&]() -> std::runtime_error {
+    return std::runtime_error(fmt::format("invalid \"foreach\" format: {}", value.dump()));
+  };
+  auto get_templates = [&](const json& v) -> std::vector<var_template> {
+    std::vector<var_template> templates;
+    for (const auto& t : v.is_array() ? v : json::array({ v }))
+    {
+      if (!t.is_string())
+        throw invalid();
+      templates.emplace_back(t.get<std::string>());
+    }
+    return templates;
+  };
+  if (!value.is_object() || (value.contains("items") == value.contains("glob")))
+    throw invalid();
+  task_foreach foreach;
+  if (value.contains("items"))
+    foreach.items = get_templates(value["items"]);
+  else
+    foreach.globs = get_templates(value["glob"]);
+  if (value.contains("var"))
+  {
+    if (!value["var"].is_string() || value["var"].get<std::string>().empty())
+      throw invalid();
+    foreach.var = value["var"].get<std::string>();
+  }
+  if (value.contains("separator"))
+  {
+    if (!value["separator"].is_string() || value["separator"].get<std::string>().empty())
+      throw invalid();
+    foreach.separator = value["separator"].get<std::string>();
+  }
+  if (value.contains("batch"))
+  {
+    const json& batch = value["batch"];
+    if (batch.is_string() && (batch.get<std::string>() == "max"))
+      foreach.batch = 0;
+    else if (batch.is_number_unsigned() && (batch.get<std::size_t>() > 0))
+      foreach.batch = batch.get<std::size_t>();
+    else
+      throw invalid();
+  }
+  return foreach;
+}
+
+// read the "parse-variables" field of a task and check the syntax of its regexes - none if not defined
+//  [{"key": "regex"}, {"key": {"regex": "regex", "match": "first|last|all", "separator": str}}]
+inline std::shared_ptr<const pattern_set> get_parse_variables(const json& task)
+{
+  if (!task.contains("parse-variables"))
+    return nullptr;
+  const json& value = task["parse-variables"];
+  auto invalid = [&]() -> std::runtime_error {
+    return std::runtime_error(fmt::format("invalid \"parse-variables\" format: {}", value.dump()));
+  };
+  if (!value.is_array())
+    throw invalid();
+  std::vector<pattern_spec> specs;
+  for (const auto& var : value)
+  {
+    if (!var.is_object())
+      throw invalid();
+    for (const auto& [key, v] : var.items())
+    {
+      pattern_spec spec;
+      spec.key = key;
+      if (v.is_string())
+        spec.regex = v.get<std::string>();
+      else if (v.is_object() && v.contains("regex") && v["regex"].is_string())
+      {
+        spec.regex = v["regex"].get<std::string>();
+        if (v.contains("match"))
+        {
+          if (!v["match"].is_string())
+            throw invalid();
+          spec.mode = parse_match_mode(v["match"].get<std::string>());
+        }
+        if (v.contains("separator"))
+        {
+          if (!v["separator"].is_string())
+            throw invalid();
+          spec.separator = v["separator"].get<std::string>();
+        }
+      }
+      else
+        throw invalid();
+      specs.push_back(std::move(spec));
+    }
+  }
+  if (specs.empty())
+    return nullptr;
+  auto patterns = std::make_shared<const pattern_set>(std::move(specs));
+  patterns->check();
+  return patterns;
+}
+
+// get the items of a "foreach" task: the lists are split by the separator (empty items are ignored), the wildcards are expanded
+inline std::vector<std::string> get_foreach_items(const task_foreach& foreach, const var_env& vars)
+{
+  std::vector<std::string> items;
+  for (const auto& list : foreach.items)
+  {
+    const std::string str = list.render(vars);
+    std::size_t start = 0;
+    while (start <= str.size())
+    {
+      const std::size_t end = std::min(str.find(foreach.separator, start), str.size());
+      const std::size_t first = str.find_first_not_of(" \t\r\n", start);
+      const std::size_t last = str.find_last_not_of(" \t\r\n", end ? end - 1 : 0);
+      if ((first < end) && (last != std::string::npos) && (last >= first))
+        items.push_back(str.substr(first, last - first + 1));
+      start = end + foreach.separator.size();
+    }
+  }
+  if (!foreach.globs.empty())
+  {
+    std::vector<std::string> patterns;
+    for (const auto& g : foreach.globs)
+      patterns.push_back(g.render(vars));
+    for (const auto& p : expand_paths(patterns))
+      items.push_back(p.generic_u8string());
+  }
+  return items;
+}
+
+// value of the item variable for the items [begin, end): the item itself, or the quoted items separated by spaces for a batch
+inline std::string join_foreach_items(const task_foreach& foreach,
+                                      const std::vector<std::string>& items,
+                                      const std::size_t begin,
+                                      const std::size_t end)
+{
+  if (foreach.batch == 1)
+    return items[begin];
+  std::string value;
+  for (std::size_t i = begin; i < end; ++i)
+  {
+    if (i > begin)
+      value += ' ';
+    value += quote_argument(items[i]);
+  }
+  return value;
+}
+
+// split the items of a "foreach" task in batches [begin, end): up to "batch" items and within the command-line limit
+//  the length of the command-line is given for a value of the item variable (linear with the length of the value)
+//  each item also counts the pointer of its argument in the argument array of the process
+inline std::vector<std::pair<std::size_t, std::size_t>> get_foreach_batches(const task_foreach& foreach,
+                                                                            const std::vector<std::string>& items,
+                                                                            const std::function<std::size_t(const std::string&)>& command_length)
+{
+  std::vector<std::pair<std::size_t, std::size_t>> batches;
+  if (foreach.batch == 1)
+  {
+    for (std::size_t i = 0; i < items.size(); ++i)
+      batches.emplace_back(i, i + 1);
+    return batches;
+  }
+  const std::size_t base = command_length(std::string());
+  const std::size_t uses = command_length("x") - base;
+  const std::size_t limit = max_command_line();
+  std::size_t begin = 0;
+  std::size_t length = 0;
+  for (std::size_t i = 0; i < items.size(); ++i)
+  {
+    // a single item is always executed: its command-line is checked by the system
+    const std::size_t item_length = quote_argument(items[i]).size() + sizeof(char*) + ((i > begin) ? 1 : 0);
+    if ((i > begin) && (((foreach.batch != 0) && (i - begin == foreach.batch)) || (base + uses * (length + item_length) > limit)))
+    {
+      batches.emplace_back(begin, i);
+      begin = i;
+      length = quote_argument(items[i]).size() + sizeof(char*);
+      continue;
+    }
+    length += item_length;
+  }
+  if (begin < items.size())
+    batches.emplace_back(begin, items.size());
+  return batches;
+}
+
+// read the list of identifiers of a "depends-on" field
+inline std::vector<std::string> get_depends_on(const json& obj)
+{
+  std::vector<std::string> ids;
+  if (!obj.contains("depends-on"))
+    return ids;
+  const json& deps = obj["depends-on"];
+  if (deps.is_string())
+    ids.push_back(deps.get<std::string>());
+  else if (deps.is_array())
+  {
+    for (const auto& d : deps)
+    {
+      if (!d.is_string())
+        throw std::runtime_error("invalid \"depends-on\" format (string or array of strings expected)");
+      ids.push_back(d.get<std::string>());
+    }
+  }
+  else
+    throw std::runtime_error("invalid \"depends-on\" format (string or array of strings expected)");
+  return ids;
+}
+
+// read the "stdin" field of a task: "task-id" or {"task": "task-id", "stderr": bool, "logs": bool}
+//  return the identifier of the task whose output is piped to the stdin - empty if none
+inline std::string get_stdin(const json& task, bool& pipe_stderr, bool& pipe_logs)
+{
+  pipe_stderr = false;
+  pipe_logs = false;
+  if (!task.contains("stdin"))
+    return std::string();
+  const json& value = task["stdin"];
+  if (value.is_string())
+    return value.get<std::string>();
+  if (!value.is_object() || !value.contains("task") || !value["task"].is_string() ||
+      (value.contains("stderr") && !value["stderr"].is_boolean()) ||
+      (value.contains("logs") && !value["logs"].is_boolean()))
+    throw std::runtime_error(fmt::format("invalid \"stdin\" format: {}", value.dump()));
+  pipe_stderr = value.contains("stderr") && value["stderr"].get<bool>();
+  pipe_logs = value.contains("logs") && value["logs"].get<bool>();
+  return value["task"].get<std::string>();
+}
+
+// read the resources of a "protected" field:
+//  true, "name", "name:capacity", {"name": "xxx", "capacity": n} or an array of them
+inline std::vector<resource> get_resources(const json& value)
+{
+  std::vector<resource> resources;
+  auto add = [&](const json& v) -> void {
+    if (v.is_boolean())
+    {
+      if (v.get<bool>())
+        resources.push_back(resource{ g_default_resource, 1 });
+    }
+    else if (v.is_string())
+      resources.push_back(parse_resource(v.get<std::string>()));
+    else if (v.is_object() && v.contains("name") && v["name"].is_string())
+    {
+      if (v.contains("capacity") && !v["capacity"].is_number_unsigned())
+        throw std::runtime_error(fmt::format("invalid resource capacity: {}", v.dump()));
+      const std::size_t capacity = v.contains("capacity") ? v["capacity"].get<std::size_t>() : 1;
+      resources.push_back(parse_resource(fmt::format("{}:{}", v["name"].get<std::string>(), capacity)));
+    }
+    else
+      throw std::runtime_error(fmt::format("invalid \"protected\" format: {}", v.dump()));
+  };
+  if (value.is_array())
+  {
+    for (const auto& v : value)
+      add(v);
+  }
+  else
+    add(value);
+  return resources;
+}
+
+// read the resources of the "protected" command-line variable: "true" or a list of "name:capacity" separated by ','
+inline std::vector<resource> get_resources(const var_env& vars)
+{
+  std::vector<resource> resources;
+  const std::string* value = vars.find("protected");
+  if (!value || value->empty() || (*value == "false"))
+    return resources;
+  if (*value == "true")
+    return { resource{ g_default_resource, 1 } };
+  std::size_t start = 0;
+  while (start <= value->size())
+  {
+    const std::size_t end = std::min(value->find(',', start), value->size());
+    resources.push_back(parse_resource(value->substr(start, end - start)));
+    start = end + 1;
+  }
+  return resources;
+}
+
+// build the execution graph of the tasks
+//  - without any "depends-on" field: each task depends on the previous one (sequential execution)
+//  - otherwise: tasks only depend on the tasks/groups listed in their "depends-on" fields
+inline std::vector<task_node> build_tasks_graph(const json& tasks_groups)
+{
+  // create one node per task and register the identifiers of groups and tasks
+  std::vector<task_node> nodes;
+  std::vector<std::vector<std::string>> depends_on;
+  std::vector<std::tuple<std::size_t, std::string, bool, bool>> pipes;
+  std::map<std::string, std::vector<std::size_t>> ids;
+  bool has_deps = false;
+  for (std::size_t g = 0; g < tasks_groups.size(); ++g)
+  {
+    const json& tasks_group = tasks_groups[g];
+    const std::size_t first = nodes.size();
+    for (const auto& task : tasks_group["tasks"])
+    {
+      auto get_paths = [&](const std::string& field) -> std::vector<var_template> {
+        std::vector<var_template> paths;
+        if (!task.contains(field))
+          return paths;
+        if (!task[field].is_array())
+          throw std::runtime_error(fmt::format("invalid \"{}\" format (array of strings expected)", field));
+        for (const auto& p : task[field])
+        {
+          if (!p.is_string())
+            throw std::runtime_error(fmt::format("invalid \"{}\" format (array of strings expected)", field));
+          paths.emplace_back(p.get<std::string>());
+        }
+        return paths;
+      };
+      task_node node;
+      node.group_idx = g;
+      node.flags = get_task_flags(tasks_group, task);
+      node.limits = get_process_limits(tasks_group, task, node.cpus);
+      node.description = var_template(task["description"].get<std::string>());
+      node.cmd = var_template(task["cmd"].get<std::string>());
+      node.args = var_template(task["args"].get<std::string>());
+      if (task.contains("variables"))
+        for (const auto& var : task["variables"])
+          for (const auto& [key, value] : var.items())
+            node.variables.emplace_back(key, var_template(value.get<std::string>()));
+      node.parse_variables = get_parse_variables(task);
+      if (task.contains("output-variable"))
+      {
+        if (!task["output-variable"].is_string() || task["output-variable"].get<std::string>().empty())
+          throw std::runtime_error(fmt::format("invalid \"output-variable\" format (string expected): {}", task["output-variable"].dump()));
+        node.output_variable = task["output-variable"].get<std::string>();
+      }
+      node.foreach = get_foreach(task);
+      node.inputs = get_paths("inputs");
+      node.outputs = get_paths("outputs");
+      node.key = task.contains("id") ? task["id"].dump() : fmt::format("{}.{}", g, nodes.size() - first);
+      if (task.contains("protected"))
+        node.resources = get_resources(task["protected"]);
+      if (tasks_group.contains("flags") && tasks_group["flags"].is_object() && tasks_group["flags"].contains("protected"))
+        node.group_resources = get_resources(tasks_group["flags"]["protected"]);
+      if (task.contains("id"))
+      {
+        if (!task["id"].is_string() || ids.find(task["id"].get<std::string>()) != ids.end())
+          throw std::runtime_error(fmt::format("invalid or duplicated task id: {}", task["id"].dump()));
+        ids[task["id"].get<std::string>()] = { nodes.size() };
+        node.id = task["id"].get<std::string>();
+      }
+      has_deps |= task.contains("depends-on");
+      std::vector<std::string> deps = get_depends_on(tasks_group);
+      for (auto& d : get_depends_on(task))
+        deps.push_back(std::move(d));
+      depends_on.push_back(std::move(deps));
+      bool pipe_stderr;
+      bool pipe_logs;
+      const std::string stdin_id = get_stdin(task, pipe_stderr, pipe_logs);
+      if (!stdin_id.empty())
+        pipes.emplace_back(nodes.size(), stdin_id, pipe_stderr, pipe_logs);
+      nodes.push_back(std::move(node));
+    }
+    if (tasks_group.contains("id"))
+    {
+      if (!tasks_group["id"].is_string() || ids.find(tasks_group["id"].get<std::string>()) != ids.end())
+        throw std::runtime_error(fmt::format("invalid or duplicated tasks-group id: {}", tasks_group["id"].dump()));
+      std::vector<std::size_t>& group_ids = ids[tasks_group["id"].get<std::string>()];
+      for (std::size_t i = first; i < nodes.size(); ++i)
+        group_ids.push_back(i);
+    }
+    has_deps |= tasks_group.contains("depends-on");
+  }
+
+  // a resource must always be declared with the same capacity
+  std::map<std::string, std::size_t> capacities;
+  for (const auto& node : nodes)
+  {
+    for (const auto& resources : { node.resources, node.group_resources })
+    {
+      for (const auto& r : resources)
+      {
+        const auto& [it, inserted] = capacities.emplace(r.name, r.capacity);
+        if (!inserted && (it->second != r.capacity))
+          throw std::runtime_error(fmt::format("resource \"{}\" declared with different capacities: {} and {}", r.name, it->second, r.capacity));
+      }
+    }
+  }
+
+  // resolve the dependencies of each task
+  auto add_deps = [&](task_node& node, const std::vector<std::string>& deps) -> void {
+    for (const auto& id : deps)
+    {
+      const auto& it = ids.find(id);
+      if (it == ids.end())
+        throw std::runtime_error(fmt::format("unknown dependency: \"{}\"", id));
+      for (const auto& d : it->second)
+      {
+        if (&nodes[d] == &node)
+          throw std::runtime_error(fmt::format("task depends on itself: \"{}\"", id));
+        if (std::find(node.deps.begin(), node.deps.end(), d) == node.deps.end())
+          node.deps.push_back(d);
+      }
+    }
+  };
+  for (std::size_t i = 0; i < nodes.size(); ++i)
+  {
+    if (!has_deps)
+    {
+      if (i > 0)
+        nodes[i].deps.push_back(i - 1);
+      continue;
+    }
+    add_deps(nodes[i], depends_on[i]);
+  }
+
+  // connect the pipelines: the output of a task is piped to a single task
+#ifdef _WIN32
+  if (!pipes.empty())
+    throw std::runtime_error("pipelines are not supported on Windows");
+#endif
+  for (const auto& [i, id, pipe_stderr, pipe_logs] : pipes)
+  {
+    const auto& it = ids.find(id);
+    if ((it == ids.end()) || (it->second.size() != 1) || (nodes[it->second.front()].id != id))
+      throw std::runtime_error(fmt::format("unknown \"stdin\" task: \"{}\"", id));
+    const std::size_t p = it->second.front();
+    if (p == i)
+      throw std::runtime_error(fmt::format("task reads its own output: \"{}\"", id));
+    if (nodes[p].foreach || nodes[i].foreach)
+      throw std::runtime_error(fmt::format("a \"foreach\" task can't be part of a pipeline: \"{}\"", id));
+    if (nodes[p].stdout_task)
+      throw std::runtime_error(fmt::format("output of the task already piped: \"{}\"", id));
+    nodes[p].stdout_task = i;
+    nodes[p].pipe_stderr = pipe_stderr;
+    nodes[p].pipe_logs = pipe_logs;
+    nodes[i].stdin_task = p;
+  }
+
+  // a protected group holds the lock during all its tasks execution:
+  //  its tasks can't start before all the external dependencies of the group are completed
+  for (std::size_t g = 0; has_deps && (g < tasks_groups.size()); ++g)
+  {
+    const auto& it = std::find_if(nodes.begin(), nodes.end(), [&](const task_node& n) { return n.group_idx == g; });
+    if ((it == nodes.end()) || it->group_resources.empty())
+      continue;
+    std::vector<std::size_t> externals;
+    for (const auto& node : nodes)
+      if (node.group_idx == g)
+        for (const auto& d : node.deps)
+          if ((nodes[d].group_idx != g) && (std::find(externals.begin(), externals.end(), d) == externals.end()))
+            externals.push_back(d);
+    for (auto& node : nodes)
+      if (node.group_idx == g)
+        for (const auto& d : externals)
+          if (std::find(node.deps.begin(), node.deps.end(), d) == node.deps.end())
+            node.waits.push_back(d);
+  }
+
+  // a pipeline is started by its first task: the tasks reading a pipe are executed at the same time as their source
+  //  their dependencies must be completed before the first task of the pipeline starts
+  for (std::size_t i = 0; i < nodes.size(); ++i)
+  {
+    if (!nodes[i].stdin_task)
+      continue;
+    std::vector<std::size_t> upstream;
+    for (auto t = nodes[i].stdin_task; t; t = nodes[*t].stdin_task)
+    {
+      if (*t == i)
+        throw std::runtime_error("circular pipeline detected between tasks");
+      upstream.push_back(*t);
+    }
+    task_node& head = nodes[upstream.back()];
+    auto is_upstream = [&](const std::size_t d) { return std::find(upstream.begin(), upstream.end(), d) != upstream.end(); };
+    nodes[i].deps.erase(std::remove_if(nodes[i].deps.begin(), nodes[i].deps.end(), is_upstream), nodes[i].deps.end());
+    nodes[i].waits.erase(std::remove_if(nodes[i].waits.begin(), nodes[i].waits.end(), is_upstream), nodes[i].waits.end());
+    for (const auto& d : head.deps)
+      if (std::find(nodes[i].deps.begin(), nodes[i].deps.end(), d) == nodes[i].deps.end())
+        nodes[i].deps.push_back(d);
+    for (const auto& list : { nodes[i].deps, nodes[i].waits })
+      for (const auto& d : list)
+        if ((&nodes[d] != &head) &&
+            (std::find(head.deps.begin(), head.deps.end(), d) == head.deps.end()) &&
+            (std::find(head.waits.begin(), head.waits.end(), d) == head.waits.end()))
+          head.waits.push_back(d);
+    nodes[i].waits.clear();
+  }
+
+  // link the nodes and check that the graph has no cycle
+  //  the tasks reading a pipe are not scheduled: they are started with their source
+  for (std::size_t i = 0; i < nodes.size(); ++i)
+  {
+    if (nodes[i].stdin_task)
+      continue;
+    nodes[i].pending = nodes[i].deps.size() + nodes[i].waits.size();
+    for (const auto& d : nodes[i].deps)
+      nodes[d].next.push_back(i);
+    for (const auto& d : nodes[i].waits)
+      nodes[d].next.push_back(i);
+  }
+  std::vector<std::size_t> pending(nodes.size());
+  std::vector<std::size_t> ready;
+  for (std::size_t i = 0; i < nodes.size(); ++i)
+  {
+    pending[i] = nodes[i].stdin_task ? 1 : nodes[i].pending;
+    if (!pending[i])
+      ready.push_back(i);
+  }
+  std::size_t sorted = 0;
+  while (!ready.empty())
+  {
+    const std::size_t i = ready.back();
+    ready.pop_back();
+    ++sorted;
+    for (const auto& n : nodes[i].next)
+      if (--pending[n] == 0)
+        ready.push_back(n);
+    if (nodes[i].stdout_task && (--pending[*nodes[i].stdout_task] == 0))
+      ready.push_back(*nodes[i].stdout_task);
+  }
+  if (sorted != nodes.size())
+    throw std::runtime_error("circular dependency detected between tasks");
+
+  return nodes;
+}
+
+// check the format of a tasks json file
+inline void check_tasks_file(const json& db, const std::filesystem::path& path)
+{
+  if((!db.contains("description")  || !db["description"].is_string()) ||
+     (!db.contains("variables")    || !db["variables"].is_array())    ||
+     (!db.contains("tasks-groups") || !db["tasks-groups"].is_array()))
+    throw std::runtime_error(fmt::format("invalid tasks file format: \"{}\"", path.filename().u8string()));
+  for (const auto& tasks_groups : db["tasks-groups"])
+  {
+    if((!tasks_groups.contains("tasks") || !tasks_groups["tasks"].is_array()))
+      throw std::runtime_error(fmt::format("invalid tasks file format: \"{}\" (incorrect tasks group format)", path.filename().u8string()));
+    for (const auto& task : tasks_groups["tasks"])
+    {
+      if ((!task.contains("description") || !task["description"].is_string()) ||
+          (!task.contains("cmd")         || !task["cmd"].is_string())         ||
+          (!task.contains("args")        || !task["args"].is_string()))
+        throw std::runtime_error(fmt::format("invalid tasks file format: \"{}\" (incorrect task format)", path.filename().u8string()));
+    }
+  }
+}
+
+// parse tasks json file and check its format
+inline json load_tasks_file(const std::filesystem::path& path)
+{
+  std::ifstream file(path);
+  if (!file.good())
+    throw std::runtime_error(fmt::format("can't open file: \"{}\"", path.filename().u8string()));
+  json db = json::parse(file);
+  check_tasks_file(db, path);
+  return db;
+}
+
+// expand the variables of a tasks file: a value can use the command-line variables and the previous variables of the file
+//  the command-line variables are only overridden while the variables of the file are expanded
+inline var_map get_json_variables(const json& db, const var_map& variables)
+{
+  var_map json_vars;
+  for (const auto& v : db["variables"])
+    for (const auto& [key, value] : v.items())
+      json_vars.set(key, update_var(value.get<std::string>(), var_env().push(variables).push(json_vars)));
+  return json_vars;
+}
+
+// parse tasks json file and expand its variables
+inline std::pair<json, var_map> parse_json(const std::filesystem::path& path, const var_map& variables)
+{
+  json db = load_tasks_file(path);
+  var_map json_vars = get_json_variables(db, variables);
+  return std::pair<json, var_map>(std::move(db), std::move(json_vars));
+}
+
+// execute one task - blocking
+//  the logs are forwarded as they are received
+//  the pipes of a pipeline are given to the process runner (closed once the process is started)
+//  the cores, priority and limits are applied to the process when it is started
+//  the deadlines are handled by the watchdog: without watchdog, only the timeout is applied (by the runner)
+//  the process, its output and its resources are reported to the metrics of the task - if any
+inline void execute_task(const std::string& cmd,
+                         const std::string& args,
+                         const std::function<void(const std::string&)>& cb_output,
+                         const bool ignore_error,
+                         const watch_options& deadlines,
+                         process_stats& stats,
+                         process_pipes pipes = process_pipes(),
+                         const process_limits& limits = process_limits(),
+                         watchdog* dog = nullptr,
+                         task_metrics::task* metrics = nullptr)
+{
+  // the tasks are not started anymore once the execution is cancelled
+  if (dog && dog->cancelled())
+    throw std::runtime_error("process not started: interrupted by the user");
+
+  // start process and wait for its termination
+  process_options options;
+  options.cmd = cmd;
+  options.args = args;
+  options.working_dir = std::filesystem::current_path();
+  options.pipes = pipes;
+  options.limits = limits;
+  std::unique_ptr<process_runner> runner = create_process_runner();
+
+  // the winpp process is only stopped by its own timeout
+  //  the idle timeout is ignored when the output is not read by AutoLaunch (piped to the next task)
+  watch_options watched = deadlines;
+#ifdef _WIN32
+  options.timeout = deadlines.timeout;
+  watched.timeout = watched.idle_timeout = std::chrono::milliseconds(0);
+#else
+  if (!dog)
+    options.timeout = deadlines.timeout;
+#endif
+  if ((pipes.out != -1) && !pipes.tee)
+    watched.idle_timeout = std::chrono::milliseconds(0);
+  std::optional<watchdog::watch> watch;
+  if (dog)
+    watch.emplace(*dog, *runner, watched);
+  auto cb_logs = [&](const std::string& logs) -> void {
+    if (watch)
+      watch->touch();
+    if (metrics)
+      metrics->output(logs.size());
+    cb_output(logs);
+  };
+  auto terminated = [&]() -> void {
+    stats = runner->stats();
+    if (metrics)
+    {
+      metrics->attach(nullptr);
+      metrics->process(stats);
+    }
+  };
+
+  int exit_code;
+  if (metrics)
+    metrics->attach(runner.get());
+  try
+  {
+    exit_code = runner->execute(options, cb_logs);
+    terminated();
+  }
+  catch (...)
+  {
+    terminated();
+    throw;
+  }
+  const std::string reason = watch ? watch->reason() : std::string();
+  if (!reason.empty() && (watch->cancelled() || !ignore_error))
+    throw std::runtime_error(fmt::format("process stopped: {}", reason));
+  if (!ignore_error && exit_code != 0)
+    throw std::runtime_error(fmt::format("process failed with error: {}", exit_code));
+}
+
+// execute the batches of items of a "foreach" task with up to "jobs" threads - blocking
+//  the batches are executed by order: no batch is started after the first error
+//  the error of the first failed batch is thrown once all the started batches are terminated
+inline void execute_batches(const std::size_t count,
+                            const std::size_t jobs,
+                            const std::function<void(std::size_t)>& execute)
+{
+  std::atomic<std::size_t> next = 0;
+  std::atomic<bool> failed = false;
+  std::mutex mtx;
+  std::exception_ptr error;
+  auto worker = [&]() -> void {
+    for (std::size_t i = next++; (i < count) && !failed; i = next++)
+    {
+      try
+      {
+        execute(i);
+      }
+      catch (...)
+      {
+        std::lock_guard<std::mutex> lck(mtx);
+        if (!error)
+          error = std::current_exception();
+        failed = true;
+      }
+    }
+  };
+  std::vector<std::thread> threads;
+  for (std::size_t t = 1; t < std::min(jobs, count); ++t)
+    threads.emplace_back(worker);
+  worker();
+  for (auto& t : threads)
+    t.join();
+  if (error)
+    std::rethrow_exception(error);
+}
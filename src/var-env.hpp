@@ -0,0 +1,312 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <optional>
+#include <unordered_map>
+#include <cstdint>
+
+/*============================================
+| Declaration
+==============================================*/
+// interned name of a variable: index in the table of the names
+using var_symbol = std::uint32_t;
+
+// table of the interned variable names - shared by all the tasks files of the program
+//  a name keeps its symbol until the end of the program: the symbols are resolved once by the compiled templates
+class var_symbols
+{
+public:
+  // get the symbol of a name - added if unknown
+  static var_symbol intern(const std::string& name);
+
+  // get the symbol of a name - none if never interned
+  static std::optional<var_symbol> find(const std::string& name);
+
+  // get the name of a symbol
+  static const std::string& name(const var_symbol symbol);
+
+private:
+  static var_symbols& instance();
+
+  std::shared_mutex m_mtx;
+  std::unordered_map<std::string, var_symbol> m_symbols;
+  std::deque<std::string> m_names;
+};
+
+// immutable map of variables: persistent trie indexed by the bits of the symbols (32 slots per level)
+//  a copy is a snapshot sharing all the nodes: a modification only copies the nodes of its path
+class var_map
+{
+public:
+  // get the value of a variable - null if not defined
+  const std::string* find(const var_symbol symbol) const;
+
+  // define a variable
+  void set(const var_symbol symbol, std::string value);
+  void set(const std::string& name, std::string value) { set(var_symbols::intern(name), std::move(value)); }
+
+  // add the variables of another map: its values override the current ones
+  //  the nodes shared by the two maps are not visited
+  void merge(const var_map& other);
+
+  // call f(symbol, value) for each variable - by order of symbol
+  template <typename F>
+  void for_each(F&& f) const;
+
+  bool empty() const { return !m_root; }
+
+private:
+  struct node
+  {
+    std::uint32_t bitmap = 0;                                 // slots used by the node
+    std::vector<std::shared_ptr<const node>> children;        // inner node: one child per used slot
+    std::vector<std::shared_ptr<const std::string>> values;   // leaf node: one value per used slot
+  };
+  using node_ptr = std::shared_ptr<const node>;
+  static constexpr unsigned g_bits = 5;
+
+  // add levels at the top of the trie until it contains the given number of levels
+  void grow(const unsigned levels);
+
+  static unsigned slot(const var_symbol symbol, const unsigned level) { return (symbol >> (level * g_bits)) & 31u; }
+  static unsigned index(const std::uint32_t bitmap, const unsigned slot);
+  static node_ptr set(const node_ptr& n, const unsigned level, const var_symbol symbol, std::shared_ptr<const std::string> value);
+  static node_ptr merge(const node_ptr& a, const node_ptr& b, const unsigned level);
+  template <typename F>
+  static void for_each(const node& n, const unsigned level, const var_symbol prefix, F& f);
+
+private:
+  node_ptr m_root;
+  unsigned m_levels = 1;                                      // the trie contains the symbols below 32^levels
+};
+
+// scoped variables: the variables are searched from the innermost scope to the outermost one
+//  a copy is a consistent snapshot of all the scopes (the maps are shared)
+class var_env
+{
+public:
+  var_env() = default;
+
+  // snapshot of the environment with a new innermost scope
+  var_env push(const var_map& scope) const;
+
+  // get the value of a variable - null if not defined
+  const std::string* find(const var_symbol symbol) const;
+  const std::string* find(const std::string& name) const;
+
+  // define a variable in the innermost scope
+  void set(const var_symbol symbol, std::string value);
+  void set(const std::string& name, std::string value) { set(var_symbols::intern(name), std::move(value)); }
+
+private:
+  std::vector<var_map> m_scopes;                              // from the outermost scope to the innermost one
+};
+
+/*============================================
+| Definition
+==============================================*/
+inline var_symbols& var_symbols::instance()
+{
+  static var_symbols symbols;
+  return symbols;
+}
+
+inline var_symbol var_symbols::intern(const std::string& name)
+{
+  var_symbols& s = instance();
+  {
+    std::shared_lock<std::shared_mutex> lck(s.m_mtx);
+    const auto& it = s.m_symbols.find(name);
+    if (it != s.m_symbols.end())
+      return it->second;
+  }
+  std::unique_lock<std::shared_mutex> lck(s.m_mtx);
+  const auto& [it, inserted] = s.m_symbols.emplace(name, static_cast<var_symbol>(s.m_names.size()));
+  if (inserted)
+    s.m_names.push_back(name);
+  return it->second;
+}
+
+inline std::optional<var_symbol> var_symbols::find(const std::string& name)
+{
+  var_symbols& s = instance();
+  std::shared_lock<std::shared_mutex> lck(s.m_mtx);
+  const auto& it = s.m_symbols.find(name);
+  if (it == s.m_symbols.end())
+    return std::nullopt;
+  return it->second;
+}
+
+inline const std::string& var_symbols::name(const var_symbol symbol)
+{
+  var_symbols& s = instance();
+  std::shared_lock<std::shared_mutex> lck(s.m_mtx);
+  return s.m_names.at(symbol);
+}
+
+inline unsigned var_map::index(const std::uint32_t bitmap, const unsigned slot)
+{
+  // number of used slots before the given one
+  std::uint32_t v = bitmap & ((1u << slot) - 1u);
+  v = v - ((v >> 1) & 0x55555555u);
+  v = (v & 0x33333333u) + ((v >> 2) & 0x33333333u);
+  return (((v + (v >> 4)) & 0x0F0F0F0Fu) * 0x01010101u) >> 24;
+}
+
+inline const std::string* var_map::find(const var_symbol symbol) const
+{
+  if ((static_cast<std::uint64_t>(symbol) >> (m_levels * g_bits)) != 0)
+    return nullptr;
+  const node* n = m_root.get();
+  for (unsigned level = m_levels - 1; n; --level)
+  {
+    const unsigned s = slot(symbol, level);
+    if (!(n->bitmap & (1u << s)))
+      return nullptr;
+    if (!level)
+      return n->values[index(n->bitmap, s)].get();
+    n = n->children[index(n->bitmap, s)].get();
+  }
+  return nullptr;
+}
+
+inline void var_map::grow(const unsigned levels)
+{
+  while (m_levels < levels)
+  {
+    if (m_root)
+    {
+      auto n = std::make_shared<node>();
+      n->bitmap = 1;
+      n->children.push_back(std::move(m_root));
+      m_root = std::move(n);
+    }
+    ++m_levels;
+  }
+}
+
+inline void var_map::set(const var_symbol symbol, std::string value)
+{
+  unsigned levels = 1;
+  while ((static_cast<std::uint64_t>(symbol) >> (levels * g_bits)) != 0)
+    ++levels;
+  grow(levels);
+  m_root = set(m_root, m_levels - 1, symbol, std::make_shared<const std::string>(std::move(value)));
+}
+
+inline var_map::node_ptr var_map::set(const node_ptr& n,
+                                      const unsigned level,
+                                      const var_symbol symbol,
+                                      std::shared_ptr<const std::string> value)
+{
+  auto copy = n ? std::make_shared<node>(*n) : std::make_shared<node>();
+  const unsigned s = slot(symbol, level);
+  const unsigned i = index(copy->bitmap, s);
+  const bool used = (copy->bitmap & (1u << s)) != 0;
+  copy->bitmap |= (1u << s);
+  if (!level)
+  {
+    if (used)
+      copy->values[i] = std::move(value);
+    else
+      copy->values.insert(copy->values.begin() + i, std::move(value));
+  }
+  else
+  {
+    if (used)
+      copy->children[i] = set(copy->children[i], level - 1, symbol, std::move(value));
+    else
+      copy->children.insert(copy->children.begin() + i, set(nullptr, level - 1, symbol, std::move(value)));
+  }
+  return copy;
+}
+
+inline void var_map::merge(const var_map& other)
+{
+  if (!other.m_root)
+    return;
+  var_map b = other;
+  grow(b.m_levels);
+  b.grow(m_levels);
+  m_root = merge(m_root, b.m_root, m_levels - 1);
+}
+
+inline var_map::node_ptr var_map::merge(const node_ptr& a, const node_ptr& b, const unsigned level)
+{
+  if (!a || (a == b))
+    return b;
+  if (!b)
+    return a;
+  auto n = std::make_shared<node>();
+  n->bitmap = a->bitmap | b->bitmap;
+  for (unsigned s = 0; s < 32; ++s)
+  {
+    const std::uint32_t bit = 1u << s;
+    if (!(n->bitmap & bit))
+      continue;
+    const bool in_a = (a->bitmap & bit) != 0;
+    const bool in_b = (b->bitmap & bit) != 0;
+    if (!level)
+      n->values.push_back(in_b ? b->values[index(b->bitmap, s)] : a->values[index(a->bitmap, s)]);
+    else
+      n->children.push_back(merge(in_a ? a->children[index(a->bitmap, s)] : nullptr,
+                                  in_b ? b->children[index(b->bitmap, s)] : nullptr,
+                                  level - 1));
+  }
+  return n;
+}
+
+template <typename F>
+inline void var_map::for_each(F&& f) const
+{
+  if (m_root)
+    for_each(*m_root, m_levels - 1, 0, f);
+}
+
+template <typename F>
+inline void var_map::for_each(const node& n, const unsigned level, const var_symbol prefix, F& f)
+{
+  std::size_t i = 0;
+  for (unsigned s = 0; s < 32; ++s)
+  {
+    if (!(n.bitmap & (1u << s)))
+      continue;
+    const var_symbol symbol = prefix | (static_cast<var_symbol>(s) << (level * g_bits));
+    if (!level)
+      f(symbol, *n.values[i++]);
+    else
+      for_each(*n.children[i++], level - 1, symbol, f);
+  }
+}
+
+inline var_env var_env::push(const var_map& scope) const
+{
+  var_env env = *this;
+  env.m_scopes.push_back(scope);
+  return env;
+}
+
+inline const std::string* var_env::find(const var_symbol symbol) const
+{
+  for (auto it = m_scopes.rbegin(); it != m_scopes.rend(); ++it)
+    if (const std::string* value = it->find(symbol))
+      return value;
+  return nullptr;
+}
+
+inline const std::string* var_env::find(const std::string& name) const
+{
+  const std::optional<var_symbol> symbol = var_symbols::find(name);
+  return symbol ? find(*symbol) : nullptr;
+}
+
+inline void var_env::set(const var_symbol symbol, std::string value)
+{
+  if (m_scopes.empty())
+    m_scopes.emplace_back();
+  m_scopes.back().set(symbol, std::move(value));
+}
@@ -0,0 +1,344 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <filesystem>
+#include <algorithm>
+#include <stdexcept>
+#include <fmt/core.h>
+#include "var-env.hpp"
+#ifdef _WIN32
+#include <winpp/win.hpp>
+#else
+#include "posix-compat.hpp"
+#endif
+
+/*============================================
+| Declaration
+==============================================*/
+// string containing variables compiled once and rendered in a single pass
+//  ${xxx}           => replaced by the value of the variable xxx
+//  ${xxx, 'a', 'b'} => replaced by the value of the variable xxx with all 'a' characters converted to 'b'
+//  $[xxx]           => replaced by the absolute path of xxx surrounded by double-quotes
+//  $<xxx>           => replaced by the absolute path of xxx surrounded by single-quotes
+// the names of the variables are interned when the template is compiled: no string compare when rendered
+// the variables and paths contained in the value of a variable are expanded too (up to g_max_var_depth levels)
+class var_template
+{
+public:
+  var_template() = default;
+  explicit var_template(const std::string& str);
+
+  // get the original string
+  const std::string& str() const { return m_str; }
+
+  // check if the string contains variables or paths to replace
+  bool is_constant() const { return m_constant; }
+
+  // replace all the variables and paths of the string
+  std::string render(const var_env& variables) const;
+
+  // write/read the compiled template in a binary stream - used by the compiled tasks plans
+  template <typename Writer>
+  void save(Writer& writer) const;
+  template <typename Reader>
+  static var_template load(Reader& reader);
+
+private:
+  enum class segment_type { text, var, path, error };
+  struct segment
+  {
+    segment() = default;
+    explicit segment(const segment_type t, std::string v = {}) : type(t), value(std::move(v)) {}
+
+    segment_type type = segment_type::text;
+    std::string value;                  // text, variable name or error message
+    var_symbol symbol = 0;              // interned variable name
+    char old_char = 0;                  // character to replace in variable value
+    char new_char = 0;                  // replacement character in variable value
+    char quote = 0;                     // quote surrounding absolute path
+    std::vector<segment> children;      // content of the path
+  };
+
+  // parse a string into segments - stop at one of the end characters
+  static std::size_t parse(const std::string& str,
+                           std::size_t pos,
+                           const std::string& end,
+                           const bool parse_paths,
+                           std::vector<segment>& segments);
+
+  // parse a variable starting at pos (just after "${")
+  static bool parse_var(const std::string& str, std::size_t& pos, segment& seg);
+
+  // append the rendered segments to the output string - depth: level of the value of a variable being expanded
+  //  return true if an absolute path has been rendered
+  static bool render(const std::vector<segment>& segments,
+                     const var_env& variables,
+                     std::string& out,
+                     const std::size_t depth);
+
+  // write/read a list of segments
+  template <typename Writer>
+  static void save(Writer& writer, const std::vector<segment>& segments);
+  template <typename Reader>
+  static void load(Reader& reader, std::vector<segment>& segments);
+
+private:
+  std::string m_str;
+  std::vector<segment> m_segments;
+  bool m_constant = true;
+};
+
+// maximum levels of variables expanded in the values of the variables - a deeper one is an endless reference
+constexpr std::size_t g_max_var_depth = 32;
+
+/*============================================
+| Definition
+==============================================*/
+inline var_template::var_template(const std::string& str) :
+  m_str(str)
+{
+  parse(m_str, 0, "", true, m_segments);
+  m_constant = std::all_of(m_segments.begin(), m_segments.end(), [](const segment& s) { return s.type == segment_type::text; });
+}
+
+inline std::size_t var_template::parse(const std::string& str,
+                                       std::size_t pos,
+                                       const std::string& end,
+                                       const bool parse_paths,
+                                       std::vector<segment>& segments)
+{
+  auto add_text = [&](const std::string& text) -> void {
+    if (text.empty())
+      return;
+    if (!segments.empty() && (segments.back().type == segment_type::text))
+      segments.back().value += text;
+    else
+      segments.push_back(segment(segment_type::text, text));
+  };
+
+  std::size_t start = pos;
+  while (pos < str.size())
+  {
+    if (!end.empty() && (end.find(str[pos]) != std::string::npos))
+      break;
+    if ((str[pos] != '$') || (pos + 1 >= str.size()))
+    {
+      ++pos;
+      continue;
+    }
+
+    // variable: ${xxx} or ${xxx, 'a', 'b'}
+    const char next = str[pos + 1];
+    if (next == '{')
+    {
+      segment seg;
+      std::size_t var_pos = pos + 2;
+      if (!parse_var(str, var_pos, seg))
+      {
+        ++pos;
+        continue;
+      }
+      add_text(str.substr(start, pos - start));
+      segments.push_back(std::move(seg));
+      pos = start = var_pos;
+    }
+    // absolute path: $[xxx] or $<xxx>
+    else if (parse_paths && ((next == '[') || (next == '<')))
+    {
+      segment seg(segment_type::path);
+      const std::size_t path_end = parse(str, pos + 2, "]>", false, seg.children);
+      if (path_end >= str.size())
+      {
+        ++pos;
+        continue;
+      }
+      add_text(str.substr(start, pos - start));
+      if ((next == '[') && (str[path_end] == ']'))
+        seg.quote = '\"';
+      else if ((next == '<') && (str[path_end] == '>'))
+        seg.quote = '\'';
+      else
+        seg = segment(segment_type::error, fmt::format("wrong pattern detected: \"{}\"", str.substr(pos, path_end + 1 - pos)));
+      segments.push_back(std::move(seg));
+      pos = start = path_end + 1;
+    }
+    else
+      ++pos;
+  }
+  add_text(str.substr(start, pos - start));
+  return pos;
+}
+
+inline bool var_template::parse_var(const std::string& str, std::size_t& pos, segment& seg)
+{
+  // variable with character replacement: ${xxx, 'a', 'b'}
+  auto parse_replace = [&](std::size_t p) -> bool {
+    const std::size_t key_end = str.find_first_of(",}", p);
+    if ((key_end == std::string::npos) || (key_end == p) || (str[key_end] != ','))
+      return false;
+    auto parse_char = [&](std::size_t& i, char& c) -> bool {
+      if ((i + 3 >= str.size()) || (str[i] == '\'') || (str[i + 1] != '\'') || (str[i + 3] != '\''))
+        return false;
+      c = str[i + 2];
+      i += 4;
+      return true;
+    };
+    std::size_t i = key_end + 1;
+    char old_char;
+    char new_char;
+    if (!parse_char(i, old_char) || (i >= str.size()) || (str[i++] != ',') ||
+        !parse_char(i, new_char) || (i >= str.size()) || (str[i++] != '}'))
+      return false;
+    seg = segment(segment_type::var, str.substr(p, key_end - p));
+    seg.old_char = old_char;
+    seg.new_char = new_char;
+    seg.symbol = var_symbols::intern(seg.value);
+    pos = i;
+    return true;
+  };
+  if (parse_replace(pos))
+    return true;
+
+  // simple variable: ${xxx}
+  const std::size_t key_end = str.find_first_of("}\r\n", pos);
+  if ((key_end == std::string::npos) || (str[key_end] != '}'))
+    return false;
+  seg = segment(segment_type::var, str.substr(pos, key_end - pos));
+  seg.symbol = var_symbols::intern(seg.value);
+  pos = key_end + 1;
+  return true;
+}
+
+inline bool var_template::render(const std::vector<segment>& segments,
+                                 const var_env& variables,
+                                 std::string& out,
+                                 const std::size_t depth)
+{
+  bool has_path = false;
+  for (const auto& seg : segments)
+  {
+    switch (seg.type)
+    {
+    case segment_type::text:
+      out += seg.value;
+      break;
+
+    case segment_type::var:
+    {
+      const std::string* value = variables.find(seg.symbol);
+      if (!value)
+        throw std::runtime_error(fmt::format("missing variable: ${{{}}}", seg.value));
+      std::string replaced;
+      if (seg.old_char != 0 && seg.new_char != 0)
+      {
+        replaced = *value;
+        std::replace(replaced.begin(), replaced.end(), seg.old_char, seg.new_char);
+        value = &replaced;
+      }
+
+      // the value can contain other variables or paths: compiled and rendered in place
+      if (value->find('$') == std::string::npos)
+      {
+        out += *value;
+        break;
+      }
+      if (depth >= g_max_var_depth)
+        throw std::runtime_error(fmt::format("this pattern can't be replaced: \"{}\"", *value));
+      std::vector<segment> children;
+      parse(*value, 0, "", true, children);
+      has_path |= render(children, variables, out, depth + 1);
+      break;
+    }
+
+    case segment_type::path:
+    {
+      std::string path;
+      render(seg.children, variables, path, depth);
+      path.erase(std::remove(path.begin(), path.end(), '\"'), path.end());
+      path.erase(std::remove(path.begin(), path.end(), '\''), path.end());
+      out += seg.quote;
+      out += std::filesystem::absolute(std::filesystem::path(path)).string();
+      out += seg.quote;
+      has_path = true;
+      break;
+    }
+
+    case segment_type::error:
+      throw std::runtime_error(seg.value);
+    }
+  }
+  return has_path;
+}
+
+inline std::string var_template::render(const var_env& variables) const
+{
+  if (m_constant)
+    return m_str;
+  std::string out;
+  out.reserve(m_str.size() * 2);
+
+  // absolute paths are converted from utf-8
+  const bool has_path = render(m_segments, variables, out, 0);
+  return has_path ? utf8::from_utf8(out) : out;
+}
+
+template <typename Writer>
+inline void var_template::save(Writer& writer) const
+{
+  writer.write(m_str);
+  writer.write(static_cast<std::uint8_t>(m_constant));
+  if (!m_constant)
+    save(writer, m_segments);
+}
+
+template <typename Reader>
+inline var_template var_template::load(Reader& reader)
+{
+  var_template t;
+  t.m_str = reader.read_string();
+  t.m_constant = reader.read_u8() != 0;
+  if (t.m_constant)
+  {
+    if (!t.m_str.empty())
+      t.m_segments.emplace_back(segment_type::text, t.m_str);
+  }
+  else
+    load(reader, t.m_segments);
+  return t;
+}
+
+template <typename Writer>
+inline void var_template::save(Writer& writer, const std::vector<segment>& segments)
+{
+  writer.write(static_cast<std::uint64_t>(segments.size()));
+  for (const auto& seg : segments)
+  {
+    writer.write(static_cast<std::uint8_t>(seg.type));
+    writer.write(seg.value);
+    writer.write(static_cast<std::uint8_t>(seg.old_char));
+    writer.write(static_cast<std::uint8_t>(seg.new_char));
+    writer.write(static_cast<std::uint8_t>(seg.quote));
+    save(writer, seg.children);
+  }
+}
+
+template <typename Reader>
+inline void var_template::load(Reader& reader, std::vector<segment>& segments)
+{
+  segments.resize(reader.read_size());
+  for (auto& seg : segments)
+  {
+    const std::uint8_t type = reader.read_u8();
+    if (type > static_cast<std::uint8_t>(segment_type::error))
+      throw std::runtime_error("invalid compiled template");
+    seg.type = static_cast<segment_type>(type);
+    seg.value = reader.read_string();
+    if (seg.type == segment_type::var)
+      seg.symbol = var_symbols::intern(seg.value);
+    seg.old_char = static_cast<char>(reader.read_u8());
+    seg.new_char = static_cast<char>(reader.read_u8());
+    seg.quote = static_cast<char>(reader.read_u8());
+    load(reader, seg.children);
+  }
+}
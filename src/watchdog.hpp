@@ -0,0 +1,532 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <array>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <csignal>
+#include <functional>
+#include <stdexcept>
+#include <fmt/core.h>
+#include "process.hpp"
+#ifdef _WIN32
+#include <condition_variable>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+/*============================================
+| Declaration
+==============================================*/
+// default time between the polite signal and the hard kill of a process
+constexpr std::chrono::milliseconds g_kill_grace{ 5000 };
+
+// deadlines of a watched process - none if 0
+struct watch_options
+{
+  std::chrono::milliseconds timeout{ 0 };          // the process is stopped after this time
+  std::chrono::milliseconds idle_timeout{ 0 };     // the process is stopped after this time without output
+  std::chrono::milliseconds grace{ g_kill_grace }; // time between the polite signal and the hard kill
+  int signal = SIGTERM;                            // polite signal - the process is killed at once if 0
+};
+
+// get a signal from its name: "SIGTERM" or "TERM" - the hard kill ("SIGKILL") is returned as 0
+inline int parse_signal(const std::string& name);
+
+// hierarchical timer wheel: 4 levels of slots (256, 64, 64 and 64 ticks)
+//  a timer is added in O(1) and moved to the lower levels when its expiration gets closer
+//  the timers are identified by a value: a cancelled timer is ignored by its owner when it expires
+class timer_wheel
+{
+public:
+  // add a timer expiring at the given tick - at the next tick if it is already expired
+  void add(const std::uint64_t tick, const std::uint64_t value);
+
+  // advance to the given tick: f(value, tick) is called for each expired timer
+  template <typename F>
+  void advance(const std::uint64_t tick, F&& f);
+
+  // first tick where a timer can expire (or be moved from a higher level) - none if empty
+  std::uint64_t next_tick() const;
+
+  std::uint64_t now() const { return m_now; }
+  bool empty() const { return !m_count; }
+
+private:
+  struct timer
+  {
+    std::uint64_t tick;
+    std::uint64_t value;
+  };
+  static constexpr unsigned g_levels = 4;
+  static unsigned shift(const unsigned level) { return level ? 8 + 6 * (level - 1) : 0; }
+  static std::uint64_t mask(const unsigned level) { return level ? 63 : 255; }
+
+  // insert a timer in the slot of its level - expiring at the first tick if it is before
+  void insert(const timer& t, const std::uint64_t first);
+
+private:
+  std::array<std::array<std::vector<timer>, 256>, g_levels> m_slots;
+  std::uint64_t m_now = 0;
+  std::size_t m_count = 0;
+};
+
+// deadlines of all the running processes handled by a single thread
+//  an expired process receives its polite signal, then it is killed with its children after its grace period
+//  the idle timeouts are checked lazily: the output only updates the time of the last output of the process
+class watchdog
+{
+  struct entry;
+
+public:
+  using clock = std::chrono::steady_clock;
+
+  watchdog();
+  ~watchdog();
+
+  watchdog(const watchdog&) = delete;
+  watchdog& operator=(const watchdog&) = delete;
+
+  // registration of a running process - unregistered when destroyed
+  class watch
+  {
+  public:
+    watch(watchdog& dog, process_runner& runner, const watch_options& options);
+    ~watch();
+
+    watch(const watch&) = delete;
+    watch& operator=(const watch&) = delete;
+
+    // the process produced some output - can be called from any thread
+    void touch();
+
+    // reason of the stop of the process - empty if it was not stopped
+    std::string reason() const;
+
+    // the process was stopped by a cancellation (not by its deadlines)
+    bool cancelled() const;
+
+  private:
+    watchdog& m_dog;
+    std::uint64_t m_id;
+    entry* m_entry;
+  };
+
+  // stop all the running processes - the processes started later are stopped at once
+  void cancel(const std::string& reason);
+  bool cancelled() const { return m_cancelled; }
+
+  // cancel the execution from a signal handler (ctrl-c) - async-signal-safe
+  //  the second interruption kills all the processes without waiting for their grace period
+  void interrupt();
+
+  // function called by the watchdog thread after an interruption
+  void on_interrupt(const std::function<void()>& fct);
+
+private:
+  enum class stage { running, terminating, killed };
+  struct entry
+  {
+    // the entry is only erased by its watch: its address is stable (map)
+    process_runner* runner = nullptr;
+    watch_options options;
+    clock::time_point start;
+    std::atomic<clock::rep> last_output{ 0 };
+    stage state = stage::running;
+    std::uint64_t armed = 0;                       // tick of the pending timer - none if 0
+    std::string reason;
+    bool cancelled = false;
+  };
+
+  std::uint64_t to_tick(const clock::time_point& t) const;
+  clock::time_point to_time(const std::uint64_t tick) const;
+
+  // arm the timer of a process (locked) and wake up the thread if it sleeps longer
+  void arm(const std::uint64_t id, entry& e, const clock::time_point& t);
+
+  // send the polite signal (or the hard kill) of a process - locked
+  void escalate(const std::uint64_t id, entry& e, const std::string& reason, const bool cancelled, const bool kill);
+
+  // timer of a process expired - locked
+  void expire(const std::uint64_t id, const std::uint64_t tick);
+
+  // thread of the watchdog
+  void run();
+
+  // wake up the thread / wait for a wake up (or the timeout)
+  void wake();
+  void wait(const clock::time_point& until);
+
+private:
+  static constexpr std::chrono::milliseconds g_tick{ 10 };
+  static constexpr std::chrono::milliseconds g_kill_retry{ 1000 };
+  const clock::time_point m_origin;
+  mutable std::mutex m_mtx;
+  std::map<std::uint64_t, entry> m_entries;
+  std::uint64_t m_next_id = 1;
+  timer_wheel m_wheel;
+  clock::time_point m_sleep_until;
+  std::atomic<bool> m_cancelled{ false };
+  std::atomic<int> m_interrupts{ 0 };
+  int m_handled_interrupts = 0;
+  std::function<void()> m_on_interrupt;
+  bool m_stop = false;
+#ifdef _WIN32
+  std::mutex m_wake_mtx;
+  std::condition_variable m_cv;
+  bool m_woken = false;
+#else
+  int m_wake_fds[2] = { -1, -1 };
+#endif
+  std::thread m_thread;
+};
+
+/*============================================
+| Definition
+==============================================*/
+inline int parse_signal(const std::string& name)
+{
+  const std::string str = (name.rfind("SIG", 0) == 0) ? name.substr(3) : name;
+  if (str == "TERM")
+    return SIGTERM;
+  if (str == "INT")
+    return SIGINT;
+  if (str == "KILL")
+    return 0;
+#ifndef _WIN32
+  if (str == "HUP")
+    return SIGHUP;
+  if (str == "QUIT")
+    return SIGQUIT;
+  if (str == "USR1")
+    return SIGUSR1;
+  if (str == "USR2")
+    return SIGUSR2;
+#endif
+  throw std::runtime_error(fmt::format("invalid signal: \"{}\"", name));
+}
+
+inline void timer_wheel::insert(const timer& t, const std::uint64_t first)
+{
+  // the timers beyond the last level are kept in its farthest slot: they are inserted again when it expires
+  const std::uint64_t max_delta = (std::uint64_t(1) << shift(g_levels)) - 1;
+  const std::uint64_t tick = std::min(std::max(t.tick, first), m_now + max_delta);
+  const std::uint64_t delta = tick - m_now;
+  unsigned level = 0;
+  while ((level + 1 < g_levels) && (delta >= (std::uint64_t(1) << shift(level + 1))))
+    ++level;
+  m_slots[level][(tick >> shift(level)) & mask(level)].push_back(t);
+}
+
+inline void timer_wheel::add(const std::uint64_t tick, const std::uint64_t value)
+{
+  insert(timer{ tick, value }, m_now + 1);
+  ++m_count;
+}
+
+template <typename F>
+inline void timer_wheel::advance(const std::uint64_t tick, F&& f)
+{
+  while (m_now < tick)
+  {
+    // the slots of the higher levels are moved to the lower levels when the lower level wraps
+    //  relative to the processed tick: its own slot of the first level is expired just after
+    ++m_now;
+    for (unsigned level = 1; (level < g_levels) && !(m_now & ((std::uint64_t(1) << shift(level)) - 1)); ++level)
+    {
+      std::vector<timer> timers;
+      timers.swap(m_slots[level][(m_now >> shift(level)) & mask(level)]);
+      for (const auto& t : timers)
+        insert(t, m_now);
+    }
+
+    std::vector<timer> timers;
+    timers.swap(m_slots[0][m_now & mask(0)]);
+    for (const auto& t : timers)
+    {
+      if (t.tick > m_now)
+      {
+        insert(t, m_now + 1);
+        continue;
+      }
+      --m_count;
+      f(t.value, t.tick);
+    }
+  }
+}
+
+inline std::uint64_t timer_wheel::next_tick() const
+{
+  // a timer of the first level or the next wrap of the first level (move of the higher levels)
+  for (std::uint64_t tick = m_now + 1; ; ++tick)
+  {
+    if (!m_slots[0][tick & mask(0)].empty() || !(tick & mask(0)))
+      return tick;
+  }
+}
+
+inline watchdog::watchdog() :
+  m_origin(clock::now()),
+  m_sleep_until(clock::time_point::max())
+{
+#ifndef _WIN32
+  if (::pipe2(m_wake_fds, O_CLOEXEC | O_NONBLOCK) == -1)
+    throw std::runtime_error(fmt::format("can't create the watchdog: {}", std::strerror(errno)));
+#endif
+  m_thread = std::thread([this]() { run(); });
+}
+
+inline watchdog::~watchdog()
+{
+  {
+    std::lock_guard<std::mutex> lck(m_mtx);
+    m_stop = true;
+  }
+  wake();
+  m_thread.join();
+#ifndef _WIN32
+  ::close(m_wake_fds[0]);
+  ::close(m_wake_fds[1]);
+#endif
+}
+
+inline std::uint64_t watchdog::to_tick(const clock::time_point& t) const
+{
+  // rounded up: a timer never expires before its time
+  if (t <= m_origin)
+    return 0;
+  return static_cast<std::uint64_t>((t - m_origin + g_tick - clock::duration(1)) / g_tick);
+}
+
+inline watchdog::clock::time_point watchdog::to_time(const std::uint64_t tick) const
+{
+  return m_origin + g_tick * tick;
+}
+
+inline void watchdog::arm(const std::uint64_t id, entry& e, const clock::time_point& t)
+{
+  e.armed = std::max(to_tick(t), m_wheel.now() + 1);
+  m_wheel.add(e.armed, id);
+  if (to_time(e.armed) < m_sleep_until)
+  {
+    m_sleep_until = to_time(e.armed);
+    wake();
+  }
+}
+
+inline void watchdog::escalate(const std::uint64_t id, entry& e, const std::string& reason, const bool cancelled, const bool kill)
+{
+  if (e.reason.empty())
+  {
+    e.reason = reason;
+    e.cancelled = cancelled;
+  }
+  const clock::time_point now = clock::now();
+  if (kill || !e.options.signal || !e.options.grace.count())
+  {
+    // hard kill of the process and its children - repeated while the process is registered
+    e.runner->kill();
+    e.state = stage::killed;
+    arm(id, e, now + g_kill_retry);
+  }
+  else if (e.runner->send_signal(e.options.signal))
+  {
+    e.state = stage::terminating;
+    arm(id, e, now + e.options.grace);
+  }
+  else
+  {
+    // the process is not started yet: the signal is sent again at the next tick
+    arm(id, e, now);
+  }
+}
+
+inline void watchdog::expire(const std::uint64_t id, const std::uint64_t tick)
+{
+  const auto& it = m_entries.find(id);
+  if ((it == m_entries.end()) || (it->second.armed != tick))
+    return;
+  entry& e = it->second;
+  e.armed = 0;
+  if (e.state != stage::running)
+    return escalate(id, e, e.reason, e.cancelled, true);
+  if (!e.reason.empty())
+    return escalate(id, e, e.reason, e.cancelled, false);
+
+  // check the deadlines: the idle deadline is moved by the output received since the timer was armed
+  const clock::time_point now = clock::now();
+  clock::time_point next = clock::time_point::max();
+  if (e.options.timeout.count())
+  {
+    const clock::time_point deadline = e.start + e.options.timeout;
+    if (now >= deadline)
+      return escalate(id, e, fmt::format("timeout of {:.1f}s", e.options.timeout.count() / 1000.0), false, false);
+    next = deadline;
+  }
+  if (e.options.idle_timeout.count())
+  {
+    const clock::time_point deadline = clock::time_point(clock::duration(e.last_output.load())) + e.options.idle_timeout;
+    if (now >= deadline)
+      return escalate(id, e, fmt::format("no output for {:.1f}s", e.options.idle_timeout.count() / 1000.0), false, false);
+    next = std::min(next, deadline);
+  }
+  if (next != clock::time_point::max())
+    arm(id, e, next);
+}
+
+inline void watchdog::run()
+{
+  std::unique_lock<std::mutex> lck(m_mtx);
+  while (!m_stop)
+  {
+    // interruptions: cancel all the processes, then kill them at the second one
+    const int interrupts = m_interrupts.load();
+    if (interrupts != m_handled_interrupts)
+    {
+      const bool first = !m_handled_interrupts;
+      m_handled_interrupts = interrupts;
+      m_cancelled = true;
+      for (auto& [id, e] : m_entries)
+        if ((e.state == stage::running) || !first)
+          escalate(id, e, "interrupted by the user", true, !first);
+      if (first && m_on_interrupt)
+      {
+        const std::function<void()> fct = m_on_interrupt;
+        lck.unlock();
+        fct();
+        lck.lock();
+      }
+      continue;
+    }
+
+    // expire the timers then sleep until the next one
+    m_wheel.advance(to_tick(clock::now()), [&](const std::uint64_t id, const std::uint64_t tick) { expire(id, tick); });
+    m_sleep_until = m_wheel.empty() ? clock::time_point::max() : to_time(m_wheel.next_tick());
+    const clock::time_point until = m_sleep_until;
+    lck.unlock();
+    wait(until);
+    lck.lock();
+  }
+}
+
+inline void watchdog::wake()
+{
+#ifdef _WIN32
+  {
+    std::lock_guard<std::mutex> lck(m_wake_mtx);
+    m_woken = true;
+  }
+  m_cv.notify_one();
+#else
+  const char c = 0;
+  const ssize_t n = ::write(m_wake_fds[1], &c, 1);
+  (void)n;
+#endif
+}
+
+inline void watchdog::wait(const clock::time_point& until)
+{
+#ifdef _WIN32
+  std::unique_lock<std::mutex> lck(m_wake_mtx);
+  if (until == clock::time_point::max())
+    m_cv.wait(lck, [&]() { return m_woken; });
+  else
+    m_cv.wait_until(lck, until, [&]() { return m_woken; });
+  m_woken = false;
+#else
+  int timeout = -1;
+  if (until != clock::time_point::max())
+  {
+    const auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(until - clock::now()).count();
+    timeout = static_cast<int>(std::max<long long>(0, std::min<long long>(remaining + 1, 60000)));
+  }
+  pollfd pfd{ m_wake_fds[0], POLLIN, 0 };
+  if (::poll(&pfd, 1, timeout) > 0)
+  {
+    char buffer[64];
+    while (::read(m_wake_fds[0], buffer, sizeof(buffer)) > 0)
+      ;
+  }
+#endif
+}
+
+inline void watchdog::cancel(const std::string& reason)
+{
+  std::lock_guard<std::mutex> lck(m_mtx);
+  m_cancelled = true;
+  for (auto& [id, e] : m_entries)
+    if (e.state == stage::running)
+      escalate(id, e, reason, true, false);
+}
+
+inline void watchdog::interrupt()
+{
+  m_interrupts.fetch_add(1);
+#ifdef _WIN32
+  // the console handlers are executed by their own thread on Windows
+  wake();
+#else
+  const char c = 0;
+  const ssize_t n = ::write(m_wake_fds[1], &c, 1);
+  (void)n;
+#endif
+}
+
+inline void watchdog::on_interrupt(const std::function<void()>& fct)
+{
+  std::lock_guard<std::mutex> lck(m_mtx);
+  m_on_interrupt = fct;
+}
+
+inline watchdog::watch::watch(watchdog& dog, process_runner& runner, const watch_options& options) :
+  m_dog(dog)
+{
+  std::lock_guard<std::mutex> lck(dog.m_mtx);
+  m_id = dog.m_next_id++;
+  entry& e = dog.m_entries[m_id];
+  m_entry = &e;
+  e.runner = &runner;
+  e.options = options;
+  e.start = clock::now();
+  e.last_output = e.start.time_since_epoch().count();
+  if (dog.m_cancelled)
+    dog.escalate(m_id, e, "interrupted by the user", true, false);
+  else if (options.timeout.count() || options.idle_timeout.count())
+  {
+    const clock::time_point t = e.start + std::min(options.timeout.count() ? options.timeout : options.idle_timeout,
+                                                   options.idle_timeout.count() ? options.idle_timeout : options.timeout);
+    dog.arm(m_id, e, t);
+  }
+}
+
+inline watchdog::watch::~watch()
+{
+  std::lock_guard<std::mutex> lck(m_dog.m_mtx);
+  m_dog.m_entries.erase(m_id);
+}
+
+inline void watchdog::watch::touch()
+{
+  // no lock: the entry is only erased by the destructor of the watch
+  m_entry->last_output.store(clock::now().time_since_epoch().count(), std::memory_order_relaxed);
+}
+
+inline std::string watchdog::watch::reason() const
+{
+  std::lock_guard<std::mutex> lck(m_dog.m_mtx);
+  return m_entry->reason;
+}
+
+inline bool watchdog::watch::cancelled() const
+{
+  std::lock_guard<std::mutex> lck(m_dog.m_mtx);
+  return m_entry->cancelled;
+}
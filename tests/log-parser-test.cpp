@@ -0,0 +1,243 @@
+#include <string>
+#include <vector>
+#include <map>
+#include <tuple>
+#include <optional>
+#include <memory>
+#include <random>
+#include <regex>
+#include <cstdlib>
+#include <fmt/core.h>
+#include "log-parser.hpp"
+
+/*============================================
+| Declaration
+==============================================*/
+// number of random regexes checked against std::regex - each one on several texts
+constexpr std::size_t g_random_regexes = 500;
+constexpr std::size_t g_random_texts = 8;
+
+// bytes of the random texts and regexes
+const std::string g_alphabet = "ab1/. ";
+
+/*============================================
+| Function definitions
+==============================================*/
+// expected value of a variable: matches of the regex searched by std::regex as the ECMAScript global search
+//  (the next search starts at the end of the match - at the next byte after an empty match)
+//  value of the first capture group (the whole match if none) - nullopt if not found
+std::optional<std::string> expected(const std::string& regex, const std::string& text, const pattern_spec::match_mode mode, const std::string& separator)
+{
+  const std::regex re(regex, std::regex::ECMAScript);
+  std::optional<std::string> value;
+  std::size_t pos = 0;
+  while (pos <= text.size())
+  {
+    std::smatch sm;
+    if (!std::regex_search(text.cbegin() + static_cast<std::ptrdiff_t>(pos), text.cend(), sm, re,
+                           pos ? std::regex_constants::match_prev_avail : std::regex_constants::match_default))
+      break;
+    const std::string v = (sm.size() > 1) ? sm.str(1) : sm.str(0);
+    if (mode == pattern_spec::match_mode::all)
+      value = value ? *value + separator + v : v;
+    else if ((mode == pattern_spec::match_mode::last) || !value)
+      value = v;
+    if (mode == pattern_spec::match_mode::first)
+      break;
+    const std::size_t end = pos + static_cast<std::size_t>(sm.position(0) + sm.length(0));
+    pos = sm.length(0) ? end : end + 1;
+  }
+  if (!value && (mode == pattern_spec::match_mode::all))
+    value = "";
+  return value;
+}
+
+// random regex: a single capture group, never repeated (the captures of the repetitions differ between engines)
+//  the groups are only repeated a bounded number of times: std::regex backtracks exponentially on the nested repetitions
+class regex_generator
+{
+public:
+  explicit regex_generator(std::mt19937& rng) : m_rng(rng) {}
+
+  std::string generate()
+  {
+    std::string regex = pick(3) ? sequence(2) : "";
+    regex += "(" + alternation(2) + ")";
+    if (pick(2))
+      regex += sequence(2);
+    return regex;
+  }
+
+private:
+  std::size_t pick(const std::size_t n) { return m_rng() % n; }
+
+  std::string alternation(const std::size_t depth)
+  {
+    std::string str = sequence(depth);
+    while (!pick(4))
+      str += "|" + sequence(depth);
+    return str;
+  }
+
+  std::string sequence(const std::size_t depth)
+  {
+    std::string str;
+    const std::size_t count = 1 + pick(3);
+    for (std::size_t i = 0; i < count; ++i)
+      str += quantified(depth);
+    return str;
+  }
+
+  std::string quantified(const std::size_t depth)
+  {
+    static const std::vector<std::string> quantifiers = { "*", "+", "?", "{1,2}", "{2}", "{0,}" };
+    static const std::vector<std::string> bounded = { "?", "{1,2}", "{2}" };
+
+    // the assertions can't be repeated
+    std::string str = atom(depth);
+    if (pick(2) && (str != "^") && (str != "$") && (str != "\\b") && (str != "\\B"))
+    {
+      const std::vector<std::string>& q = (str[0] == '(') ? bounded : quantifiers;
+      str += q[pick(q.size())];
+      if (!pick(3))
+        str += "?";
+    }
+    return str;
+  }
+
+  std::string atom(const std::size_t depth)
+  {
+    static const std::vector<std::string> atoms = { "a", "b", "1", "/", "\\.", " ", ".", "[ab]", "[^a]", "\\d", "\\w", "\\s" };
+    static const std::vector<std::string> assertions = { "^", "$", "\\b", "\\B" };
+    if (depth && !pick(5))
+      return "(?:" + alternation(depth - 1) + ")";
+    if (!pick(12))
+      return assertions[pick(assertions.size())];
+    return atoms[pick(atoms.size())];
+  }
+
+private:
+  std::mt19937& m_rng;
+};
+
+// extract the variables of a text split in random chunks (with new-lines removed by the parser)
+std::map<std::string, std::string> extract(const std::vector<pattern_spec>& specs, const std::string& text, std::mt19937& rng)
+{
+  log_parser parser(std::make_shared<const pattern_set>(specs), 64 * 1024);
+  for (std::size_t pos = 0; pos < text.size(); )
+  {
+    const std::size_t size = 1 + rng() % 7;
+    std::string chunk = text.substr(pos, size);
+    if (!(rng() % 4))
+      chunk.insert(rng() % (chunk.size() + 1), "\r\n");
+    parser.parse(chunk);
+    pos += size;
+  }
+  parser.finish();
+  return parser.variables();
+}
+
+int main(int argc, char** argv)
+{
+  std::mt19937 rng((argc > 1) ? static_cast<unsigned>(std::atoi(argv[1])) : 20201u);
+  std::size_t checks = 0;
+  std::size_t failures = 0;
+  auto check = [&](const pattern_spec& spec, const std::optional<std::string>& value, const std::optional<std::string>& expect, const std::string& text) -> void {
+    ++checks;
+    if (value == expect)
+      return;
+    if (++failures <= 20)
+      fmt::print("FAIL regex \"{}\" ({}) on \"{}\": expected {}, got {}\n",
+        spec.regex,
+        (spec.mode == pattern_spec::match_mode::first) ? "first" : (spec.mode == pattern_spec::match_mode::last) ? "last" : "all",
+        text,
+        expect ? "\"" + *expect + "\"" : "none",
+        value ? "\"" + *value + "\"" : "none");
+  };
+  auto find = [](const std::map<std::string, std::string>& vars, const std::string& key) -> std::optional<std::string> {
+    const auto& it = vars.find(key);
+    return (it != vars.end()) ? std::optional<std::string>(it->second) : std::nullopt;
+  };
+
+  // known cases: a pending match kept while a greedy thread continues, priorities of the alternations
+  const std::vector<std::tuple<std::string, std::string, std::string>> cases = {
+    { "path=(.*)/", "path=/usr/bin/gcc", "/usr/bin" },
+    { "version (.+)\\.", "version 1.2.3-rc", "1.2" },
+    { "(1|.+aa)", "xaacc1", "xaa" },
+    { "(a+?)b", "aaab", "aaa" },
+    { "(ab|a)(c|bcd)", "abcd", "ab" } };
+  for (const auto& [regex, text, value] : cases)
+  {
+    const pattern_spec spec{ "v", regex };
+    check(spec, find(extract({ spec }, text, rng), "v"), value, text);
+  }
+
+  // batches of a "foreach" task: parsed apart, then merged by order of the batches
+  {
+    const std::vector<pattern_spec> specs = {
+      { "first", "v=(\\d);" },
+      { "last", "v=(\\d);", pattern_spec::match_mode::last },
+      { "all", "v=(\\d);", pattern_spec::match_mode::all, "," },
+      { "none", "x=(\\d);", pattern_spec::match_mode::all, "," } };
+    const std::vector<std::string> batches = { "v=1;", "", "v=2;v=3;" };
+    const auto set = std::make_shared<const pattern_set>(specs);
+    log_parser merged(set, 64 * 1024);
+    for (const auto& text : batches)
+    {
+      log_parser batch(set, 64 * 1024);
+      batch.parse(text);
+      batch.finish();
+      merged.merge(batch);
+    }
+    const std::string text = "v=1;|v=2;v=3;";
+    check(specs[0], find(merged.variables(), "first"), "1", text);
+    check(specs[1], find(merged.variables(), "last"), "3", text);
+    check(specs[2], find(merged.variables(), "all"), "1,2,3", text);
+    check(specs[3], find(merged.variables(), "none"), "", text);
+  }
+
+  // syntax checked without compiling: the unsupported regexes are rejected
+  const std::vector<std::pair<std::string, std::string>> syntax = {
+    { "(a|b)+c{2,3}", "accepted" },
+    { "(a)\\1", "rejected" },
+    { "a(?=b)", "rejected" },
+    { "(a", "rejected" },
+    { "a)", "rejected" },
+    { "[b-a]", "rejected" } };
+  for (const auto& [regex, expect] : syntax)
+  {
+    const pattern_spec spec{ "v", regex };
+    std::string result = "accepted";
+    try
+    {
+      pattern_set({ spec }).check();
+    }
+    catch (const std::exception&)
+    {
+      result = "rejected";
+    }
+    check(spec, result, expect, "");
+  }
+
+  // random regexes, modes and texts: several regexes are searched at once
+  regex_generator generator(rng);
+  for (std::size_t i = 0; i < g_random_regexes; ++i)
+  {
+    std::vector<pattern_spec> specs;
+    const std::size_t count = 1 + rng() % 3;
+    for (std::size_t k = 0; k < count; ++k)
+      specs.push_back(pattern_spec{ fmt::format("v{}", k), generator.generate(), static_cast<pattern_spec::match_mode>(rng() % 3), "," });
+    for (std::size_t t = 0; t < g_random_texts; ++t)
+    {
+      std::string text;
+      const std::size_t size = rng() % 40;
+      for (std::size_t c = 0; c < size; ++c)
+        text += g_alphabet[rng() % g_alphabet.size()];
+      const std::map<std::string, std::string> vars = extract(specs, text, rng);
+      for (const auto& spec : specs)
+        check(spec, find(vars, spec.key), expected(spec.regex, text, spec.mode, spec.separator), text);
+    }
+  }
+  fmt::print("{} checks, {} failures\n", checks, failures);
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,301 @@
+#include <string>
+#include <vector>
+#include <map>
+#include <optional>
+#include <random>
+#include <regex>
+#include <filesystem>
+#include <algorithm>
+#include <stdexcept>
+#include <cstdlib>
+#include <fmt/core.h>
+#include "var-template.hpp"
+
+/*============================================
+| Declaration
+==============================================*/
+// number of random templates checked against the regex implementation - each one with several sets of variables
+constexpr std::size_t g_random_templates = 500;
+constexpr std::size_t g_random_variables = 4;
+
+// maximum number of replacements of the regex implementation: it never ends on a self-reference
+constexpr std::size_t g_max_replacements = 1000;
+
+// bytes of the random texts: the characters of the patterns are only generated as whole patterns
+const std::string g_alphabet = "ab/. ";
+
+/*============================================
+| Function definitions
+==============================================*/
+// regex implementation of the variables replacement (before var_template) - the loops are bounded
+const std::string replace_string(const std::string& str,
+                                 const std::string& old_value,
+                                 const std::string& new_value)
+{
+  const std::size_t pos = str.find(old_value);
+  if (pos != std::string::npos)
+  {
+    std::string new_str = str.substr(0, pos);
+    new_str += new_value;
+    new_str += str.substr(pos + old_value.size());
+    return new_str;
+  }
+  return str;
+}
+
+bool replace_vars(std::string& str,
+                  const std::map<std::string, std::string>& variables,
+                  const std::string& old_value,
+                  const std::string& key,
+                  const char old_char = 0,
+                  const char new_char = 0)
+{
+  const auto& it = variables.find(key);
+  if (it == variables.end())
+    return false;
+  std::string new_value = it->second;
+  if (old_char != 0 && new_char != 0)
+    std::replace(new_value.begin(), new_value.end(), old_char, new_char);
+  str = replace_string(str, old_value, new_value);
+  return true;
+}
+
+const std::string update_var(const std::string& str,
+                             const std::map<std::string, std::string>& variables)
+{
+  std::size_t replacements = 0;
+  auto bound = [&](const std::string& current) -> void {
+    if (++replacements > g_max_replacements)
+      throw std::runtime_error(fmt::format("this pattern can't be replaced: \"{}\"", current));
+  };
+
+  // replace sub-string with pattern ${xxx, 'x', 'y'} by their corresponding variable value
+  std::string new_str = str;
+  {
+    std::regex replace_pattern(R"(\$\{([^,\}]+),[^']'(.)',[^']'(.)'\})");
+    do
+    {
+      auto rit = std::sregex_iterator(new_str.begin(), new_str.end(), replace_pattern);
+      if (rit == std::sregex_iterator())
+        break;
+      bound(new_str);
+      const std::string old_value = rit->str(0);
+      const std::string key = rit->str(1);
+      const char old_char = rit->str(2).at(0);
+      const char new_char = rit->str(3).at(0);
+      if (!replace_vars(new_str, variables, old_value, key, old_char, new_char))
+        throw std::runtime_error(fmt::format("missing variable: ${{{}}}", key));
+    } while (true);
+  }
+
+  // replace sub-string with pattern ${xxx} by their corresponding variable value
+  {
+    std::regex replace_pattern(R"(\$\{(.*?)\})");
+    do
+    {
+      auto rit = std::sregex_iterator(new_str.begin(), new_str.end(), replace_pattern);
+      if (rit == std::sregex_iterator())
+        break;
+      bound(new_str);
+      const std::string old_value = rit->str(0);
+      const std::string key = rit->str(1);
+      if (!replace_vars(new_str, variables, old_value, key))
+        throw std::runtime_error(fmt::format("missing variable: ${{{}}}", key));
+    } while (true);
+  }
+
+  // there shouldn't be any sub-string with pattern ${xxx}
+  if (std::regex_search(new_str, std::regex(R"(\$\{.*?\})")))
+    throw std::runtime_error(fmt::format("this pattern can't be replaced: \"{}\"", new_str));
+
+  // replace sub-string with pattern $[xxx] or $<xxx> by the absolute path with quotes
+  {
+    std::regex replace_pattern(R"(\$([\[<])(.*?)([\]>]))");
+    do
+    {
+      auto rit = std::sregex_iterator(new_str.begin(), new_str.end(), replace_pattern);
+      if (rit == std::sregex_iterator())
+        break;
+      const std::string old_value = rit->str(0);
+      std::string key = rit->str(2);
+      key.erase(std::remove(key.begin(), key.end(), '\"'), key.end());
+      key.erase(std::remove(key.begin(), key.end(), '\''), key.end());
+      char quote;
+      if (rit->str(1).at(0) == '[' && rit->str(3).at(0) == ']')
+        quote = '\"';
+      else if (rit->str(1).at(0) == '<' && rit->str(3).at(0) == '>')
+        quote = '\'';
+      else
+        throw std::runtime_error(fmt::format("wrong pattern detected: \"{}\"", old_value));
+      new_str = replace_string(new_str, old_value, quote + std::filesystem::absolute(std::filesystem::path(key)).string() + quote);
+      new_str = utf8::from_utf8(new_str);
+    } while (true);
+  }
+
+  return new_str;
+}
+
+// random templates and values: plain variables (p*) have a plain text value, nested variables (n*) reference
+//  the next ones - both implementations differ when the patterns are built across the replaced values, so:
+//  the values never contain a replace-form (rejected by the regex implementation when reached by ${xxx}),
+//  the paths only contain plain variables (a path in a path is closed by the first ']' or '>')
+//  and an unclosed path is only at the end of the template (its content would be the replaced values)
+class template_generator
+{
+public:
+  explicit template_generator(std::mt19937& rng) : m_rng(rng) {}
+
+  // template: text, variables, replace-forms, paths and incomplete patterns
+  std::string generate()
+  {
+    static const std::vector<std::string> incomplete = { "$", "${", "${p0", "$x" };
+    static const std::vector<std::string> unclosed = { "$[", "$<", "$[a" };
+    std::string str;
+    const std::size_t count = pick(6);
+    for (std::size_t i = 0; i < count; ++i)
+    {
+      switch (pick(8))
+      {
+      case 0: str += text(); break;
+      case 1: str += fmt::format("${{p{}}}", pick(3)); break;
+      case 2: str += fmt::format("${{n{}}}", pick(3)); break;
+      case 3: str += fmt::format("${{{}{}, '{}', '{}'}}", pick(2) ? 'p' : 'n', pick(3), letter(), letter()); break;
+      case 4: str += path(); break;
+      case 5: str += (pick(4) ? text() : "${missing}"); break;
+      case 6: str += (pick(4) ? text() : "$[a/b>"); break;
+      default: str += incomplete[pick(incomplete.size())]; break;
+      }
+    }
+    if (!pick(4))
+      str += unclosed[pick(unclosed.size())];
+    return str + " ";
+  }
+
+  // variables: p0-p2 plain, n0-n2 nested (n0 -> n1 -> n2 -> plain)
+  std::map<std::string, std::string> variables()
+  {
+    std::map<std::string, std::string> vars;
+    for (std::size_t i = 0; i < 3; ++i)
+      vars[fmt::format("p{}", i)] = text();
+    for (std::size_t i = 0; i < 3; ++i)
+    {
+      std::string value = text();
+      if (i < 2)
+        value += fmt::format("${{n{}}}", i + 1 + pick(2 - i));
+      value += fmt::format("${{p{}}}", pick(3));
+      if (!pick(3))
+        value += path();
+      vars[fmt::format("n{}", i)] = value + text();
+    }
+    return vars;
+  }
+
+private:
+  std::size_t pick(const std::size_t n) { return m_rng() % n; }
+  char letter() { return "ab/."[pick(4)]; }
+
+  std::string text()
+  {
+    std::string str;
+    const std::size_t size = pick(4);
+    for (std::size_t i = 0; i < size; ++i)
+      str += g_alphabet[pick(g_alphabet.size())];
+    return str;
+  }
+
+  std::string path()
+  {
+    const std::string content = text() + (pick(2) ? fmt::format("${{p{}}}", pick(3)) : "") + "f";
+    return pick(2) ? "$[" + content + "]" : "$<" + content + ">";
+  }
+
+private:
+  std::mt19937& m_rng;
+};
+
+// result of a replacement: the replaced string - nullopt if an error is thrown
+template <typename F>
+std::optional<std::string> result(F&& f)
+{
+  try
+  {
+    return f();
+  }
+  catch (const std::exception&)
+  {
+    return std::nullopt;
+  }
+}
+
+int main(int argc, char** argv)
+{
+  std::mt19937 rng((argc > 1) ? static_cast<unsigned>(std::atoi(argv[1])) : 20201u);
+  std::size_t checks = 0;
+  std::size_t failures = 0;
+  auto check = [&](const std::string& str, const std::map<std::string, std::string>& variables) -> void {
+    var_map map;
+    for (const auto& [key, value] : variables)
+      map.set(key, value);
+    const var_env vars = var_env().push(map);
+    const std::optional<std::string> expect = result([&]() { return update_var(str, variables); });
+    const std::optional<std::string> value = result([&]() { return var_template(str).render(vars); });
+    ++checks;
+    if (value == expect)
+      return;
+    std::string defined;
+    for (const auto& [key, v] : variables)
+      defined += fmt::format(" {}=\"{}\"", key, v);
+    if (++failures <= 20)
+      fmt::print("FAIL template \"{}\" with{}: expected {}, got {}\n",
+        str,
+        defined,
+        expect ? "\"" + *expect + "\"" : "error",
+        value ? "\"" + *value + "\"" : "error");
+  };
+
+  // known cases: nested variables, replace-forms, paths, self-references and errors
+  const std::map<std::string, std::string> vars = {
+    { "a", "A" },
+    { "dir", "out/bin" },
+    { "list", "x;y;z" },
+    { "nested", "<${a}>" },
+    { "deeper", "${nested}-${list}" },
+    { "path", "$[${dir}/f]" },
+    { "self", "${self}" },
+    { "ping", "1${pong}" },
+    { "pong", "2${ping}" } };
+  const std::vector<std::string> cases = {
+    "${a}",
+    "x${a}y${a}z",
+    "${nested}",
+    "${deeper}",
+    "${list, ';', ' '}",
+    "${nested, 'A', 'B'}",
+    "${deeper, '-', '+'}",
+    "$[${dir}]",
+    "$<${dir}/${a}>",
+    "${path}",
+    "cd $[${dir}] && run $<f>",
+    "$[a/b>",
+    "${self}",
+    "${ping}",
+    "${missing}",
+    "${}",
+    "${a",
+    "$[a",
+    "$${a}",
+    "100$ ${a}" };
+  for (const auto& str : cases)
+    check(str, vars);
+
+  // random templates with several sets of variables
+  template_generator generator(rng);
+  for (std::size_t i = 0; i < g_random_templates; ++i)
+  {
+    const std::string str = generator.generate();
+    for (std::size_t v = 0; v < g_random_variables; ++v)
+      check(str, generator.variables());
+  }
+  fmt::print("{} checks, {} failures\n", checks, failures);
+  return failures ? 1 : 0;
+}